@@ -69,6 +69,15 @@ struct Buf {
   std::vector<llvm::Type*> asLLVMType(ast::IRBuilderBPF& b, uint32_t length);
 } __attribute__((packed));
 
+// Locates a string argument within a format string record. Rather than being
+// sent at their full size, strings are packed after the fixed-size part of
+// the record with only the bytes that were actually read, and their slot in
+// the fixed-size part holds this reference instead.
+struct StringRef {
+  uint32_t offset; // From the start of the arguments.
+  uint32_t length; // Including the NUL byte, if any.
+} __attribute__((packed));
+
 struct RuntimeError {
   uint64_t action_id;
   uint64_t error_id;
@@ -1,5 +1,7 @@
 #include "ast/context.h"
 
+#include <algorithm>
+
 #include "ast/ast.h"
 #include "ast/diagnostic.h"
 
@@ -91,6 +93,39 @@ ASTContext::ASTContext() : ASTContext("", "")
 {
 }
 
+NodeArena::~NodeArena()
+{
+  clear();
+}
+
+void NodeArena::clear()
+{
+  // Destroy in the reverse order of creation, like a stack of allocations.
+  for (auto it = nodes_.rbegin(); it != nodes_.rend(); ++it) {
+    (*it)->~Node();
+  }
+  nodes_.clear();
+  blocks_.clear();
+  next_ = nullptr;
+  available_ = 0;
+}
+
+void *NodeArena::allocate(size_t size, size_t align)
+{
+  void *ptr = next_;
+  if (!ptr || !std::align(align, size, ptr, available_)) {
+    // Oversized nodes get a block of their own.
+    size_t block_size = std::max(BLOCK_SIZE, size + align);
+    blocks_.push_back(std::make_unique_for_overwrite<std::byte[]>(block_size));
+    ptr = blocks_.back().get();
+    available_ = block_size;
+    ptr = std::align(align, size, ptr, available_);
+  }
+  next_ = static_cast<std::byte *>(ptr) + size;
+  available_ -= size;
+  return ptr;
+}
+
 void ASTContext::clear()
 {
   root = nullptr;
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstddef>
 #include <map>
 #include <memory>
+#include <new>
 #include <variant>
 #include <vector>
 
@@ -81,6 +83,47 @@ private:
   friend class ASTContext;
 };
 
+// Bump allocator backing the AST nodes.
+//
+// Nodes are constructed in place into large blocks rather than allocated one
+// at a time. This avoids an allocation per node, and keeps nodes that are
+// created together (by the parser, or by cloning a subtree) next to each
+// other in memory. Nodes are never freed individually: all of them are
+// destroyed, in reverse order of creation, when the arena is cleared.
+class NodeArena {
+public:
+  NodeArena() = default;
+  NodeArena(const NodeArena &other) = delete;
+  NodeArena &operator=(const NodeArena &other) = delete;
+  ~NodeArena();
+
+  template <NodeType T, typename... Args>
+  T *create(Args &&...args)
+  {
+    void *mem = allocate(sizeof(T), alignof(T));
+    auto *node = new (mem) T(std::forward<Args>(args)...);
+    nodes_.push_back(node);
+    return node;
+  }
+
+  size_t size() const
+  {
+    return nodes_.size();
+  }
+
+  void clear();
+
+private:
+  void *allocate(size_t size, size_t align);
+
+  static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+  std::vector<std::unique_ptr<std::byte[]>> blocks_;
+  std::byte *next_ = nullptr;
+  size_t available_ = 0;
+  std::vector<Node *> nodes_;
+};
+
 // Manages the lifetime of AST nodes.
 //
 // Nodes allocated by an ASTContext will be kept alive for the duration of the
@@ -96,12 +139,9 @@ public:
   template <NodeType T, typename... Args>
   constexpr T *make_node(Location &&loc, Args... args)
   {
-    auto uniq_ptr = std::make_unique<T>(*this,
-                                        std::move(loc),
-                                        std::forward<Args>(args)...);
-    auto *raw_ptr = uniq_ptr.get();
-    state_->nodes_.push_back(std::move(uniq_ptr));
-    return raw_ptr;
+    return state_->nodes_.create<T>(*this,
+                                    std::move(loc),
+                                    std::forward<Args>(args)...);
   }
 
   template <NodeType T, typename... Args>
@@ -134,10 +174,7 @@ public:
     if (other == nullptr) {
       return nullptr;
     }
-    auto uniq_ptr = std::make_unique<T>(*this, loc, *other);
-    auto *raw_ptr = uniq_ptr.get();
-    state_->nodes_.push_back(std::move(uniq_ptr));
-    return raw_ptr;
+    return state_->nodes_.create<T>(*this, loc, *other);
   }
 
   unsigned int node_count()
@@ -192,7 +229,7 @@ private:
   class State {
   public:
     State();
-    std::vector<std::unique_ptr<Node>> nodes_;
+    NodeArena nodes_;
     std::unique_ptr<Diagnostics> diagnostics_;
     MetadataIndex::InternalMap metadata_;
   };
@@ -1,6 +1,7 @@
 #include <filesystem>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Transforms/Utils/Local.h>
 
 #include "arch/arch.h"
 #include "ast/async_event_types.h"
@@ -17,6 +18,20 @@
 namespace bpftrace::ast {
 
 namespace {
+// Returns the contents of a string literal, as emitted by
+// CodegenLLVM::visit(String &), if `val` refers to one. Only constant globals
+// qualify: anything else may be written to before the comparison runs.
+std::optional<std::string_view> getStringLiteral(Value *val)
+{
+  auto *var = dyn_cast<GlobalVariable>(val);
+  if (!var || !var->isConstant() || !var->hasInitializer())
+    return std::nullopt;
+  auto *data = dyn_cast<ConstantDataArray>(var->getInitializer());
+  if (!data || !data->isString())
+    return std::nullopt;
+  return std::string_view(data->getAsString());
+}
+
 std::string_view probeReadHelperName(bpf_func_id id)
 {
   switch (id) {
@@ -150,7 +165,9 @@ StructType *IRBuilderBPF::GetStackStructType(const StackType &stack_type)
   // If the offset changes, make sure to also change the codegen for "stack_len"
   elements.emplace_back(getInt64Ty()); // nr_stack_frames
 
-  if (stack_type.mode == StackMode::build_id) {
+  if (stack_type.interned) {
+    elements.emplace_back(getInt64Ty()); // stack id, see table_name()
+  } else if (stack_type.mode == StackMode::build_id) {
     // struct bpf_stack_build_id {
     //   __s32		status;
     //   unsigned char	build_id[BPF_BUILD_ID_SIZE];
@@ -532,7 +549,32 @@ CallInst *IRBuilderBPF::createCall(FunctionType *callee_type,
 
 Value *IRBuilderBPF::GetMapVar(const std::string &map_name)
 {
-  return module_.getGlobalVariable(bpf_map_name(map_name));
+  Value *map = module_.getGlobalVariable(bpf_map_name(map_name));
+  auto info = bpftrace_.resources.maps_info.find(map_name);
+  if (info == bpftrace_.resources.maps_info.end() ||
+      info->second.rotation_index == -1)
+    return map;
+
+  // A rotated map has two BPF maps, and probes update the one selected by its
+  // flag, which userspace flips. The flags are the same for all CPUs, so only
+  // the slots of the first CPU are used.
+  const auto global_name = std::string(bpftrace::globalvars::MAP_ROTATION);
+  const auto index = static_cast<size_t>(info->second.rotation_index);
+  bpftrace_.resources.global_vars.check_index(global_name,
+                                              bpftrace_.resources,
+                                              index);
+  auto sized_type = bpftrace_.resources.global_vars.get_sized_type(
+      global_name, bpftrace_.resources, *bpftrace_.config_);
+  Value *flag = CreateGEP(GetType(sized_type),
+                          module_.getGlobalVariable(global_name),
+                          { getInt64(0), getInt64(0), getInt64(index) });
+  Value *rotated = CreateICmpNE(CreateLoad(getInt64Ty(), flag, "rotation"),
+                                getInt64(0),
+                                "rotated");
+  return CreateSelect(rotated,
+                      module_.getGlobalVariable(rotated_map_name(map_name)),
+                      map,
+                      "rotated_map");
 }
 
 Value *IRBuilderBPF::GetNull()
@@ -547,6 +589,13 @@ CallInst *IRBuilderBPF::CreateMapLookup(Map &map,
   return createMapLookup(map.ident, key, name);
 }
 
+CallInst *IRBuilderBPF::CreateMapLookup(const std::string &map_name,
+                                        Value *key,
+                                        const std::string &name)
+{
+  return createMapLookup(map_name, key, name);
+}
+
 CallInst *IRBuilderBPF::createMapLookup(const std::string &map_name,
                                         Value *key,
                                         const std::string &name)
@@ -598,12 +647,9 @@ Value *IRBuilderBPF::CreateGetStrAllocation(const std::string &name,
                           [](AsyncIds &async_ids) { return async_ids.str(); });
 }
 
-Value *IRBuilderBPF::CreateGetFmtStringArgsAllocation(StructType *struct_type,
-                                                      const std::string &name,
-                                                      const Location &loc)
+Value *IRBuilderBPF::CreateGetFmtStringArgsAllocation(const Location &loc)
 {
-  return createAllocation(
-      bpftrace::globalvars::FMT_STRINGS_BUFFER, struct_type, name, loc);
+  return createScratchBuffer(bpftrace::globalvars::FMT_STRINGS_BUFFER, loc, 0);
 }
 
 Value *IRBuilderBPF::CreateAnonStructAllocation(const SizedType &tuple_type,
@@ -632,11 +678,6 @@ Value *IRBuilderBPF::CreateCallStackAllocation(const SizedType &stack_type,
                           });
 }
 
-Value *IRBuilderBPF::CreateJoinAllocation(const Location &loc)
-{
-  return createScratchBuffer(bpftrace::globalvars::JOIN_BUFFER, loc, 0);
-}
-
 Value *IRBuilderBPF::CreateReadMapValueAllocation(const SizedType &value_type,
                                                   const std::string &name,
                                                   const Location &loc)
@@ -1221,49 +1262,26 @@ Value *IRBuilderBPF::CreateForEachMapElem(Map &map,
 void IRBuilderBPF::CreateCheckSetRecursion(const Location &loc,
                                            int early_exit_ret)
 {
-  const std::string map_ident = to_string(MapType::RecursionPrevention);
-
-  AllocaInst *key = CreateAllocaBPF(getInt32Ty(), "lookup_key");
-  CreateStore(getInt32(0), key);
-
-  CallInst *call = createMapLookup(map_ident, key);
-
-  llvm::Function *parent = GetInsertBlock()->getParent();
-  BasicBlock *lookup_success_block = BasicBlock::Create(module_.getContext(),
-                                                        "lookup_success",
-                                                        parent);
-  BasicBlock *lookup_failure_block = BasicBlock::Create(module_.getContext(),
-                                                        "lookup_failure",
-                                                        parent);
-  BasicBlock *merge_block = BasicBlock::Create(module_.getContext(),
-                                               "lookup_merge",
-                                               parent);
-
-  // Make the verifier happy with a null check even though the value should
-  // never be null for key 0.
-  Value *condition = CreateICmpNE(
-      CreateIntCast(call, getPtrTy(), true),
-      ConstantExpr::getCast(Instruction::IntToPtr, getInt64(0), getPtrTy()),
-      "map_lookup_cond");
-  CreateCondBr(condition, lookup_success_block, lookup_failure_block);
-
-  SetInsertPoint(lookup_success_block);
-
-  CreateLifetimeEnd(key);
-
-  // createMapLookup  returns an u8*
-  auto *cast = CreatePtrToInt(call, getInt64Ty(), "cast");
+  // The flag lives in a per-CPU slot of a global variable rather than in a
+  // map so that the check, which runs on every probe entry, needs no map
+  // lookup and no null check.
+  auto *flag = createScratchBuffer(bpftrace::globalvars::RECURSION_PREVENTION,
+                                   loc,
+                                   0);
 
   Value *prev_value = CREATE_ATOMIC_RMW(AtomicRMWInst::BinOp::Xchg,
-                                        cast,
+                                        flag,
                                         getInt64(1),
                                         8,
                                         AtomicOrdering::SequentiallyConsistent);
 
-  llvm::Function *set_parent = GetInsertBlock()->getParent();
+  llvm::Function *parent = GetInsertBlock()->getParent();
   BasicBlock *value_is_set_block = BasicBlock::Create(module_.getContext(),
                                                       "value_is_set",
-                                                      set_parent);
+                                                      parent);
+  BasicBlock *merge_block = BasicBlock::Create(module_.getContext(),
+                                               "value_merge",
+                                               parent);
   Value *set_condition = CreateICmpEQ(prev_value,
                                       getInt64(0),
                                       "value_set_condition");
@@ -1277,58 +1295,15 @@ void IRBuilderBPF::CreateCheckSetRecursion(const Location &loc,
   CreateIncEventLossCounter(loc);
   CreateRet(getInt64(early_exit_ret));
 
-  SetInsertPoint(lookup_failure_block);
-
-  CreateRuntimeError(RuntimeErrorId::CPU_COUNT_MISMATCH, loc);
-  CreateRet(getInt64(0));
-
   SetInsertPoint(merge_block);
 }
 
 void IRBuilderBPF::CreateUnSetRecursion(const Location &loc)
 {
-  const std::string map_ident = to_string(MapType::RecursionPrevention);
-
-  AllocaInst *key = CreateAllocaBPF(getInt32Ty(), "lookup_key");
-  CreateStore(getInt32(0), key);
-
-  CallInst *call = createMapLookup(map_ident, key);
-
-  llvm::Function *parent = GetInsertBlock()->getParent();
-  BasicBlock *lookup_success_block = BasicBlock::Create(module_.getContext(),
-                                                        "lookup_success",
-                                                        parent);
-  BasicBlock *lookup_failure_block = BasicBlock::Create(module_.getContext(),
-                                                        "lookup_failure",
-                                                        parent);
-  BasicBlock *merge_block = BasicBlock::Create(module_.getContext(),
-                                               "lookup_merge",
-                                               parent);
-
-  // Make the verifier happy with a null check even though the value should
-  // never be null for key 0.
-  Value *condition = CreateICmpNE(
-      CreateIntCast(call, getPtrTy(), true),
-      ConstantExpr::getCast(Instruction::IntToPtr, getInt64(0), getPtrTy()),
-      "map_lookup_cond");
-  CreateCondBr(condition, lookup_success_block, lookup_failure_block);
-
-  SetInsertPoint(lookup_success_block);
-
-  CreateLifetimeEnd(key);
-
-  // createMapLookup  returns an u8*
-  auto *cast = CreatePtrToInt(call, getInt64Ty(), "cast");
-  CreateStore(getInt64(0), cast);
-
-  CreateBr(merge_block);
-
-  SetInsertPoint(lookup_failure_block);
-
-  CreateRuntimeError(RuntimeErrorId::CPU_COUNT_MISMATCH, loc);
-  CreateBr(merge_block);
-
-  SetInsertPoint(merge_block);
+  auto *flag = createScratchBuffer(bpftrace::globalvars::RECURSION_PREVENTION,
+                                   loc,
+                                   0);
+  CreateStore(getInt64(0), flag);
 }
 
 void IRBuilderBPF::CreateProbeRead(Value *dst,
@@ -1404,19 +1379,32 @@ Value *IRBuilderBPF::CreateStrncmp(Value *str1,
                                    uint64_t n,
                                    bool inverse)
 {
-  // This function compares each character of the two strings. It returns 0
-  // if all are equal and 1 if any are different.
+  // This function compares the two strings up to n bytes or the first NULL
+  // in str1. It returns 0 if they are equal and 1 if they are different
+  // (inverted when `inverse` is set).
+  //
+  // When either side is a string literal, its contents are known at compile
+  // time and the comparison becomes a branch-free XOR of the other string
+  // against constant words.
+  if (auto literal = getStringLiteral(str2))
+    return CreateStrncmpLiteral(str1, *literal, n, inverse);
+  if (auto literal = getStringLiteral(str1))
+    return CreateStrncmpLiteral(str2, *literal, n, inverse);
+
+  // Otherwise compare a word at a time:
   //
   //  strcmp(String val1, String val2)
   //  {
-  //     for (size_t i = 0; i < n; i++)
+  //     for (size_t i = 0; i < n; i += sizeof(word))
   //     {
-  //
-  //       if (val1[i] != val2[i])
+  //       word l = val1[i], r = val2[i];
+  //       word z = (l - 0x0101..01) & ~l & 0x8080..80;  // NULL bytes in l
+  //       word mask = z ? z ^ (z - 1) : ~0;             // up to first NULL
+  //       if ((l ^ r) & mask)
   //       {
   //         return 1;
   //       }
-  //       if (val1[i] == NULL)
+  //       if (z)
   //       {
   //         break;
   //       }
@@ -1424,6 +1412,19 @@ Value *IRBuilderBPF::CreateStrncmp(Value *str1,
   //
   //     return 0;
   //  }
+  //
+  // The lowest set bit of z always marks the first NULL byte, so this is
+  // only valid on little-endian targets. Words are never wider than the
+  // known alignment of both strings; in the worst case this degrades to the
+  // byte-at-a-time loop.
+  const DataLayout &dl = module_.getDataLayout();
+  uint64_t word_size = 1;
+  if (dl.isLittleEndian()) {
+    word_size = std::min(
+        { getOrEnforceKnownAlignment(str1, MaybeAlign(8), dl).value(),
+          getOrEnforceKnownAlignment(str2, MaybeAlign(8), dl).value(),
+          static_cast<uint64_t>(8) });
+  }
 
   llvm::Function *parent = GetInsertBlock()->getParent();
   AllocaInst *store = CreateAllocaBPF(getInt64Ty(), "strcmp.result");
@@ -1436,32 +1437,55 @@ Value *IRBuilderBPF::CreateStrncmp(Value *str1,
 
   CreateStore(getInt64(inverse ? 0 : 1), store);
 
-  Value *null_byte = getInt8(0);
-  for (size_t i = 0; i < n; i++) {
-    BasicBlock *char_eq = BasicBlock::Create(module_.getContext(),
+  for (uint64_t i = 0; i < n;) {
+    uint64_t size = word_size;
+    while (i + size > n)
+      size /= 2;
+
+    BasicBlock *word_eq = BasicBlock::Create(module_.getContext(),
                                              "strcmp.loop",
                                              parent);
     BasicBlock *loop_null_check = BasicBlock::Create(module_.getContext(),
                                                      "strcmp.loop_null_cmp",
                                                      parent);
 
-    Value *l;
-    auto *ptr_l = CreateGEP(getInt8Ty(), str1, { getInt32(i) });
-    l = CreateLoad(getInt8Ty(), ptr_l);
-
-    Value *r;
-    auto *ptr_r = CreateGEP(getInt8Ty(), str2, { getInt32(i) });
-    r = CreateLoad(getInt8Ty(), ptr_r);
-
-    Value *cmp = CreateICmpNE(l, r, "strcmp.cmp");
+    IntegerType *word_ty = getIntNTy(size * 8);
+    Value *l = CreateAlignedLoad(
+        word_ty, CreateGEP(getInt8Ty(), str1, { getInt32(i) }), Align(size));
+    Value *r = CreateAlignedLoad(
+        word_ty, CreateGEP(getInt8Ty(), str2, { getInt32(i) }), Align(size));
+
+    Value *cmp;
+    Value *cmp_null;
+    if (size == 1) {
+      cmp = CreateICmpNE(l, r, "strcmp.cmp");
+      cmp_null = CreateICmpEQ(l, getInt8(0), "strcmp.cmp_null");
+    } else {
+      APInt ones = APInt::getSplat(size * 8, APInt(8, 0x01));
+      APInt highs = APInt::getSplat(size * 8, APInt(8, 0x80));
+      Value *zeros = CreateAnd(CreateAnd(CreateSub(l, getInt(ones)),
+                                         CreateNot(l)),
+                               getInt(highs),
+                               "strcmp.zeros");
+      cmp_null = CreateICmpNE(zeros,
+                              ConstantInt::get(word_ty, 0),
+                              "strcmp.cmp_null");
+      Value *mask = CreateSelect(
+          cmp_null,
+          CreateXor(zeros, CreateSub(zeros, ConstantInt::get(word_ty, 1))),
+          Constant::getAllOnesValue(word_ty),
+          "strcmp.mask");
+      cmp = CreateICmpNE(CreateAnd(CreateXor(l, r), mask),
+                         ConstantInt::get(word_ty, 0),
+                         "strcmp.cmp");
+    }
     CreateCondBr(cmp, str_ne, loop_null_check);
 
     SetInsertPoint(loop_null_check);
+    CreateCondBr(cmp_null, done, word_eq);
 
-    Value *cmp_null = CreateICmpEQ(l, null_byte, "strcmp.cmp_null");
-    CreateCondBr(cmp_null, done, char_eq);
-
-    SetInsertPoint(char_eq);
+    SetInsertPoint(word_eq);
+    i += size;
   }
 
   CreateBr(done);
@@ -1477,6 +1501,50 @@ Value *IRBuilderBPF::CreateStrncmp(Value *str1,
   return result;
 }
 
+Value *IRBuilderBPF::CreateStrncmpLiteral(Value *str,
+                                          std::string_view literal,
+                                          uint64_t n,
+                                          bool inverse)
+{
+  // Only the bytes up to and including the literal's NULL terminator can
+  // decide the result, so compare exactly those (capped at n). Every word is
+  // XOR'd against the matching slice of the literal and the results are
+  // OR'd together; the strings differ iff the accumulator is non-zero.
+  const DataLayout &dl = module_.getDataLayout();
+  literal = literal.substr(0, literal.find('\0'));
+  uint64_t len = std::min(n, static_cast<uint64_t>(literal.size()) + 1);
+  uint64_t word_size = std::min(
+      getOrEnforceKnownAlignment(str, MaybeAlign(8), dl).value(),
+      static_cast<uint64_t>(8));
+
+  Value *acc = getInt64(0);
+  for (uint64_t i = 0; i < len;) {
+    uint64_t size = word_size;
+    while (i + size > len)
+      size /= 2;
+
+    uint64_t expected = 0;
+    for (uint64_t j = 0; j < size; j++) {
+      uint64_t byte = i + j < literal.size()
+                          ? static_cast<uint8_t>(literal[i + j])
+                          : 0;
+      uint64_t shift = dl.isLittleEndian() ? j : size - 1 - j;
+      expected |= byte << (8 * shift);
+    }
+
+    IntegerType *word_ty = getIntNTy(size * 8);
+    Value *word = CreateAlignedLoad(
+        word_ty, CreateGEP(getInt8Ty(), str, { getInt32(i) }), Align(size));
+    Value *diff = CreateXor(word, ConstantInt::get(word_ty, expected));
+    acc = CreateOr(acc, CreateZExt(diff, getInt64Ty()), "strcmp.acc");
+    i += size;
+  }
+
+  Value *cmp = inverse ? CreateICmpEQ(acc, getInt64(0), "strcmp.cmp")
+                       : CreateICmpNE(acc, getInt64(0), "strcmp.cmp");
+  return CreateZExt(cmp, getInt64Ty());
+}
+
 Value *IRBuilderBPF::CreateGetNs(TimestampMode ts, const Location &loc)
 {
   // If the BPFTRACE_DUMMY_TS_MAP environment variable is set, generate code
@@ -1853,13 +1921,19 @@ CallInst *IRBuilderBPF::CreateGetSocketCookie(Value *var, const Location &loc)
 }
 
 void IRBuilderBPF::CreateOutput(Value *data, size_t size, const Location &loc)
+{
+  CreateOutput(data, getInt64(size), loc);
+}
+
+void IRBuilderBPF::CreateOutput(Value *data, Value *size, const Location &loc)
 {
   assert(data && data->getType()->isPointerTy());
+  assert(size && size->getType() == getInt64Ty());
   CreateRingbufOutput(data, size, loc);
 }
 
 void IRBuilderBPF::CreateRingbufOutput(Value *data,
-                                       size_t size,
+                                       Value *size,
                                        const Location &loc)
 {
   Value *map_ptr = GetMapVar(to_string(MapType::Ringbuf));
@@ -1872,7 +1946,7 @@ void IRBuilderBPF::CreateRingbufOutput(Value *data,
 
   Value *ret = CreateHelperCall(BPF_FUNC_ringbuf_output,
                                 ringbuf_output_func_type,
-                                { map_ptr, data, getInt64(size), getInt64(0) },
+                                { map_ptr, data, size, getInt64(0) },
                                 false,
                                 "ringbuf_output",
                                 loc);
@@ -1894,6 +1968,58 @@ void IRBuilderBPF::CreateRingbufOutput(Value *data,
   SetInsertPoint(merge_block);
 }
 
+void IRBuilderBPF::CreateReservedOutput(
+    size_t size,
+    const Location &loc,
+    const std::function<void(Value *)> &write)
+{
+  Value *map_ptr = GetMapVar(to_string(MapType::Ringbuf));
+
+  // void *bpf_ringbuf_reserve(void *ringbuf, u64 size, u64 flags)
+  FunctionType *ringbuf_reserve_func_type = FunctionType::get(
+      getPtrTy(), { map_ptr->getType(), getInt64Ty(), getInt64Ty() }, false);
+  Value *data = CreateHelperCall(BPF_FUNC_ringbuf_reserve,
+                                 ringbuf_reserve_func_type,
+                                 { map_ptr, getInt64(size), getInt64(0) },
+                                 false,
+                                 "ringbuf_reserve",
+                                 loc);
+
+  llvm::Function *parent = GetInsertBlock()->getParent();
+  BasicBlock *write_block = BasicBlock::Create(module_.getContext(),
+                                               "ringbuf_write",
+                                               parent);
+  BasicBlock *loss_block = BasicBlock::Create(module_.getContext(),
+                                              "event_loss_counter",
+                                              parent);
+  BasicBlock *merge_block = BasicBlock::Create(module_.getContext(),
+                                               "counter_merge",
+                                               parent);
+  Value *condition = CreateIsNull(data, "ringbuf_loss");
+  CreateCondBr(condition, loss_block, write_block);
+
+  SetInsertPoint(write_block);
+  CreateMemsetBPF(data, getInt8(0), size);
+  write(data);
+
+  // void bpf_ringbuf_submit(void *data, u64 flags)
+  FunctionType *ringbuf_submit_func_type = FunctionType::get(
+      getVoidTy(), { data->getType(), getInt64Ty() }, false);
+  CreateHelperCall(BPF_FUNC_ringbuf_submit,
+                   ringbuf_submit_func_type,
+                   { data, getInt64(0) },
+                   false,
+                   "",
+                   loc);
+  CreateBr(merge_block);
+
+  SetInsertPoint(loss_block);
+  CreateIncEventLossCounter(loc);
+  CreateBr(merge_block);
+
+  SetInsertPoint(merge_block);
+}
+
 void IRBuilderBPF::CreateIncEventLossCounter(const Location &loc)
 {
   auto *value = createScratchBuffer(bpftrace::globalvars::EVENT_LOSS_COUNTER,
@@ -1956,6 +2082,46 @@ void IRBuilderBPF::CreatePerCpuMapElemAdd(const std::string &map_ident,
   CreateLifetimeEnd(value);
 }
 
+// Returns a pointer to the value for `key`, first inserting a zeroed value if
+// there is none. The result is null only if the element could not be created.
+Value *IRBuilderBPF::CreateMapLookupOrInit(const std::string &map_ident,
+                                           Value *key,
+                                           const SizedType &value_type,
+                                           const Location &loc)
+{
+  CallInst *lookup = createMapLookup(map_ident, key);
+  BasicBlock *lookup_block = GetInsertBlock();
+
+  llvm::Function *parent = lookup_block->getParent();
+  BasicBlock *lookup_failure_block = BasicBlock::Create(module_.getContext(),
+                                                        "lookup_failure",
+                                                        parent);
+  BasicBlock *lookup_merge_block = BasicBlock::Create(module_.getContext(),
+                                                      "lookup_merge",
+                                                      parent);
+
+  Value *condition = CreateICmpNE(lookup, GetNull(), "map_lookup_cond");
+  CreateCondBr(condition, lookup_merge_block, lookup_failure_block);
+
+  SetInsertPoint(lookup_failure_block);
+
+  // For per-CPU maps, this only overwrites the slot of the current CPU even
+  // if another CPU created the element in the meantime.
+  AllocaInst *initial_value = CreateAllocaBPFInit(value_type, "initial_value");
+  CreateMapUpdateElem(map_ident, key, initial_value, loc, BPF_ANY);
+  CreateLifetimeEnd(initial_value);
+  CallInst *init_lookup = createMapLookup(map_ident, key);
+  BasicBlock *init_block = GetInsertBlock();
+
+  CreateBr(lookup_merge_block);
+  SetInsertPoint(lookup_merge_block);
+
+  PHINode *value = CreatePHI(getPtrTy(), 2, "lookup_elem");
+  value->addIncoming(lookup, lookup_block);
+  value->addIncoming(init_lookup, init_block);
+  return value;
+}
+
 void IRBuilderBPF::CreateTracePrintk(Value *fmt_ptr,
                                      Value *fmt_size,
                                      const std::vector<Value *> &values,
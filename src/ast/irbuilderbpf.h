@@ -58,6 +58,9 @@ public:
   CallInst *CreateMapLookup(Map &map,
                             Value *key,
                             const std::string &name = "lookup_elem");
+  CallInst *CreateMapLookup(const std::string &map_name,
+                            Value *key,
+                            const std::string &name = "lookup_elem");
   Value *CreateMapLookupElem(const std::string &map_name,
                              Value *key,
                              const SizedType &type,
@@ -133,16 +136,15 @@ public:
   CallInst *CreateThisCpuPtr(Value *var, const Location &loc);
   CallInst *CreateGetSocketCookie(Value *var, const Location &loc);
   Value *CreateGetStrAllocation(const std::string &name, const Location &loc);
-  Value *CreateGetFmtStringArgsAllocation(StructType *struct_type,
-                                          const std::string &name,
-                                          const Location &loc);
+  // Unlike the other allocations, this is always a scratch buffer and never
+  // on the stack, since records are written to it at variable offsets.
+  Value *CreateGetFmtStringArgsAllocation(const Location &loc);
   Value *CreateAnonStructAllocation(const SizedType &tuple_type,
                                     const std::string &name,
                                     const Location &loc);
   Value *CreateCallStackAllocation(const SizedType &stack_type,
                                    const std::string &name,
                                    const Location &loc);
-  Value *CreateJoinAllocation(const Location &loc);
   Value *CreateWriteMapValueAllocation(const SizedType &value_type,
                                        const std::string &name,
                                        const Location &loc);
@@ -166,6 +168,16 @@ public:
                        const Twine &Name);
   void CreateGetCurrentComm(AllocaInst *buf, size_t size, const Location &loc);
   void CreateOutput(Value *data, size_t size, const Location &loc);
+  void CreateOutput(Value *data, Value *size, const Location &loc);
+  // Reserves `size` bytes in the output ring buffer and calls `write` with a
+  // pointer to the reservation, so that the record can be built in place and
+  // submitted without an intermediate copy. The reservation is zeroed first so
+  // that padding does not carry stale ring buffer contents to user space. If
+  // no space can be reserved, the event loss counter is incremented instead
+  // and `write` is not emitted on that path.
+  void CreateReservedOutput(size_t size,
+                            const Location &loc,
+                            const std::function<void(Value *)> &write);
   void CreateIncEventLossCounter(const Location &loc);
   void CreatePerCpuMapElemInit(const std::string &map_ident,
                                Value *key,
@@ -176,6 +188,10 @@ public:
                               Value *val,
                               const SizedType &value_type,
                               const Location &loc);
+  Value *CreateMapLookupOrInit(const std::string &map_ident,
+                               Value *key,
+                               const SizedType &value_type,
+                               const Location &loc);
   void CreateTracePrintk(Value *fmt,
                          Value *fmt_size,
                          const std::vector<Value *> &values,
@@ -305,8 +321,12 @@ private:
                              const Location &loc,
                              size_t key);
   bpf_func_id selectProbeReadHelper(AddrSpace as, bool str);
+  Value *CreateStrncmpLiteral(Value *str,
+                              std::string_view literal,
+                              uint64_t n,
+                              bool inverse);
 
-  void CreateRingbufOutput(Value *data, size_t size, const Location &loc);
+  void CreateRingbufOutput(Value *data, Value *size, const Location &loc);
 
   void createPerCpuSum(AllocaInst *ret, CallInst *call, const SizedType &type);
   void createPerCpuMinMax(AllocaInst *ret,
@@ -1,15 +1,22 @@
 #include <algorithm>
 #include <arpa/inet.h>
+#include <atomic>
 #include <cerrno>
+#include <chrono>
 #include <csignal>
 #include <cstdio>
 #include <ctime>
+#include <thread>
+#include <unordered_set>
+#include <variant>
 
 // Required for LLVM_VERSION_MAJOR.
 #include <llvm/IR/GlobalValue.h>
 
 #include <llvm/ADT/FunctionExtras.h>
 #include <llvm/ADT/StringRef.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/CodeGen/UnreachableBlockElim.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DebugInfo.h>
@@ -27,8 +34,16 @@
 #include <llvm/Support/raw_os_ostream.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/AlwaysInliner.h>
+#include <llvm/Transforms/IPO/GlobalDCE.h>
 #include <llvm/Transforms/IPO/StripSymbols.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Scalar/ADCE.h>
+#include <llvm/Transforms/Scalar/EarlyCSE.h>
+#include <llvm/Transforms/Scalar/SROA.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
 #include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
 
 #include "arch/arch.h"
 #include "ast/ast.h"
@@ -44,6 +59,7 @@
 #include "ast/passes/codegen_llvm.h"
 #include "ast/passes/control_flow_analyser.h"
 #include "ast/passes/link.h"
+#include "ast/passes/map_fusion.h"
 #include "ast/passes/named_param.h"
 #include "ast/passes/types/type_map.h"
 #include "ast/visitor.h"
@@ -68,34 +84,39 @@ using namespace llvm;
 static constexpr char LLVMTargetTriple[] = "bpf";
 static constexpr auto LICENSE = "LICENSE";
 
-static auto getTargetMachine()
+// Creates a new BPF target machine. Target machines must not be shared
+// between threads, see getTargetMachine() for the shared instance.
+static std::unique_ptr<TargetMachine> createTargetMachine()
 {
-  static auto *target = []() {
-    std::string error_str;
-    const auto *target = llvm::TargetRegistry::lookupTarget(
+  std::string error_str;
+  const auto *target = llvm::TargetRegistry::lookupTarget(
 #if LLVM_VERSION_MAJOR >= 22
-        Triple(LLVMTargetTriple),
+      Triple(LLVMTargetTriple),
 #else
-        LLVMTargetTriple,
+      LLVMTargetTriple,
 #endif
-        error_str);
-    if (!target) {
-      throw util::FatalUserException(
-          "Could not find bpf llvm target, does your llvm support it?");
-    }
-    auto *machine = target->createTargetMachine(
+      error_str);
+  if (!target) {
+    throw util::FatalUserException(
+        "Could not find bpf llvm target, does your llvm support it?");
+  }
+  std::unique_ptr<TargetMachine> machine(target->createTargetMachine(
 #if LLVM_VERSION_MAJOR >= 21
-        Triple(LLVMTargetTriple),
+      Triple(LLVMTargetTriple),
 #else
-        LLVMTargetTriple,
+      LLVMTargetTriple,
 #endif
-        "generic",
-        "",
-        TargetOptions(),
-        std::optional<Reloc::Model>());
-    machine->setOptLevel(llvm::CodeGenOptLevel::Aggressive);
-    return machine;
-  }();
+      "generic",
+      "",
+      TargetOptions(),
+      std::optional<Reloc::Model>()));
+  machine->setOptLevel(llvm::CodeGenOptLevel::Aggressive);
+  return machine;
+}
+
+static auto getTargetMachine()
+{
+  static auto *target = createTargetMachine().release();
   return target;
 }
 
@@ -121,6 +142,162 @@ private:
 
 char InternalError::ID;
 
+// Builtins and standard library getters which have no side effects and whose
+// value does not change during a single probe invocation. nsecs is left out
+// on purpose: scripts time sections of a probe with it.
+const std::unordered_set<std::string> PURE_BUILTINS = {
+  "pid",
+  "tid",
+  "__builtin_cpu",
+  "__builtin_comm",
+};
+const std::unordered_set<std::string> PURE_GETTERS = {
+  "__get_cgroup",
+  "__get_current_task",
+  "__get_current_uid_gid",
+};
+
+// Returns the key under which the value of a builtin may be reused within a
+// probe, or an empty string if it must be recomputed on every use.
+std::string pureBuiltinKey(const Builtin &builtin)
+{
+  return PURE_BUILTINS.contains(builtin.ident) ? builtin.ident : "";
+}
+
+std::string pureBuiltinKey(const Call &call)
+{
+  if (call.func == "pid" || call.func == "tid")
+    return call.func + (shouldForceInitPidNs(call.vargs) ? "(init)" : "");
+  if (PURE_GETTERS.contains(call.func) && call.vargs.empty())
+    return call.func;
+  return "";
+}
+
+// Returns the part of a probe body that only runs once all of its leading
+// filters have passed. Filters are either predicates, which are desugared into
+// `{ if (pred) { body } }`, or early returns such as the one added by the pid
+// filter: `{ if (cond) { return } else { body } }`.
+BlockExpr *filteredBody(BlockExpr *block)
+{
+  while (block->stmts.empty()) {
+    auto *filter = block->expr.as<IfExpr>();
+    if (!filter)
+      break;
+    auto *left = filter->left.as<BlockExpr>();
+    auto *right = filter->right.as<BlockExpr>();
+    if (left && filter->right.is<None>()) {
+      block = left;
+    } else if (left && right && left->stmts.size() == 1 &&
+               left->stmts.front().is<Jump>() &&
+               left->stmts.front().as<Jump>()->ident == JumpType::RETURN) {
+      block = right;
+    } else {
+      break;
+    }
+  }
+  return block;
+}
+
+// Collects the side-effect-free builtins which are used more than once in a
+// probe body, and which are worth computing once on entry to it: one of their
+// uses must run on every path through the body, before anything that may end
+// the probe early. Otherwise hoisting would add a helper call to events which
+// never reach any use, e.g. when every use is inside an `if`.
+class RepeatedBuiltins : public Visitor<RepeatedBuiltins> {
+public:
+  using Node = std::variant<Builtin *, Call *>;
+  using Visitor<RepeatedBuiltins>::visit;
+
+  void visit(Builtin &builtin)
+  {
+    add(pureBuiltinKey(builtin), &builtin);
+  }
+  void visit(Call &call)
+  {
+    add(pureBuiltinKey(call), &call);
+    Visitor<RepeatedBuiltins>::visit(call);
+    if (call.func == "exit")
+      exited_ = true;
+  }
+  void visit(Binop &binop)
+  {
+    if (binop.op != Operator::LAND && binop.op != Operator::LOR) {
+      Visitor<RepeatedBuiltins>::visit(binop);
+      return;
+    }
+    visit(binop.left);
+    conditional(binop.right);
+  }
+  void visit(IfExpr &if_expr)
+  {
+    visit(if_expr.cond);
+    conditional(if_expr.left);
+    conditional(if_expr.right);
+  }
+  void visit(While &while_block)
+  {
+    depth_++;
+    Visitor<RepeatedBuiltins>::visit(while_block);
+    depth_--;
+  }
+  void visit(Jump &jump)
+  {
+    Visitor<RepeatedBuiltins>::visit(jump);
+    if (jump.ident == JumpType::RETURN)
+      exited_ = true;
+  }
+  void visit([[maybe_unused]] For &f)
+  {
+    // Loop bodies are emitted as separate callback functions, which cannot
+    // use values computed in the probe function.
+  }
+
+  // Returns the builtins to compute on entry, in order of first use.
+  std::vector<Node> nodes() const
+  {
+    std::vector<Node> result;
+    for (const auto &key : keys_) {
+      const auto &use = uses_.at(key);
+      if (use.count > 1 && use.unconditional)
+        result.push_back(use.node);
+    }
+    return result;
+  }
+
+private:
+  struct Uses {
+    Node node;
+    int count = 0;
+    bool unconditional = false;
+  };
+
+  void conditional(Expression &node)
+  {
+    depth_++;
+    visit(node);
+    depth_--;
+  }
+
+  void add(const std::string &key, Node node)
+  {
+    if (key.empty())
+      return;
+    auto [it, inserted] = uses_.try_emplace(key, Uses{ .node = node });
+    if (inserted)
+      keys_.push_back(key);
+    it->second.count++;
+    if (depth_ == 0 && !exited_)
+      it->second.unconditional = true;
+  }
+
+  // Nesting depth of conditionally evaluated code.
+  int depth_ = 0;
+  // Whether the body may have ended before the current node.
+  bool exited_ = false;
+  std::vector<std::string> keys_;
+  std::unordered_map<std::string, Uses> uses_;
+};
+
 struct VariableLLVM {
   llvm::Value *value;
   llvm::Type *type;
@@ -261,6 +438,11 @@ private:
 
   void createPrintMapCall(Call &call);
   void createPrintNonMapCall(Call &call);
+
+  // Aggregations into maps which share a fused map (see MapFusion) update
+  // their fields of a single element, found with one lookup.
+  const MapInfo *fusedMapInfo(Call &call);
+  void createFusedAggregations(const std::vector<Call *> &calls);
   void createJoinCall(Call &call, int id);
 
   void createMapDefinition(const std::string &name,
@@ -329,9 +511,22 @@ private:
   ScopedExpr kstack(const SizedType &stype, const Location &loc);
   ScopedExpr ustack(const SizedType &stype, const Location &loc);
   ScopedExpr dw_ustack(const SizedType &stype, const Location &loc);
+  ScopedExpr intern_stack(const SizedType &stype,
+                          ScopedExpr frames,
+                          const Location &loc);
+  Value *stack_hash(Value *frames,
+                    Value *nr_frames,
+                    const StackType &stack_type);
 
   int get_probe_id();
 
+  // Computes the side-effect-free builtins which are used more than once in
+  // the probe body up front, so that every use shares a single helper call.
+  // This happens only after the probe's filters have passed, so that events
+  // which are filtered out do no other work.
+  void cacheBuiltins(BlockExpr &block);
+  Value *getCachedBuiltin(const std::string &key);
+
   // Create return instruction
   //
   // If null, return value will depend on current attach point (void in subprog)
@@ -454,6 +649,12 @@ private:
       loops_;
   std::unordered_map<std::string, bool> probe_names_;
   std::unordered_map<std::string, llvm::Function *> extern_funcs_;
+
+  // Builtin values computed on entry to the filtered probe body, see
+  // cacheBuiltins().
+  std::unordered_map<std::string, Value *> builtin_cache_;
+  llvm::Function *builtin_cache_func_ = nullptr;
+  BlockExpr *builtin_cache_block_ = nullptr;
 };
 
 } // namespace
@@ -553,6 +754,9 @@ ScopedExpr CodegenLLVM::visit(String &string)
       s, ArrayType::get(b_.getInt8Ty(), type_map_.type(&string).GetSize())));
   string_var->setInitializer(
       ConstantDataArray::getString(module_->getContext(), s));
+  // Literals are never written to. Marking them constant places them in
+  // .rodata and lets the builder compare against their contents directly.
+  string_var->setConstant(true);
   return ScopedExpr(string_var);
 }
 
@@ -571,6 +775,9 @@ ScopedExpr CodegenLLVM::visit(Identifier &identifier)
 
 ScopedExpr CodegenLLVM::kstack(const SizedType &stype, const Location &loc)
 {
+  if (stype.stack_type.interned)
+    return intern_stack(stype, kstack(CreateStackFrames(stype), loc), loc);
+
   StructType *stack_struct_type = b_.GetStackStructType(stype.stack_type);
 
   llvm::Function *parent = b_.GetInsertBlock()->getParent();
@@ -622,6 +829,9 @@ ScopedExpr CodegenLLVM::kstack(const SizedType &stype, const Location &loc)
 
 ScopedExpr CodegenLLVM::ustack(const SizedType &stype, const Location &loc)
 {
+  if (stype.stack_type.interned)
+    return intern_stack(stype, ustack(CreateStackFrames(stype), loc), loc);
+
   StructType *stack_struct_type = b_.GetStackStructType(stype.stack_type);
 
   llvm::Function *parent = b_.GetInsertBlock()->getParent();
@@ -685,6 +895,9 @@ ScopedExpr CodegenLLVM::ustack(const SizedType &stype, const Location &loc)
 
 ScopedExpr CodegenLLVM::dw_ustack(const SizedType &stype, const Location &loc)
 {
+  if (stype.stack_type.interned)
+    return intern_stack(stype, dw_ustack(CreateStackFrames(stype), loc), loc);
+
   StructType *stack_struct_type = b_.GetStackStructType(stype.stack_type);
 
   llvm::Function *parent = b_.GetInsertBlock()->getParent();
@@ -771,6 +984,130 @@ ScopedExpr CodegenLLVM::dw_ustack(const SizedType &stype, const Location &loc)
   return ScopedExpr(stack);
 }
 
+// Stores the frames in the stack table of the stack type, keyed by their
+// hash, and returns the interned stack which only carries the hash.
+ScopedExpr CodegenLLVM::intern_stack(const SizedType &stype,
+                                     ScopedExpr frames,
+                                     const Location &loc)
+{
+  const auto &stack_type = stype.stack_type;
+  StructType *frames_struct_type = b_.GetStackStructType(
+      CreateStackFrames(stype).stack_type);
+  StructType *stack_struct_type = b_.GetStackStructType(stack_type);
+  // Both structs start with the same fields, up to nr_stack_frames. See
+  // IRBuilderBPF::GetStackStructType
+  unsigned int nr_frames_idx = stack_type.kernel ? 0 : 2;
+
+  Value *nr_frames = b_.CreateLoad(
+      b_.getInt64Ty(),
+      b_.CreateGEP(frames_struct_type,
+                   frames.value(),
+                   { b_.getInt64(0), b_.getInt32(nr_frames_idx) }));
+  Value *trace = b_.CreateGEP(frames_struct_type,
+                              frames.value(),
+                              { b_.getInt64(0),
+                                b_.getInt32(nr_frames_idx + 1) });
+
+  AllocaInst *stack_id = b_.CreateAllocaBPF(b_.getInt64Ty(), "stack_id");
+  b_.CreateStore(stack_hash(trace, nr_frames, stack_type), stack_id);
+
+  // Look the stack up first: this keeps known stacks from being evicted and
+  // saves copying their frames again.
+  llvm::Function *parent = b_.GetInsertBlock()->getParent();
+  BasicBlock *insert_block = BasicBlock::Create(module_->getContext(),
+                                                "stack_insert",
+                                                parent);
+  BasicBlock *merge_block = BasicBlock::Create(module_->getContext(),
+                                               "stack_merge",
+                                               parent);
+  Value *known = b_.CreateMapLookup(stack_type.table_name(), stack_id);
+  b_.CreateCondBr(b_.CreateICmpEQ(known, b_.GetNull()),
+                  insert_block,
+                  merge_block);
+  b_.SetInsertPoint(insert_block);
+  b_.CreateMapUpdateElem(stack_type.table_name(), stack_id, trace, loc);
+  b_.CreateBr(merge_block);
+  b_.SetInsertPoint(merge_block);
+
+  AllocaInst *stack = b_.CreateAllocaBPF(stype, stack_type.name());
+  for (unsigned int i = 0; i <= nr_frames_idx; i++) {
+    llvm::Type *field_type = stack_struct_type->getElementType(i);
+    b_.CreateStore(
+        b_.CreateLoad(field_type,
+                      b_.CreateGEP(frames_struct_type,
+                                   frames.value(),
+                                   { b_.getInt64(0), b_.getInt32(i) })),
+        b_.CreateGEP(stack_struct_type,
+                     stack,
+                     { b_.getInt64(0), b_.getInt32(i) }));
+  }
+  b_.CreateStore(b_.CreateLoad(b_.getInt64Ty(), stack_id),
+                 b_.CreateGEP(stack_struct_type,
+                              stack,
+                              { b_.getInt64(0),
+                                b_.getInt32(nr_frames_idx + 1) }));
+  b_.CreateLifetimeEnd(stack_id);
+
+  return ScopedExpr(stack);
+}
+
+// Hashes the first `nr_frames` frames of `frames` in a bounded loop, one
+// 64-bit word at a time (FNV-1a, folding the high bits back in so that frames
+// which only differ there don't collide).
+Value *CodegenLLVM::stack_hash(Value *frames,
+                               Value *nr_frames,
+                               const StackType &stack_type)
+{
+  if (!loop_metadata_)
+    loop_metadata_ = createLoopMetadata();
+
+  const uint64_t words_per_frame = stack_type.elem_size() / sizeof(uint64_t);
+  Value *max_words = b_.getInt64(stack_type.limit * words_per_frame);
+  Value *nr_words = b_.CreateMul(nr_frames, b_.getInt64(words_per_frame));
+  // The verifier needs a constant bound
+  nr_words = b_.CreateSelect(b_.CreateICmpULT(nr_words, max_words),
+                             nr_words,
+                             max_words);
+
+  llvm::Function *parent = b_.GetInsertBlock()->getParent();
+  BasicBlock *entry_block = b_.GetInsertBlock();
+  BasicBlock *cond_block = BasicBlock::Create(module_->getContext(),
+                                              "stack_hash_cond",
+                                              parent);
+  BasicBlock *body_block = BasicBlock::Create(module_->getContext(),
+                                              "stack_hash_body",
+                                              parent);
+  BasicBlock *end_block = BasicBlock::Create(module_->getContext(),
+                                             "stack_hash_end",
+                                             parent);
+  b_.CreateBr(cond_block);
+
+  b_.SetInsertPoint(cond_block);
+  PHINode *i = b_.CreatePHI(b_.getInt64Ty(), 2, "i");
+  PHINode *hash = b_.CreatePHI(b_.getInt64Ty(), 2, "hash");
+  i->addIncoming(b_.getInt64(0), entry_block);
+  hash->addIncoming(b_.CreateXor(b_.getInt64(0xcbf29ce484222325ULL),
+                                 nr_frames),
+                    entry_block);
+  Instruction *loop_hdr = b_.CreateCondBr(b_.CreateICmpULT(i, nr_words),
+                                          body_block,
+                                          end_block);
+  loop_hdr->setMetadata(LLVMContext::MD_loop, loop_metadata_);
+
+  b_.SetInsertPoint(body_block);
+  Value *word = b_.CreateLoad(b_.getInt64Ty(),
+                              b_.CreateGEP(b_.getInt64Ty(), frames, i));
+  Value *next = b_.CreateMul(b_.CreateXor(hash, word),
+                             b_.getInt64(0x100000001b3ULL));
+  next = b_.CreateXor(next, b_.CreateLShr(next, 32));
+  i->addIncoming(b_.CreateAdd(i, b_.getInt64(1)), body_block);
+  hash->addIncoming(next, body_block);
+  b_.CreateBr(cond_block);
+
+  b_.SetInsertPoint(end_block);
+  return hash;
+}
+
 int CodegenLLVM::get_probe_id()
 {
   auto begin = bpftrace_.resources.probe_ids.begin();
@@ -784,6 +1121,9 @@ int CodegenLLVM::get_probe_id()
 
 ScopedExpr CodegenLLVM::visit(Builtin &builtin)
 {
+  if (auto *value = getCachedBuiltin(pureBuiltinKey(builtin)))
+    return ScopedExpr(value);
+
   if (builtin.ident == "nsecs") {
     return ScopedExpr(b_.CreateGetNs(TimestampMode::boot, builtin.loc));
   } else if (builtin.ident == "__builtin_elapsed") {
@@ -919,6 +1259,14 @@ ScopedExpr CodegenLLVM::visit(Builtin &builtin)
 
 ScopedExpr CodegenLLVM::visit(Call &call)
 {
+  if (auto *value = getCachedBuiltin(pureBuiltinKey(call)))
+    return ScopedExpr(value);
+
+  if (fusedMapInfo(call)) {
+    createFusedAggregations({ &call });
+    return ScopedExpr();
+  }
+
   if (call.func == "count") {
     Map &map = *call.vargs.at(0).as<Map>();
     auto scoped_key = getMapKey(map, call.vargs.at(1));
@@ -1861,7 +2209,8 @@ ScopedExpr CodegenLLVM::visit(Call &call)
                                 { b_.getInt64(0), b_.getInt32(1) }));
 
     return ScopedExpr(buf, [this, buf]() { b_.CreateLifetimeEnd(buf); });
-  } else if (call.func == "clear" || call.func == "zero") {
+  } else if (call.func == "clear" || call.func == "zero" ||
+             call.func == "rotate") {
     auto elements = AsyncEvent::MapEvent().asLLVMType(b_);
     StructType *event_struct = b_.GetStructType(call.func + "_t",
                                                 elements,
@@ -1876,16 +2225,14 @@ ScopedExpr CodegenLLVM::visit(Call &call)
     auto *aa_ptr = b_.CreateGEP(event_struct,
                                 buf,
                                 { b_.getInt64(0), b_.getInt32(0) });
+    auto action = async_action::AsyncAction::rotate;
     if (call.func == "clear")
-      b_.CreateStore(b_.GetIntSameSize(static_cast<int64_t>(
-                                           async_action::AsyncAction::clear),
-                                       elements.at(0)),
-                     aa_ptr);
-    else
-      b_.CreateStore(b_.GetIntSameSize(static_cast<int64_t>(
-                                           async_action::AsyncAction::zero),
-                                       elements.at(0)),
-                     aa_ptr);
+      action = async_action::AsyncAction::clear;
+    else if (call.func == "zero")
+      action = async_action::AsyncAction::zero;
+    b_.CreateStore(b_.GetIntSameSize(static_cast<int64_t>(action),
+                                     elements.at(0)),
+                   aa_ptr);
 
     int id = bpftrace_.resources.maps_info.at(map.ident).id;
     if (id == -1) {
@@ -3322,13 +3669,118 @@ ScopedExpr CodegenLLVM::visit(For &f)
 ScopedExpr CodegenLLVM::visit(BlockExpr &block_expr)
 {
   scope_stack_.push_back(&block_expr);
-  visit(block_expr.stmts);
+  if (&block_expr == builtin_cache_block_)
+    cacheBuiltins(block_expr);
+  for (size_t i = 0; i < block_expr.stmts.size();) {
+    std::vector<Call *> fused;
+    for (auto *call : fusable_run(block_expr.stmts, i)) {
+      const auto *info = fusedMapInfo(*call);
+      if (!info || (!fused.empty() &&
+                    info->fused_map != fusedMapInfo(*fused.front())->fused_map))
+        break;
+      fused.push_back(call);
+    }
+    if (fused.empty()) {
+      visit(block_expr.stmts.at(i++));
+      continue;
+    }
+    createFusedAggregations(fused);
+    i += fused.size();
+  }
   ScopedExpr value = visit(block_expr.expr);
   scope_stack_.pop_back();
 
   return value;
 }
 
+const MapInfo *CodegenLLVM::fusedMapInfo(Call &call)
+{
+  if (call.vargs.empty() || !call.vargs.at(0).is<Map>())
+    return nullptr;
+  auto it = bpftrace_.resources.maps_info.find(
+      call.vargs.at(0).as<Map>()->ident);
+  if (it == bpftrace_.resources.maps_info.end() || it->second.fused_map.empty())
+    return nullptr;
+  return &it->second;
+}
+
+void CodegenLLVM::createFusedAggregations(const std::vector<Call *> &calls)
+{
+  Call &first = *calls.front();
+  Map &first_map = *first.vargs.at(0).as<Map>();
+  const auto &fused_map = fusedMapInfo(first)->fused_map;
+
+  // All the calls have the same key, so it is evaluated only once.
+  ScopedExpr scoped_key = getMapKey(first_map, first.vargs.at(1));
+  Value *lookup = b_.CreateMapLookupOrInit(
+      fused_map,
+      scoped_key.value(),
+      bpftrace_.resources.fused_maps_info.at(fused_map).value_type,
+      first.loc);
+
+  llvm::Function *parent = b_.GetInsertBlock()->getParent();
+  BasicBlock *lookup_success_block = BasicBlock::Create(module_->getContext(),
+                                                        "lookup_success",
+                                                        parent);
+  BasicBlock *lookup_merge_block = BasicBlock::Create(module_->getContext(),
+                                                      "lookup_merge",
+                                                      parent);
+
+  Value *lookup_condition = b_.CreateICmpNE(lookup,
+                                            b_.GetNull(),
+                                            "lookup_cond");
+  b_.CreateCondBr(lookup_condition, lookup_success_block, lookup_merge_block);
+
+  b_.SetInsertPoint(lookup_success_block);
+
+  for (auto *call : calls) {
+    Map &map = *call->vargs.at(0).as<Map>();
+    const auto &value_type = type_map_.map_value_type(map.ident);
+
+    // The first field is the value (or total), the second is the "value is
+    // set" flag (or count), laid out as for the unfused maps.
+    Value *field = b_.CreateGEP(b_.getInt8Ty(),
+                                lookup,
+                                b_.getInt64(fusedMapInfo(*call)->fused_offset));
+    Value *second_field = b_.CreateGEP(b_.getInt8Ty(),
+                                       field,
+                                       b_.getInt64(sizeof(uint64_t)));
+
+    if (call->func == "count") {
+      b_.CreateStore(b_.CreateAdd(b_.CreateLoad(b_.getInt64Ty(), field),
+                                  b_.getInt64(1)),
+                     field);
+      continue;
+    }
+
+    ScopedExpr scoped_expr = visit(call->vargs.at(2));
+    // promote int to 64-bit
+    Value *expr = b_.CreateIntCast(scoped_expr.value(),
+                                   b_.getInt64Ty(),
+                                   value_type.IsSigned());
+
+    if (call->func == "sum") {
+      b_.CreateStore(
+          b_.CreateAdd(b_.CreateLoad(b_.getInt64Ty(), field), expr), field);
+    } else if (call->func == "max" || call->func == "min") {
+      b_.CreateMinMax(expr,
+                      field,
+                      second_field,
+                      call->func == "max",
+                      value_type.IsSigned());
+    } else {
+      b_.CreateStore(
+          b_.CreateAdd(b_.CreateLoad(b_.getInt64Ty(), field), expr), field);
+      b_.CreateStore(b_.CreateAdd(b_.CreateLoad(b_.getInt64Ty(), second_field),
+                                  b_.getInt64(1)),
+                     second_field);
+    }
+  }
+
+  b_.CreateBr(lookup_merge_block);
+  b_.SetInsertPoint(lookup_merge_block);
+}
+
 void CodegenLLVM::generateProbe(Probe &probe,
                                 const std::string &name,
                                 FunctionType *func_type)
@@ -3354,7 +3806,37 @@ void CodegenLLVM::generateProbe(Probe &probe,
   }
 
   variables_.clear();
+  builtin_cache_block_ = filteredBody(probe.block);
   visit(*probe.block);
+  builtin_cache_block_ = nullptr;
+}
+
+void CodegenLLVM::cacheBuiltins(BlockExpr &block)
+{
+  builtin_cache_.clear();
+  builtin_cache_func_ = b_.GetInsertBlock()->getParent();
+
+  RepeatedBuiltins repeated;
+  repeated.visit(block);
+  for (auto node : repeated.nodes()) {
+    std::visit(
+        [this](auto *expr) {
+          auto scoped_expr = visit(*expr);
+          // The value is shared by every use, so any storage backing it
+          // lives as long as the probe.
+          scoped_expr.disarm();
+          builtin_cache_.emplace(pureBuiltinKey(*expr), scoped_expr.value());
+        },
+        node);
+  }
+}
+
+Value *CodegenLLVM::getCachedBuiltin(const std::string &key)
+{
+  if (key.empty() || b_.GetInsertBlock()->getParent() != builtin_cache_func_)
+    return nullptr;
+  auto it = builtin_cache_.find(key);
+  return it != builtin_cache_.end() ? it->second : nullptr;
 }
 
 void CodegenLLVM::add_probe(AttachPoint &ap,
@@ -4010,9 +4492,15 @@ void CodegenLLVM::createFormatStringCall(Call &call,
                                          async_action::AsyncAction async_action)
 {
   std::vector<llvm::Type *> elements;
+  size_t strings_size = 0;
   for (const Field &arg : call_args) {
-    llvm::Type *ty = b_.GetType(arg.type);
-    elements.push_back(ty);
+    if (arg.type.IsStringTy()) {
+      // See AsyncEvent::StringRef.
+      elements.push_back(b_.getInt64Ty());
+      strings_size += arg.type.GetSize();
+    } else {
+      elements.push_back(b_.GetType(arg.type));
+    }
   }
 
   // perf event output has: uint64_t id, vargs
@@ -4029,41 +4517,102 @@ void CodegenLLVM::createFormatStringCall(Call &call,
                                                   call_name + "_t",
                                                   false);
 
-  int struct_size = datalayout().getTypeAllocSize(ringbuf_struct);
-  Value *fmt_args = b_.CreateGetFmtStringArgsAllocation(ringbuf_struct,
-                                                        call_name + "_args",
-                                                        call.loc);
-  // The struct is not packed so we need to memset it
-  b_.CreateMemsetBPF(fmt_args, b_.getInt8(0), struct_size);
-
-  Value *id_offset = b_.CreateGEP(ringbuf_struct,
-                                  fmt_args,
-                                  { b_.getInt32(0), b_.getInt32(0) });
-  b_.CreateStore(b_.getInt64(id + static_cast<int>(async_action)), id_offset);
-  Value *fmt_offset = nullptr;
-  if (fmt_struct) {
-    fmt_offset = b_.CreateGEP(ringbuf_struct,
-                              fmt_args,
-                              { b_.getInt32(0), b_.getInt32(1) });
+  // Arguments are evaluated up front, so that their side effects happen even
+  // if no space can be reserved in the ring buffer for the record.
+  std::vector<ScopedExpr> scoped_args;
+  for (size_t i = 1; i < call.vargs.size(); i++) {
+    scoped_args.emplace_back(visit(call.vargs.at(i)));
   }
 
-  for (size_t i = 1; i < call.vargs.size(); i++) {
-    Expression &arg = call.vargs.at(i);
-    auto scoped_arg = visit(arg);
-    Value *offset = b_.CreateGEP(fmt_struct,
-                                 fmt_offset,
-                                 { b_.getInt32(0), b_.getInt32(i - 1) });
-    if (needMemcpy(type_map_.type(arg)))
-      b_.CreateMemcpyBPF(offset,
-                         scoped_arg.value(),
-                         type_map_.type(arg).GetSize());
-    else
-      b_.CreateStore(scoped_arg.value(), offset);
+  // Writes the record, returning its size. The fixed-size part of the record
+  // must already be zeroed, so that padding does not leak stale bytes.
+  int struct_size = datalayout().getTypeAllocSize(ringbuf_struct);
+  auto write_record = [&](Value *record) -> Value * {
+    Value *id_offset = b_.CreateGEP(ringbuf_struct,
+                                    record,
+                                    { b_.getInt32(0), b_.getInt32(0) });
+    b_.CreateStore(b_.getInt64(id + static_cast<int>(async_action)),
+                   id_offset);
+    Value *fmt_offset = nullptr;
+    if (fmt_struct) {
+      fmt_offset = b_.CreateGEP(ringbuf_struct,
+                                record,
+                                { b_.getInt32(0), b_.getInt32(1) });
+    }
+
+    Value *args_size = b_.getInt64(struct_size - sizeof(uint64_t));
+    for (size_t i = 1; i < call.vargs.size(); i++) {
+      const auto &arg_type = call_args.at(i - 1).type;
+      Value *value = scoped_args.at(i - 1).value();
+      Value *offset = b_.CreateGEP(fmt_struct,
+                                   fmt_offset,
+                                   { b_.getInt32(0), b_.getInt32(i - 1) });
+      if (arg_type.IsStringTy()) {
+        // Append the string up to its NUL byte, and reference it from its
+        // slot. Anything past the string's length is either overwritten by
+        // the next string or not sent.
+        size_t size = arg_type.GetSize();
+        Value *dst = b_.CreateGEP(b_.getInt8Ty(), fmt_offset, args_size);
+        Value *len = b_.CreateProbeReadStr(
+            dst, size, value, AddrSpace::kernel, call.loc);
+        len = b_.CreateSelect(b_.CreateICmpSLT(len, b_.getInt64(0)),
+                              b_.getInt64(0),
+                              len);
+
+        // The helper always NUL terminates, so for a string that fills its
+        // buffer the last byte is copied as-is: this is how user space
+        // detects truncation. Shorter strings already end at their NUL.
+        llvm::Function *parent = b_.GetInsertBlock()->getParent();
+        BasicBlock *full_block = BasicBlock::Create(module_->getContext(),
+                                                    "str_full",
+                                                    parent);
+        BasicBlock *merge_block = BasicBlock::Create(module_->getContext(),
+                                                     "str_merge",
+                                                     parent);
+        b_.CreateCondBr(b_.CreateICmpEQ(len, b_.getInt64(size)),
+                        full_block,
+                        merge_block);
+        b_.SetInsertPoint(full_block);
+        b_.CreateStore(
+            b_.CreateLoad(b_.getInt8Ty(),
+                          b_.CreateGEP(b_.getInt8Ty(),
+                                       value,
+                                       b_.getInt64(size - 1))),
+            b_.CreateGEP(b_.getInt8Ty(), dst, b_.getInt64(size - 1)));
+        b_.CreateBr(merge_block);
+        b_.SetInsertPoint(merge_block);
+
+        b_.CreateStore(b_.CreateTrunc(args_size, b_.getInt32Ty()),
+                       b_.CreateGEP(b_.getInt32Ty(), offset, b_.getInt64(0)));
+        b_.CreateStore(b_.CreateTrunc(len, b_.getInt32Ty()),
+                       b_.CreateGEP(b_.getInt32Ty(), offset, b_.getInt64(1)));
+        args_size = b_.CreateAdd(args_size, len);
+      } else if (needMemcpy(arg_type)) {
+        b_.CreateMemcpyBPF(offset, value, arg_type.GetSize());
+      } else {
+        b_.CreateStore(value, offset);
+      }
+    }
+    return b_.CreateAdd(args_size, b_.getInt64(sizeof(uint64_t)));
+  };
+
+  // Fixed-size records are written directly into the ring buffer.
+  if (strings_size == 0) {
+    b_.CreateReservedOutput(struct_size, call.loc, [&](Value *record) {
+      write_record(record);
+    });
+    return;
   }
 
-  b_.CreateOutput(fmt_args, struct_size, call.loc);
-  if (dyn_cast<AllocaInst>(fmt_args))
-    b_.CreateLifetimeEnd(fmt_args);
+  // Records with strings are only as long as the strings that were actually
+  // read, so they are built in a buffer large enough for the longest strings
+  // and then only the used part is output. This buffer is always a global,
+  // never the stack, since only privileged programs may write to the stack
+  // at a variable offset.
+  Value *record = b_.CreateGetFmtStringArgsAllocation(call.loc);
+  b_.CreateMemsetBPF(record, b_.getInt8(0), struct_size);
+  Value *record_size = write_record(record);
+  b_.CreateOutput(record, record_size, call.loc);
 }
 
 void CodegenLLVM::createPrintMapCall(Call &call)
@@ -4074,46 +4623,50 @@ void CodegenLLVM::createPrintMapCall(Call &call)
   auto &arg = call.vargs.at(0);
   auto &map = *arg.as<Map>();
 
-  AllocaInst *buf = b_.CreateAllocaBPF(print_struct,
-                                       call.func + "_" + map.ident);
-
-  // store asyncactionid:
-  b_.CreateStore(
-      b_.getInt64(static_cast<int64_t>(async_action::AsyncAction::print)),
-      b_.CreateGEP(print_struct, buf, { b_.getInt64(0), b_.getInt32(0) }));
-
   int id = bpftrace_.resources.maps_info.at(map.ident).id;
   if (id == -1) {
     LOG(BUG) << "map id for map \"" << map.ident << "\" not found";
   }
-  auto *ident_ptr = b_.CreateGEP(print_struct,
-                                 buf,
-                                 { b_.getInt64(0), b_.getInt32(1) });
-  b_.CreateStore(b_.GetIntSameSize(id, elements.at(1)), ident_ptr);
 
   // top, div
-  // first loops sets the arguments as passed by user. The second one zeros
-  // the rest
-  size_t arg_idx = 1;
-  for (; arg_idx < call.vargs.size(); arg_idx++) {
-    auto scoped_arg = visit(call.vargs.at(arg_idx));
+  std::vector<ScopedExpr> scoped_args;
+  for (size_t i = 1; i < call.vargs.size(); i++) {
+    scoped_args.emplace_back(visit(call.vargs.at(i)));
+  }
 
+  size_t struct_size = getStructSize(print_struct);
+  b_.CreateReservedOutput(struct_size, call.loc, [&](Value *buf) {
+    // store asyncactionid:
     b_.CreateStore(
-        b_.CreateIntCast(scoped_arg.value(), elements.at(arg_idx), false),
-        b_.CreateGEP(print_struct,
-                     buf,
-                     { b_.getInt64(0), b_.getInt32(arg_idx + 1) }));
-  }
+        b_.getInt64(static_cast<int64_t>(async_action::AsyncAction::print)),
+        b_.CreateGEP(print_struct, buf, { b_.getInt64(0), b_.getInt32(0) }));
 
-  for (; arg_idx < 3; arg_idx++) {
-    b_.CreateStore(b_.GetIntSameSize(0, elements.at(arg_idx)),
-                   b_.CreateGEP(print_struct,
-                                buf,
-                                { b_.getInt64(0), b_.getInt32(arg_idx + 1) }));
-  }
+    auto *ident_ptr = b_.CreateGEP(print_struct,
+                                   buf,
+                                   { b_.getInt64(0), b_.getInt32(1) });
+    b_.CreateStore(b_.GetIntSameSize(id, elements.at(1)), ident_ptr);
 
-  b_.CreateOutput(buf, getStructSize(print_struct), call.loc);
-  b_.CreateLifetimeEnd(buf);
+    // first loops sets the arguments as passed by user. The second one zeros
+    // the rest
+    size_t arg_idx = 1;
+    for (; arg_idx < call.vargs.size(); arg_idx++) {
+      b_.CreateStore(
+          b_.CreateIntCast(scoped_args.at(arg_idx - 1).value(),
+                           elements.at(arg_idx),
+                           false),
+          b_.CreateGEP(print_struct,
+                       buf,
+                       { b_.getInt64(0), b_.getInt32(arg_idx + 1) }));
+    }
+
+    for (; arg_idx < 3; arg_idx++) {
+      b_.CreateStore(
+          b_.GetIntSameSize(0, elements.at(arg_idx)),
+          b_.CreateGEP(print_struct,
+                       buf,
+                       { b_.getInt64(0), b_.getInt32(arg_idx + 1) }));
+    }
+  });
 }
 
 void CodegenLLVM::createJoinCall(Call &call, int id)
@@ -4126,53 +4679,55 @@ void CodegenLLVM::createJoinCall(Call &call, int id)
   BasicBlock *failure_callback = BasicBlock::Create(module_->getContext(),
                                                     "failure_callback",
                                                     parent);
-  Value *perfdata = b_.CreateJoinAllocation(call.loc);
 
   uint32_t content_size = bpftrace_.join_argnum_ * bpftrace_.join_argsize_;
 
   auto elements = AsyncEvent::Join().asLLVMType(b_, content_size);
   StructType *join_struct = b_.GetStructType("join_t", elements, true);
 
-  Value *join_data = b_.CreateBitCast(perfdata, PointerType::get(llvm_ctx_, 0));
-
-  b_.CreateStore(
-      b_.getInt64(static_cast<int>(async_action::AsyncAction::join)),
-      b_.CreateGEP(join_struct, join_data, { b_.getInt64(0), b_.getInt32(0) }));
+  size_t header_size = offsetof(AsyncEvent::Join, content); // action_id +
+                                                            // join_id
+  size_t total_size = header_size + content_size;
+  b_.CreateReservedOutput(total_size, call.loc, [&](Value *join_data) {
+    b_.CreateStore(
+        b_.getInt64(static_cast<int>(async_action::AsyncAction::join)),
+        b_.CreateGEP(join_struct,
+                     join_data,
+                     { b_.getInt64(0), b_.getInt32(0) }));
+
+    b_.CreateStore(b_.getInt64(id),
+                   b_.CreateGEP(join_struct,
+                                join_data,
+                                { b_.getInt64(0), b_.getInt32(1) }));
 
-  b_.CreateStore(
-      b_.getInt64(id),
-      b_.CreateGEP(join_struct, join_data, { b_.getInt64(0), b_.getInt32(1) }));
+    Value *content_ptr = b_.CreateGEP(join_struct,
+                                      join_data,
+                                      { b_.getInt64(0), b_.getInt32(2) });
 
-  Value *content_ptr = b_.CreateGEP(join_struct,
-                                    join_data,
-                                    { b_.getInt64(0), b_.getInt32(2) });
+    SizedType elem_type = CreatePointer(CreateInt8(), addrspace);
 
-  SizedType elem_type = CreatePointer(CreateInt8(), addrspace);
+    Value *value = scoped_arg.value();
+    AllocaInst *arr = b_.CreateAllocaBPF(b_.getInt64Ty(), call.func + "_r0");
 
-  Value *value = scoped_arg.value();
-  AllocaInst *arr = b_.CreateAllocaBPF(b_.getInt64Ty(), call.func + "_r0");
+    for (unsigned int i = 0; i < bpftrace_.join_argnum_; i++) {
+      if (i > 0) {
+        value = b_.CreateGEP(b_.GetType(elem_type), value, b_.getInt32(1));
+      }
 
-  for (unsigned int i = 0; i < bpftrace_.join_argnum_; i++) {
-    if (i > 0) {
-      value = b_.CreateGEP(b_.GetType(elem_type), value, b_.getInt32(1));
+      b_.CreateProbeRead(arr, elem_type, value, call.loc);
+      Value *str_offset = b_.getInt64(
+          static_cast<uint64_t>(i) *
+          static_cast<uint64_t>(bpftrace_.join_argsize_));
+      Value *str_ptr = b_.CreateGEP(b_.getInt8Ty(), content_ptr, str_offset);
+
+      b_.CreateProbeReadStr(str_ptr,
+                            bpftrace_.join_argsize_,
+                            b_.CreateLoad(b_.getInt64Ty(), arr),
+                            addrspace,
+                            call.loc);
     }
-
-    b_.CreateProbeRead(arr, elem_type, value, call.loc);
-    Value *str_offset = b_.getInt64(
-        static_cast<uint64_t>(i) *
-        static_cast<uint64_t>(bpftrace_.join_argsize_));
-    Value *str_ptr = b_.CreateGEP(b_.getInt8Ty(), content_ptr, str_offset);
-
-    b_.CreateProbeReadStr(str_ptr,
-                          bpftrace_.join_argsize_,
-                          b_.CreateLoad(b_.getInt64Ty(), arr),
-                          addrspace,
-                          call.loc);
-  }
-  size_t header_size = offsetof(AsyncEvent::Join, content); // action_id +
-                                                            // join_id
-  size_t total_size = header_size + content_size;
-  b_.CreateOutput(perfdata, total_size, call.loc);
+    b_.CreateLifetimeEnd(arr);
+  });
 
   b_.CreateBr(failure_callback);
   b_.SetInsertPoint(failure_callback);
@@ -4192,45 +4747,46 @@ void CodegenLLVM::createPrintNonMapCall(Call &call)
   StructType *print_struct = b_.GetStructType(struct_name.str(),
                                               elements,
                                               true);
-  Value *buf = b_.CreateGetFmtStringArgsAllocation(print_struct,
-                                                   struct_name.str(),
-                                                   call.loc);
   size_t struct_size = datalayout().getTypeAllocSize(print_struct);
 
-  // Store asyncactionid:
-  b_.CreateStore(
-      b_.getInt64(
-          static_cast<int64_t>(async_action::AsyncAction::print_non_map)),
-      b_.CreateGEP(print_struct, buf, { b_.getInt64(0), b_.getInt32(0) }));
-
-  // Store print id
   auto found_id = bpftrace_.resources.non_map_print_args_id_map.find(&call);
   if (found_id == bpftrace_.resources.non_map_print_args_id_map.end()) {
     LOG(BUG) << "No id found for non_map_print call";
   }
-  b_.CreateStore(
-      b_.getInt64(found_id->second),
-      b_.CreateGEP(print_struct, buf, { b_.getInt64(0), b_.getInt32(1) }));
-
-  // Store content
-  Value *content_offset = b_.CreateGEP(print_struct,
-                                       buf,
-                                       { b_.getInt32(0), b_.getInt32(2) });
-  b_.CreateMemsetBPF(content_offset,
-                     b_.getInt8(0),
-                     type_map_.type(arg).GetSize());
-  if (needMemcpy(type_map_.type(arg))) {
-    if (inBpfMemory(type_map_.type(arg)))
-      b_.CreateMemcpyBPF(content_offset, value, type_map_.type(arg).GetSize());
-    else
-      b_.CreateProbeRead(content_offset, type_map_.type(arg), value, call.loc);
-  } else {
-    b_.CreateStore(value, content_offset);
-  }
 
-  b_.CreateOutput(buf, struct_size, call.loc);
-  if (dyn_cast<AllocaInst>(buf))
-    b_.CreateLifetimeEnd(buf);
+  b_.CreateReservedOutput(struct_size, call.loc, [&](Value *buf) {
+    // Store asyncactionid:
+    b_.CreateStore(
+        b_.getInt64(
+            static_cast<int64_t>(async_action::AsyncAction::print_non_map)),
+        b_.CreateGEP(print_struct, buf, { b_.getInt64(0), b_.getInt32(0) }));
+
+    // Store print id
+    b_.CreateStore(
+        b_.getInt64(found_id->second),
+        b_.CreateGEP(print_struct, buf, { b_.getInt64(0), b_.getInt32(1) }));
+
+    // Store content
+    Value *content_offset = b_.CreateGEP(print_struct,
+                                         buf,
+                                         { b_.getInt32(0), b_.getInt32(2) });
+    b_.CreateMemsetBPF(content_offset,
+                       b_.getInt8(0),
+                       type_map_.type(arg).GetSize());
+    if (needMemcpy(type_map_.type(arg))) {
+      if (inBpfMemory(type_map_.type(arg)))
+        b_.CreateMemcpyBPF(content_offset,
+                           value,
+                           type_map_.type(arg).GetSize());
+      else
+        b_.CreateProbeRead(content_offset,
+                           type_map_.type(arg),
+                           value,
+                           call.loc);
+    } else {
+      b_.CreateStore(value, content_offset);
+    }
+  });
 }
 
 void CodegenLLVM::createMapDefinition(const std::string &name,
@@ -4292,10 +4848,24 @@ void CodegenLLVM::generate_maps(const RequiredResources &required_resources)
 {
   // User-defined maps
   for (const auto &[name, info] : required_resources.maps_info) {
+    // Stored in a fused map, defined below
+    if (!info.fused_map.empty())
+      continue;
     const auto &val_type = info.value_type;
     const auto &key_type = info.key_type;
     createMapDefinition(
         name, info.bpf_type, info.max_entries, key_type, val_type);
+    if (info.rotation_index != -1)
+      createMapDefinition(rotated_map_name(name),
+                          info.bpf_type,
+                          info.max_entries,
+                          key_type,
+                          val_type);
+  }
+
+  for (const auto &[name, info] : required_resources.fused_maps_info) {
+    createMapDefinition(
+        name, info.bpf_type, info.max_entries, info.key_type, info.value_type);
   }
 
   // bpftrace internal maps
@@ -4307,12 +4877,13 @@ void CodegenLLVM::generate_maps(const RequiredResources &required_resources)
                         CreateUInt64());
   }
 
-  if (bpftrace_.need_recursion_check_) {
-    createMapDefinition(to_string(MapType::RecursionPrevention),
-                        BPF_MAP_TYPE_PERCPU_ARRAY,
-                        1,
-                        CreateUInt32(),
-                        CreateUInt64());
+  for (const auto &stack_type : required_resources.interned_stacks) {
+    size_t words = stack_type.limit * stack_type.elem_size() / sizeof(uint64_t);
+    createMapDefinition(stack_type.table_name(),
+                        BPF_MAP_TYPE_LRU_HASH,
+                        bpftrace_.config_->max_map_keys,
+                        CreateUInt64(),
+                        CreateArray(words, CreateUInt64()));
   }
 
   if (required_resources.using_skboutput) {
@@ -5015,36 +5586,251 @@ Pass CreateVerifyPass()
   });
 }
 
-Pass CreateOptimizePass()
+// Runs the module passes added by `build` over `module`.
+static void runPasses(
+    llvm::Module &module,
+    TargetMachine *machine,
+    llvm::function_ref<void(llvm::PassBuilder &, ModulePassManager &)> build,
+    bool unroll = false)
 {
-  return Pass::create("optimize", [](CompiledModule &cm) {
-    PipelineTuningOptions pto;
-    pto.LoopUnrolling = false;
-    pto.LoopInterleaving = false;
-    pto.LoopVectorization = false;
-    pto.SLPVectorization = false;
-
-    llvm::PassBuilder pb(getTargetMachine(), pto);
-
-    // ModuleAnalysisManager must be destroyed first.
-    llvm::LoopAnalysisManager lam;
-    llvm::FunctionAnalysisManager fam;
-    llvm::CGSCCAnalysisManager cgam;
-    llvm::ModuleAnalysisManager mam;
-
-    // Register all the basic analyses with the managers.
-    pb.registerModuleAnalyses(mam);
-    pb.registerCGSCCAnalyses(cgam);
-    pb.registerFunctionAnalyses(fam);
-    pb.registerLoopAnalyses(lam);
-    pb.crossRegisterProxies(lam, fam, cgam, mam);
-
-    ModulePassManager mpm = pb.buildPerModuleDefaultPipeline(
-        llvm::OptimizationLevel::O3);
+  PipelineTuningOptions pto;
+  pto.LoopUnrolling = unroll;
+  pto.LoopInterleaving = false;
+  pto.LoopVectorization = false;
+  pto.SLPVectorization = false;
+
+  llvm::PassBuilder pb(machine, pto);
+
+  // ModuleAnalysisManager must be destroyed first.
+  llvm::LoopAnalysisManager lam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::CGSCCAnalysisManager cgam;
+  llvm::ModuleAnalysisManager mam;
+
+  // Register all the basic analyses with the managers.
+  pb.registerModuleAnalyses(mam);
+  pb.registerCGSCCAnalyses(cgam);
+  pb.registerFunctionAnalyses(fam);
+  pb.registerLoopAnalyses(lam);
+  pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+  ModulePassManager mpm;
+  build(pb, mpm);
+  mpm.run(module, mam);
+}
 
+// The scalar cleanup used by the fast pipeline, and after unrolling by the
+// max pipeline. Promoting allocas is what keeps the stack usage within the
+// verifier's limit; the rest removes the bulk of the redundant loads, stores
+// and branches emitted by codegen.
+static FunctionPassManager cleanupPasses(llvm::PassBuilder &pb)
+{
+  FunctionPassManager fpm;
+  fpm.addPass(SROAPass(SROAOptions::ModifyCFG));
+  fpm.addPass(EarlyCSEPass());
+  fpm.addPass(InstCombinePass());
+  fpm.addPass(SimplifyCFGPass());
+  pb.invokePeepholeEPCallbacks(fpm, llvm::OptimizationLevel::O1);
+  fpm.addPass(ADCEPass());
+  return fpm;
+}
+
+static const char *opt_level_str(ConfigOptLevel level)
+{
+  switch (level) {
+    case ConfigOptLevel::fast:
+      return "fast";
+    case ConfigOptLevel::standard:
+      return "standard";
+    case ConfigOptLevel::max:
+      return "max";
+  }
+  return "unknown";
+}
+
+static void optimize(llvm::Module &module,
+                     TargetMachine *machine,
+                     ConfigOptLevel level)
+{
+  switch (level) {
+    case ConfigOptLevel::fast:
+      // The O0 pipeline still runs the BPF target's own IR passes (e.g. for
+      // preserve_static_offset and CO-RE accesses) and the always-inliner,
+      // both of which are required for the program to load.
+      runPasses(module, machine, [](auto &pb, auto &mpm) {
+        mpm.addPass(pb.buildO0DefaultPipeline(llvm::OptimizationLevel::O0));
+        mpm.addPass(createModuleToFunctionPassAdaptor(cleanupPasses(pb)));
+        mpm.addPass(GlobalDCEPass());
+        mpm.addPass(llvm::StripDeadDebugInfoPass());
+      });
+      break;
+    case ConfigOptLevel::standard:
+      runPasses(module, machine, [](auto &pb, auto &mpm) {
+        mpm.addPass(
+            pb.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O3));
+        mpm.addPass(llvm::StripDeadDebugInfoPass());
+      });
+      break;
+    case ConfigOptLevel::max:
+      runPasses(
+          module,
+          machine,
+          [](auto &pb, auto &mpm) {
+            mpm.addPass(
+                pb.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O3));
+            mpm.addPass(createModuleToFunctionPassAdaptor(cleanupPasses(pb)));
+            mpm.addPass(GlobalDCEPass());
+            mpm.addPass(llvm::StripDeadDebugInfoPass());
+          },
+          /*unroll=*/true);
+      break;
+  }
+}
+
+static SmallVector<char, 0> writeBitcode(const llvm::Module &module)
+{
+  SmallVector<char, 0> data;
+  raw_svector_ostream os(data);
+  WriteBitcodeToFile(module, os);
+  return data;
+}
+
+static Expected<std::unique_ptr<llvm::Module>> readBitcode(
+    const SmallVector<char, 0> &data,
+    LLVMContext &context)
+{
+  return parseBitcodeFile(
+      MemoryBufferRef(StringRef(data.data(), data.size()), "partition"),
+      context);
+}
+
+// Optimizes the module as `jobs` partitions in parallel.
+//
+// An LLVMContext, and everything allocated within it, can only be used by a
+// single thread at a time. The module is therefore split into partitions
+// which are serialized and each optimized in a fresh context on a worker
+// thread, before being linked back into a single module in the original
+// context. Partitioning only depends on the module itself and partitions are
+// always linked back in the same order, so the result is deterministic.
+static Result<> optimizeParallel(CompiledModule &cm,
+                                 size_t jobs,
+                                 ConfigOptLevel level)
+{
+  auto &context = cm.module->getContext();
+
+  // Functions are only defined in one partition after the split, so anything
+  // that must be inlined (e.g. linked stdlib bitcode) is inlined up front.
+  runPasses(*cm.module, getTargetMachine(), [](auto &, auto &mpm) {
+    mpm.addPass(AlwaysInlinerPass());
+    mpm.addPass(GlobalDCEPass());
+  });
+
+  // Keep internal functions (subprograms) with their callers: externalizing
+  // them would turn them into global BPF functions, which are verified
+  // differently by the kernel.
+  std::vector<SmallVector<char, 0>> partitions;
+  size_t used = 0;
+  SplitModule(
+      *cm.module,
+      jobs,
+      [&](std::unique_ptr<llvm::Module> part) {
+        if (llvm::any_of(part->functions(), [](const llvm::Function &fn) {
+              return !fn.isDeclaration();
+            }))
+          used++;
+        partitions.emplace_back(writeBitcode(*part));
+      },
+      /*PreserveLocals=*/true);
+
+  std::vector<std::string> errors(partitions.size());
+  std::atomic<size_t> next = 0;
+  auto worker = [&] {
+    auto machine = createTargetMachine();
+    for (size_t i = next++; i < partitions.size(); i = next++) {
+      LLVMContext part_context;
+      auto part = readBitcode(partitions[i], part_context);
+      if (!part) {
+        errors[i] = toString(part.takeError());
+        continue;
+      }
+      optimize(**part, machine.get(), level);
+      partitions[i] = writeBitcode(**part);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < std::min(jobs, partitions.size()); ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (const auto &err : errors) {
+    if (!err.empty()) {
+      return make_error<SystemError>("optimizing partition: " + err, 0);
+    }
+  }
+
+  std::unique_ptr<llvm::Module> merged;
+  for (const auto &data : partitions) {
+    auto part = readBitcode(data, context);
+    if (!part) {
+      return part.takeError();
+    }
+    if (!merged) {
+      merged = std::move(*part);
+    } else if (Linker::linkModules(*merged, std::move(*part))) {
+      return make_error<LinkError>("error linking optimized partitions",
+                                   EINVAL);
+    }
+  }
+  cm.module = std::move(merged);
+  cm.partitions = used;
+
+  // Drop anything that was only kept alive across partition boundaries.
+  runPasses(*cm.module, getTargetMachine(), [](auto &, auto &mpm) {
+    mpm.addPass(GlobalDCEPass());
     mpm.addPass(llvm::StripDeadDebugInfoPass());
-    mpm.run(*cm.module, mam);
   });
+  return OK();
+}
+
+Pass CreateOptimizePass()
+{
+  return Pass::create(
+      "optimize", [](BPFtrace &bpftrace, CompiledModule &cm) -> Result<> {
+        auto level = bpftrace.config_->opt_level;
+        size_t jobs = bpftrace.config_->compile_jobs;
+        if (jobs == 0) {
+          jobs = std::max(1U, std::thread::hardware_concurrency());
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        auto report = [&] {
+          auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - start);
+          LOG(V1) << "Optimized program (opt_level=" << opt_level_str(level)
+                  << ", partitions=" << cm.partitions << ") in "
+                  << elapsed.count() << "us";
+        };
+
+        // Splitting only pays off with several functions to spread around.
+        size_t functions = llvm::count_if(cm.module->functions(),
+                                          [](const llvm::Function &fn) {
+                                            return !fn.isDeclaration();
+                                          });
+        if (jobs > 1 && functions > 1) {
+          auto ok = optimizeParallel(cm, std::min(jobs, functions), level);
+          if (ok) {
+            report();
+          }
+          return ok;
+        }
+
+        optimize(*cm.module, getTargetMachine(), level);
+        report();
+        return OK();
+      });
 }
 
 Pass CreateDumpIRPass(std::ostream &out)
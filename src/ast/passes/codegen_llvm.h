@@ -28,6 +28,9 @@ public:
   CompiledModule(std::unique_ptr<llvm::Module> module)
       : module(std::move(module)) {};
   std::unique_ptr<llvm::Module> module;
+  // Number of partitions that functions were spread over for optimization,
+  // or 1 if the module was optimized as a whole.
+  size_t partitions = 1;
 };
 
 // Compiles the primary AST, and emits `CompiledModule`.
@@ -39,7 +39,9 @@ public:
   void visit(Cast &cast);
 
 private:
-  void resolve_fields(SizedType &type);
+  void resolve_fields(SizedType &type, bool nested = false);
+  void resolve_value_fields(bool is_field_base);
+  void resolve_args_fields();
   void resolve_type(const ParsedType &type);
 
   ProbeType probe_type_;
@@ -49,6 +51,9 @@ private:
   bpf_prog_type prog_type_{ BPF_PROG_TYPE_UNSPEC };
   bool has_builtin_args_;
   Probe *probe_ = nullptr;
+  // The expression whose record type is only used to access one of its
+  // fields, i.e. which doesn't need its embedded records resolved.
+  const Node *field_base_ = nullptr;
 
   std::map<std::string, SizedType> var_types_;
 };
@@ -62,6 +67,7 @@ void FieldAnalyser::visit(Identifier &identifier)
 
 void FieldAnalyser::visit(Builtin &builtin)
 {
+  bool is_field_base = field_base_ == &builtin;
   std::string builtin_type;
   sized_type_ = CreateNone();
   if (builtin.ident == "ctx") {
@@ -85,6 +91,8 @@ void FieldAnalyser::visit(Builtin &builtin)
     if (!probe_)
       return;
     has_builtin_args_ = true;
+    if (!is_field_base)
+      resolve_args_fields();
     return;
   } else if (builtin.ident == "__builtin_retval") {
     if (!probe_)
@@ -98,6 +106,7 @@ void FieldAnalyser::visit(Builtin &builtin)
 
   if (bpftrace_.has_btf_data())
     sized_type_ = bpftrace_.btf_->get_stype(builtin_type);
+  resolve_value_fields(is_field_base);
 }
 
 void FieldAnalyser::visit(Map &map)
@@ -116,8 +125,10 @@ void FieldAnalyser::visit(Variable &var)
 
 void FieldAnalyser::visit(FieldAccess &acc)
 {
+  bool is_field_base = field_base_ == &acc;
   has_builtin_args_ = false;
 
+  field_base_ = &acc.expr.node();
   visit(acc.expr);
 
   // Automatically resolve through pointers.
@@ -133,6 +144,7 @@ void FieldAnalyser::visit(FieldAccess &acc)
 
     has_builtin_args_ = false;
   } else if (sized_type_.IsCTypeTy()) {
+    resolve_fields(sized_type_);
     SizedType field_type = CreateNone();
     if (sized_type_.HasField(acc.field))
       field_type = sized_type_.GetField(acc.field).type;
@@ -148,11 +160,15 @@ void FieldAnalyser::visit(FieldAccess &acc)
       bpftrace_.btf_set_.insert(field_type_name);
     }
   }
+
+  resolve_value_fields(is_field_base);
 }
 
 void FieldAnalyser::visit(ArrayAccess &arr)
 {
+  bool is_field_base = field_base_ == &arr;
   visit(arr.indexpr);
+  field_base_ = &arr.expr.node();
   visit(arr.expr);
   if (sized_type_.IsPtrTy()) {
     sized_type_ = sized_type_.GetPointeeTy();
@@ -161,6 +177,7 @@ void FieldAnalyser::visit(ArrayAccess &arr)
     sized_type_ = sized_type_.GetElementTy();
     resolve_fields(sized_type_);
   }
+  resolve_value_fields(is_field_base);
 }
 
 void FieldAnalyser::visit(MapAccess &acc)
@@ -177,6 +194,15 @@ void FieldAnalyser::visit(Sizeof &szof)
 void FieldAnalyser::visit(Offsetof &offof)
 {
   visit(*offof.type_of);
+
+  // Nested fields (e.g. `offsetof(struct Foo, a.b)`) walk embedded records.
+  auto record = sized_type_;
+  for (const auto &field : offof.field) {
+    resolve_fields(record);
+    if (!record.IsCTypeTy() || !record.HasField(field))
+      break;
+    record = record.GetField(field).type;
+  }
 }
 
 void FieldAnalyser::visit(Typeof &typeof)
@@ -203,14 +229,16 @@ void FieldAnalyser::visit(AssignVarStatement &assignment)
 
 void FieldAnalyser::visit(Unop &unop)
 {
+  bool is_field_base = field_base_ == &unop;
   visit(unop.expr);
   if (unop.op == Operator::MUL && sized_type_.IsPtrTy()) {
     sized_type_ = sized_type_.GetPointeeTy();
     resolve_fields(sized_type_);
+    resolve_value_fields(is_field_base);
   }
 }
 
-void FieldAnalyser::resolve_fields(SizedType &type)
+void FieldAnalyser::resolve_fields(SizedType &type, bool nested)
 {
   if (!type.IsCTypeTy())
     return;
@@ -221,8 +249,36 @@ void FieldAnalyser::resolve_fields(SizedType &type)
         dwarf->resolve_fields(type);
   }
 
-  if (type.GetFieldCount() == 0 && bpftrace_.has_btf_data())
-    bpftrace_.btf_->resolve_fields(type);
+  if ((nested || type.GetFieldCount() == 0) && bpftrace_.has_btf_data())
+    bpftrace_.btf_->resolve_fields(type, nested);
+}
+
+// BTF records are resolved lazily, one level at a time, as fields are
+// accessed. A record which is used as a whole (printed, stored, etc.) needs
+// all of its embedded records resolved too.
+void FieldAnalyser::resolve_value_fields(bool is_field_base)
+{
+  if (is_field_base)
+    return;
+  if (sized_type_.IsCTypeTy())
+    resolve_fields(sized_type_, true);
+}
+
+// Same for the arguments of a probe, when `args` is used as a whole.
+void FieldAnalyser::resolve_args_fields()
+{
+  auto type_name = probe_->args_typename();
+  if (!type_name)
+    return;
+  auto args = bpftrace_.structs.Lookup(*type_name).lock();
+  if (!args)
+    return;
+  for (const auto &arg : args->fields) {
+    auto arg_type = arg.type;
+    while (arg_type.IsArrayTy())
+      arg_type = arg_type.GetElementTy();
+    resolve_fields(arg_type, true);
+  }
 }
 
 void FieldAnalyser::resolve_type(const ParsedType &type)
@@ -275,8 +331,10 @@ void FieldAnalyser::visit(Cast &cast)
 {
   // N.B. Visit the expression first, so that fields can be resolved, but then
   // visit the type so that the returned sized_type_ is always the type.
+  bool is_field_base = field_base_ == &cast;
   visit(cast.expr);
   visit(cast.typeof);
+  resolve_value_fields(is_field_base);
 }
 
 Pass CreateFieldAnalyserPass()
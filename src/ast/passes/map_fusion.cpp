@@ -0,0 +1,232 @@
+#include <map>
+#include <set>
+#include <unordered_set>
+
+#include "ast/passes/map_fusion.h"
+#include "ast/visitor.h"
+#include "bpfmap.h"
+#include "bpftrace.h"
+#include "required_resources.h"
+
+namespace bpftrace::ast {
+
+namespace {
+
+const std::unordered_set<std::string> FUSABLE_FUNCS = {
+  "avg", "count", "max", "min", "stats", "sum",
+};
+
+// Builtins which have the same value throughout a single run of a probe.
+const std::unordered_set<std::string> STABLE_BUILTINS = {
+  "args",
+  "pid",
+  "tid",
+  "__builtin_comm",
+  "__builtin_cpid",
+  "__builtin_cpu",
+  "__builtin_func",
+  "__builtin_ncpus",
+  "__builtin_probe",
+  "__builtin_retval",
+  "__builtin_usermode",
+};
+
+// Checks that an expression has no side effects and evaluates to the same
+// value wherever it appears within a run of statements.
+class StabilityCheck : public Visitor<StabilityCheck> {
+public:
+  using Visitor<StabilityCheck>::visit;
+
+  void visit(Builtin &builtin)
+  {
+    if (!STABLE_BUILTINS.contains(builtin.ident))
+      stable = false;
+  }
+  void visit([[maybe_unused]] Call &call)
+  {
+    stable = false;
+  }
+  void visit([[maybe_unused]] BlockExpr &block)
+  {
+    stable = false;
+  }
+  void visit(Unop &unop)
+  {
+    if (unop.op == Operator::PRE_INCREMENT ||
+        unop.op == Operator::PRE_DECREMENT ||
+        unop.op == Operator::POST_INCREMENT ||
+        unop.op == Operator::POST_DECREMENT)
+      stable = false;
+    Visitor<StabilityCheck>::visit(unop);
+  }
+
+  bool stable = true;
+};
+
+bool is_stable(Call &call)
+{
+  StabilityCheck check;
+  for (size_t i = 1; i < call.vargs.size(); i++)
+    check.visit(call.vargs.at(i));
+  return check.stable;
+}
+
+// An aggregation into a map, as a statement of its own.
+Call *aggregation(Statement &stmt)
+{
+  auto *discard = stmt.as<DiscardExpr>();
+  if (!discard)
+    return nullptr;
+  auto *call = discard->expr.as<Call>();
+  if (!call || !FUSABLE_FUNCS.contains(call->func) || call->vargs.size() < 2 ||
+      !call->vargs.at(0).is<Map>())
+    return nullptr;
+  return call;
+}
+
+class MapFusion : public Visitor<MapFusion> {
+public:
+  using Visitor<MapFusion>::visit;
+
+  // Maps which are used in any other way must keep their own BPF map.
+  void visit(Map &map)
+  {
+    excluded.insert(map.ident);
+  }
+  void visit(MapDeclStatement &decl)
+  {
+    excluded.insert(decl.ident);
+  }
+  void visit(BlockExpr &block);
+
+  std::vector<std::set<std::string>> runs;
+  std::unordered_set<std::string> excluded;
+};
+
+void MapFusion::visit(BlockExpr &block)
+{
+  for (size_t i = 0; i < block.stmts.size();) {
+    auto run = fusable_run(block.stmts, i);
+    if (run.empty()) {
+      visit(block.stmts.at(i++));
+      continue;
+    }
+
+    auto &maps = runs.emplace_back();
+    for (auto *call : run) {
+      maps.insert(call->vargs.at(0).as<Map>()->ident);
+      for (size_t j = 1; j < call->vargs.size(); j++)
+        visit(call->vargs.at(j));
+    }
+    i += run.size();
+  }
+  visit(block.expr);
+}
+
+bool can_fuse(const MapInfo &info, const MapInfo &first)
+{
+  return (info.bpf_type == BPF_MAP_TYPE_PERCPU_HASH ||
+          info.bpf_type == BPF_MAP_TYPE_LRU_PERCPU_HASH) &&
+         get_fused_value_size(info.value_type).has_value() &&
+         info.bpf_type == first.bpf_type && info.key_type == first.key_type &&
+         info.is_scalar == first.is_scalar &&
+         info.max_entries == first.max_entries;
+}
+
+void fuse_maps(const MapFusion &fusion, RequiredResources &resources)
+{
+  // A group of maps can only be fused if every run which updates any of them
+  // updates all of them, so that they always have the same set of keys.
+  std::map<std::string, std::set<std::string>> groups;
+  std::unordered_set<std::string> conflicting;
+  for (const auto &run : fusion.runs) {
+    for (const auto &name : run) {
+      auto [it, inserted] = groups.emplace(name, run);
+      if (!inserted && it->second != run)
+        conflicting.insert(name);
+    }
+  }
+
+  std::set<std::set<std::string>> candidates;
+  for (const auto &[_, group] : groups)
+    candidates.insert(group);
+
+  for (const auto &group : candidates) {
+    if (group.size() < 2)
+      continue;
+
+    auto first = resources.maps_info.find(*group.begin());
+    if (first == resources.maps_info.end())
+      continue;
+
+    bool fusable = true;
+    for (const auto &name : group) {
+      auto it = resources.maps_info.find(name);
+      if (conflicting.contains(name) || fusion.excluded.contains(name) ||
+          it == resources.maps_info.end() ||
+          !can_fuse(it->second, first->second)) {
+        fusable = false;
+        break;
+      }
+    }
+    if (!fusable)
+      continue;
+
+    auto fused_name = "fused_" +
+                      std::to_string(resources.fused_maps_info.size());
+    size_t offset = 0;
+    for (const auto &name : group) {
+      auto &info = resources.maps_info.at(name);
+      info.fused_map = fused_name;
+      info.fused_offset = offset;
+      offset += *get_fused_value_size(info.value_type);
+    }
+
+    MapInfo fused_info;
+    fused_info.key_type = first->second.key_type;
+    fused_info.value_type = CreateArray(offset / sizeof(uint64_t),
+                                        CreateUInt64());
+    fused_info.max_entries = first->second.max_entries;
+    fused_info.bpf_type = first->second.bpf_type;
+    fused_info.is_scalar = first->second.is_scalar;
+    resources.fused_maps_info.emplace(fused_name, std::move(fused_info));
+  }
+}
+
+} // namespace
+
+std::vector<Call *> fusable_run(StatementList &stmts, size_t start)
+{
+  std::vector<Call *> run;
+  std::unordered_set<std::string> maps;
+  for (size_t i = start; i < stmts.size(); i++) {
+    auto *call = aggregation(stmts.at(i));
+    if (!call)
+      break;
+
+    // Later keys are assumed to equal the first, and all values are evaluated
+    // after the one lookup, so nothing may change between the statements.
+    if (!run.empty()) {
+      if (!is_stable(*run.front()) || !is_stable(*call) ||
+          !(call->vargs.at(1) == run.front()->vargs.at(1)) ||
+          maps.contains(call->vargs.at(0).as<Map>()->ident))
+        break;
+    }
+    maps.insert(call->vargs.at(0).as<Map>()->ident);
+    run.push_back(call);
+  }
+  return run;
+}
+
+Pass CreateMapFusionPass()
+{
+  auto fn = [](ASTContext &ast, BPFtrace &b) {
+    MapFusion fusion;
+    fusion.visit(ast.root);
+    fuse_maps(fusion, b.resources);
+  };
+
+  return Pass::create("MapFusion", fn);
+}
+
+} // namespace bpftrace::ast
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <vector>
+
+#include "ast/ast.h"
+#include "ast/pass_manager.h"
+
+namespace bpftrace::ast {
+
+// Returns the aggregations (`count()`, `sum()`, ...) made by consecutive
+// statements starting at `start` which can share a single map lookup: they
+// update distinct maps with the same key, and neither the key nor any of the
+// values depend on the order of evaluation. Returns an empty list if the
+// statement at `start` is not an aggregation.
+std::vector<Call *> fusable_run(StatementList &stmts, size_t start);
+
+// Stores the values of maps which are only ever aggregated together, with the
+// same keys, in a single BPF map so that each event does one lookup instead
+// of one per map. The maps are split back out when printed.
+Pass CreateMapFusionPass();
+
+} // namespace bpftrace::ast
@@ -27,7 +27,7 @@ const std::unordered_set<std::string> &getAssignRewriteFuncs()
 const std::unordered_set<std::string> &getRawMapArgFuncs()
 {
   static std::unordered_set<std::string> RAW_MAP_ARG = {
-    "print", "clear", "zero", "len", "is_scalar",
+    "print", "clear", "zero", "rotate", "len", "is_scalar",
   };
   return RAW_MAP_ARG;
 }
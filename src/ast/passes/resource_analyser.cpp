@@ -67,6 +67,7 @@ private:
 
   void update_map_info(Map &map);
   void update_variable_info(Variable &var);
+  void update_stack_info(const SizedType &ty);
 
   RequiredResources resources_;
   BPFtrace &bpftrace_;
@@ -135,12 +136,15 @@ RequiredResources ResourceAnalyser::resources()
     resources_.global_vars.add_known(bpftrace::globalvars::MAP_KEY_BUFFER);
   }
 
-  if (resources_.join_value_size > 0) {
-    resources_.global_vars.add_known(bpftrace::globalvars::JOIN_BUFFER);
-  }
-
   resources_.global_vars.add_known(bpftrace::globalvars::MAX_CPU_ID);
   resources_.global_vars.add_known(bpftrace::globalvars::EVENT_LOSS_COUNTER);
+  if (bpftrace_.need_recursion_check_) {
+    resources_.global_vars.add_known(
+        bpftrace::globalvars::RECURSION_PREVENTION);
+  }
+  if (resources_.rotated_maps > 0) {
+    resources_.global_vars.add_known(bpftrace::globalvars::MAP_ROTATION);
+  }
 
   return std::move(resources_);
 }
@@ -171,12 +175,7 @@ void ResourceAnalyser::visit(Builtin &builtin)
     resources_.global_vars.add_known(bpftrace::globalvars::CHILD_PID);
   } else if (builtin.ident == "ustack" || builtin.ident == "kstack" ||
              builtin.ident == "__builtin_dw_ustack") {
-    const auto &ty = type_map_.type(&builtin);
-    if (exceeds_stack_limit(ty.GetSize())) {
-      resources_.call_stack_buffers++;
-      resources_.max_call_stack_size = std::max(resources_.max_call_stack_size,
-                                                ty.GetSize());
-    }
+    update_stack_info(type_map_.type(&builtin));
   } else if (builtin.ident == "__builtin_elapsed") {
     resources_.needs_elapsed_map = true;
   }
@@ -202,18 +201,34 @@ void ResourceAnalyser::visit(Call &call)
     //
     // Thus, we are good to reuse the padding logic present in tuple
     // creation to generate offsets for each argument in the args "tuple".
-    auto tuple = Struct::CreateTuple(args);
-
-    // Keep track of max "tuple" size needed for fmt string args. Codegen
-    // will use this information to create a percpu array map of large
-    // enough size for all fmt string calls to use. Note that since this
-    // will end up being aligned differently than the arguments themselves,
-    // we need to ensure that it is aligned to the size of the largest type.
-    uint64_t args_size = sizeof(uint64_t) + static_cast<uint64_t>(tuple->size);
-    if (args_size % sizeof(uint64_t) != 0) {
-      args_size += sizeof(uint64_t) - (args_size % sizeof(uint64_t));
+    //
+    // Strings are the exception: their slot only holds a StringRef, and the
+    // bytes themselves are appended after the tuple.
+    std::vector<SizedType> slots;
+    uint64_t strings_size = 0;
+    for (const auto &arg : args) {
+      if (arg.IsStringTy()) {
+        static_assert(sizeof(AsyncEvent::StringRef) == sizeof(uint64_t));
+        slots.push_back(CreateUInt64());
+        strings_size += arg.GetSize();
+      } else {
+        slots.push_back(arg);
+      }
+    }
+    auto tuple = Struct::CreateTuple(slots);
+    for (size_t i = 0; i < args.size(); i++) {
+      tuple->fields[i].type = args[i];
     }
-    if (exceeds_stack_limit(args_size)) {
+
+    // Records carrying strings have a variable size, and are built in a
+    // scratch buffer large enough for the longest strings before being
+    // output. Other records are written to the ring buffer directly.
+    if (strings_size > 0) {
+      uint64_t args_size = sizeof(uint64_t) +
+                           static_cast<uint64_t>(tuple->size) + strings_size;
+      if (args_size % sizeof(uint64_t) != 0) {
+        args_size += sizeof(uint64_t) - (args_size % sizeof(uint64_t));
+      }
       resources_.max_fmtstring_args_size = std::max(
           resources_.max_fmtstring_args_size, args_size);
     }
@@ -336,12 +351,7 @@ void ResourceAnalyser::visit(Call &call)
     }
   } else if (call.func == "ustack" || call.func == "kstack" ||
              call.func == "__builtin_dw_ustack") {
-    const auto &ty = type_map_.type(&call);
-    if (exceeds_stack_limit(ty.GetSize())) {
-      resources_.call_stack_buffers++;
-      resources_.max_call_stack_size = std::max(resources_.max_call_stack_size,
-                                                ty.GetSize());
-    }
+    update_stack_info(type_map_.type(&call));
   } else if (call.func == "time") {
     resources_.time_args_id_map[&call] = resources_.time_args.size();
     if (!call.vargs.empty())
@@ -352,18 +362,12 @@ void ResourceAnalyser::visit(Call &call)
     resources_.strftime_args_id_map[&call] = resources_.strftime_args.size();
     resources_.strftime_args.push_back(call.vargs.at(0).as<String>()->value);
   } else if (call.func == "print") {
-    constexpr auto nonmap_headroom = sizeof(AsyncEvent::PrintNonMap);
     auto &arg = call.vargs.at(0);
     if (!arg.is<Map>()) {
       const auto &arg_type = type_map_.type(arg);
       resources_.non_map_print_args_id_map[&call] =
           resources_.non_map_print_args.size();
       resources_.non_map_print_args.push_back(arg_type);
-      const size_t fmtstring_args_size = nonmap_headroom + arg_type.GetSize();
-      if (exceeds_stack_limit(fmtstring_args_size)) {
-        resources_.max_fmtstring_args_size = std::max<uint64_t>(
-            resources_.max_fmtstring_args_size, fmtstring_args_size);
-      }
     }
   } else if (call.func == "cgroup_path") {
     resources_.cgroup_path_args_id_map[&call] =
@@ -382,12 +386,15 @@ void ResourceAnalyser::visit(Call &call)
     resources_.using_skboutput = true;
   }
 
-  if (call.func == "print" || call.func == "clear" || call.func == "zero") {
+  if (call.func == "print" || call.func == "clear" || call.func == "zero" ||
+      call.func == "rotate") {
     if (auto *map = call.vargs.at(0).as<Map>()) {
       auto &name = map->ident;
       auto &map_info = resources_.maps_info[name];
       if (map_info.id == -1)
         map_info.id = next_map_id_++;
+      if (call.func == "rotate" && map_info.rotation_index == -1)
+        map_info.rotation_index = resources_.rotated_maps++;
     }
   }
 
@@ -397,12 +404,6 @@ void ResourceAnalyser::visit(Call &call)
       resources_.str_buffers++;
   }
 
-  if (call.func == "join") {
-    resources_.join_value_size = offsetof(AsyncEvent::Join, content) +
-                                 (bpftrace_.join_argnum_ *
-                                  bpftrace_.join_argsize_);
-  }
-
   // These functions, some of which are desugared AssignMapStatements (e.g.,
   // `@a[1, 2, 3] = count(); -> count(@a, (1, 2, 3));`) might require
   // additional map key scratch buffers because the map key type might be
@@ -602,6 +603,19 @@ void ResourceAnalyser::update_variable_info(Variable &var)
   }
 }
 
+void ResourceAnalyser::update_stack_info(const SizedType &ty)
+{
+  // Interned stacks are still collected in full before being hashed.
+  auto frames_ty = CreateStackFrames(ty);
+  if (exceeds_stack_limit(frames_ty.GetSize())) {
+    resources_.call_stack_buffers++;
+    resources_.max_call_stack_size = std::max(resources_.max_call_stack_size,
+                                              frames_ty.GetSize());
+  }
+  if (ty.stack_type.interned)
+    resources_.interned_stacks.insert(ty.stack_type);
+}
+
 void ResourceAnalyser::visit(AssignVarStatement &assignment)
 {
   Visitor<ResourceAnalyser>::visit(assignment);
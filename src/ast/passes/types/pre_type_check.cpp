@@ -317,6 +317,7 @@ const std::map<std::string, nargs_spec> CALL_NARGS = {
   { "printf",         { .min_args=1, .max_args=128 } },
   { "pton",           { .min_args=1, .max_args=1 } },
   { "reg",            { .min_args=1, .max_args=1 } },
+  { "rotate",         { .min_args=1, .max_args=1 } },
   { "sizeof",         { .min_args=1, .max_args=1 } },
   { "skboutput",      { .min_args=4, .max_args=4 } },
   { "socket_cookie",  { .min_args=1, .max_args=1 } },
@@ -34,8 +34,9 @@ namespace bpftrace::ast {
 namespace {
 
 std::unordered_set<std::string> VOID_RETURNING_FUNCS = {
-  "join", "printf", "errorf", "warnf", "system", "cat",     "debugf",
-  "exit", "print",  "clear",  "zero",  "time",   "unwatch", "fail"
+  "join",   "printf", "errorf", "warnf", "system", "cat",     "debugf",
+  "exit",   "print",  "clear",  "zero",  "time",   "unwatch", "fail",
+  "rotate"
 };
 
 std::unordered_map<std::string, SizedType (*)()> SIMPLE_BUILTIN_TYPES = {
@@ -854,15 +855,22 @@ void TypeRuleCollector::visit(Builtin &builtin)
     if (bpftrace_.config_->stack_mode == StackMode::build_id) {
       builtin.addWarning() << "'build_id' stack mode can only be used for "
                               "ustack. Falling back to 'raw' mode.";
-      builtin_type = CreateStack(true, StackType{ .mode = StackMode::raw });
+      builtin_type = CreateStack(
+          true,
+          StackType{ .mode = StackMode::raw,
+                     .interned = bpftrace_.config_->intern_stacks });
     } else {
       builtin_type = CreateStack(
-          true, StackType{ .mode = bpftrace_.config_->stack_mode });
+          true,
+          StackType{ .mode = bpftrace_.config_->stack_mode,
+                     .interned = bpftrace_.config_->intern_stacks });
     }
   } else if (builtin.ident == "ustack" ||
              builtin.ident == "__builtin_dw_ustack") {
     builtin_type = CreateStack(
-        false, StackType{ .mode = bpftrace_.config_->stack_mode });
+        false,
+        StackType{ .mode = bpftrace_.config_->stack_mode,
+                   .interned = bpftrace_.config_->intern_stacks });
   } else if (builtin.ident == "__builtin_comm") {
     constexpr int COMM_SIZE = 16;
     builtin_type = CreateString(COMM_SIZE);
@@ -2525,6 +2533,7 @@ SizedType TypeRuleCollector::get_stack_type(Call &call, bool kernel)
   auto return_type = CreateStack(kernel);
   StackType stack_type;
   stack_type.mode = bpftrace_.config_->stack_mode;
+  stack_type.interned = bpftrace_.config_->intern_stacks;
 
   auto nargs = call.vargs.size();
   if (nargs > 2) {
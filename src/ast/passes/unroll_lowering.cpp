@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <unordered_set>
+
+#include "ast/ast.h"
+#include "ast/passes/collect_nodes.h"
+#include "ast/passes/unroll_lowering.h"
+#include "ast/visitor.h"
+#include "bpffeature.h"
+#include "bpftrace.h"
+#include "probe_types.h"
+
+namespace bpftrace::ast {
+
+namespace {
+
+// Unrolling copies the body once per iteration, while a loop pays for a
+// helper call and a context reload per iteration. Past this many AST nodes in
+// total, the extra instructions (and verifier work) outweigh the call.
+constexpr uint64_t UNROLL_NODE_BUDGET = 256;
+
+// Builtins which may be used from a loop callback. Anything else might need
+// the probe context, which is not passed to the callback.
+const std::unordered_set<std::string> CTX_FREE_BUILTINS = {
+  "pid",
+  "tid",
+  "__builtin_comm",
+  "__builtin_cpid",
+  "__builtin_cpu",
+  "__builtin_elapsed",
+  "__builtin_ncpus",
+  "__builtin_probe",
+};
+
+// Functions which need the probe context or change the control flow of the
+// whole probe, and so can't be moved into a loop callback.
+const std::unordered_set<std::string> CTX_FUNCS = {
+  "__builtin_dw_ustack",
+  "exit",
+  "kstack",
+  "override",
+  "reg",
+  "skboutput",
+  "ustack",
+};
+
+class NodeCounter : public Visitor<NodeCounter> {
+public:
+  using Visitor<NodeCounter>::visit;
+
+  void visit(Expression &expr)
+  {
+    count++;
+    Visitor<NodeCounter>::visit(expr);
+  }
+  void visit(Statement &stmt)
+  {
+    count++;
+    Visitor<NodeCounter>::visit(stmt);
+  }
+
+  uint64_t count = 0;
+};
+
+class UnrollLowering : public Visitor<UnrollLowering> {
+public:
+  UnrollLowering(ASTContext &ast) : ast_(ast) {};
+
+  using Visitor<UnrollLowering>::visit;
+  void visit(Probe &probe);
+  void visit(Statement &stmt);
+
+private:
+  bool should_lower(Unroll &unroll);
+
+  ASTContext &ast_;
+  bool in_iter_ = false;
+  int next_id_ = 0;
+};
+
+} // namespace
+
+void UnrollLowering::visit(Probe &probe)
+{
+  // Printing from iterators goes through the probe context.
+  in_iter_ = std::ranges::any_of(probe.attach_points, [](const auto *ap) {
+    return probetype(ap->provider) == ProbeType::iter;
+  });
+  Visitor<UnrollLowering>::visit(probe);
+  in_iter_ = false;
+}
+
+bool UnrollLowering::should_lower(Unroll &unroll)
+{
+  auto *integer = unroll.expr.as<Integer>();
+  // Invalid counts are left for the type checks to report.
+  if (!integer || integer->value < 2 || integer->value > 100)
+    return false;
+
+  // Inside the body, jumps refer to the enclosing loop or probe; inside a
+  // callback they would refer to the callback itself.
+  CollectNodes<Jump> jumps;
+  jumps.visit(unroll.block);
+  if (!jumps.nodes().empty())
+    return false;
+
+  CollectNodes<Builtin> builtins;
+  builtins.visit(unroll.block, [](const Builtin &builtin) {
+    return !CTX_FREE_BUILTINS.contains(builtin.ident);
+  });
+  if (!builtins.nodes().empty())
+    return false;
+
+  CollectNodes<Call> calls;
+  calls.visit(unroll.block, [this](const Call &call) {
+    return CTX_FUNCS.contains(call.func) || (in_iter_ && call.func == "printf");
+  });
+  if (!calls.nodes().empty())
+    return false;
+
+  NodeCounter counter;
+  counter.visit(unroll.block);
+  return integer->value * counter.count > UNROLL_NODE_BUDGET;
+}
+
+void UnrollLowering::visit(Statement &stmt)
+{
+  // Lower inner statements first, so that the size of an outer body reflects
+  // any loops already created within it.
+  Visitor<UnrollLowering>::visit(stmt);
+
+  auto *unroll = stmt.as<Unroll>();
+  if (!unroll || !should_lower(*unroll))
+    return;
+
+  // unroll(N) { ... }  =>  for $__unroll_index_K : 0..N { ... }
+  //
+  // The loop variable is never referenced by the body; it is named uniquely
+  // so that nested lowered loops do not shadow each other.
+  const auto &loc = unroll->loc;
+  auto *decl = ast_.make_node<Variable>(
+      loc, "__unroll_index_" + std::to_string(next_id_++));
+  auto *range = ast_.make_node<Range>(
+      loc,
+      ast_.make_node<Integer>(loc, 0),
+      ast_.make_node<Integer>(loc, unroll->expr.as<Integer>()->value));
+  stmt = ast_.make_node<For>(loc, decl, range, unroll->block);
+}
+
+Pass CreateUnrollLoweringPass()
+{
+  auto fn = [](ASTContext &ast, BPFtrace &b) {
+    if (!b.feature_->has_helper_loop())
+      return;
+    UnrollLowering lowering(ast);
+    lowering.visit(ast.root);
+  };
+
+  return Pass::create("UnrollLowering", fn);
+}
+
+} // namespace bpftrace::ast
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "ast/pass_manager.h"
+
+namespace bpftrace::ast {
+
+// Rewrites `unroll` statements whose fully unrolled body would be large into
+// bounded `for` loops, which are lowered to a single `bpf_loop` callback
+// instead of N copies of the body.
+Pass CreateUnrollLoweringPass();
+
+} // namespace bpftrace::ast
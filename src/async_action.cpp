@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <fstream>
 #include <memory>
 #include <string>
@@ -13,6 +16,31 @@
 
 namespace bpftrace::async_action {
 
+// Strings are packed after the fixed-size part of the record, see
+// AsyncEvent::StringRef. This expands them back to their full size.
+static Result<OpaqueValue> unpack_string(const Field &field,
+                                         const OpaqueValue &value)
+{
+  // The reference and the bytes it points to both come from the record, so
+  // check them against its size rather than trusting them.
+  if (field.offset < 0 ||
+      static_cast<size_t>(field.offset) + sizeof(AsyncEvent::StringRef) >
+          value.size())
+    return make_error<SystemError>("string argument outside of the record",
+                                   EINVAL);
+  auto ref = value.slice(field.offset).bitcast<AsyncEvent::StringRef>();
+  if (static_cast<size_t>(ref.offset) + ref.length > value.size())
+    return make_error<SystemError>("string argument outside of the record",
+                                   EINVAL);
+
+  auto size = static_cast<size_t>(field.type.GetSize());
+  auto str = value.slice(ref.offset, std::min<size_t>(ref.length, size));
+  return OpaqueValue::alloc(size, [&](char *data) {
+    memcpy(data, str.data(), str.size());
+    memset(data + str.size(), 0, size - str.size());
+  });
+}
+
 static Result<std::vector<output::Primitive>> prepare_args(
     BPFtrace &bpftrace,
     const ast::CDefinitions &c_definitions,
@@ -21,10 +49,14 @@ static Result<std::vector<output::Primitive>> prepare_args(
 {
   std::vector<output::Primitive> res;
   for (const auto &field : fields) {
-    auto v = format(bpftrace,
-                    c_definitions,
-                    field.type,
-                    value.slice(field.offset, field.type.GetSize()));
+    auto arg = field.type.IsStringTy()
+                   ? unpack_string(field, value)
+                   : Result<OpaqueValue>(
+                         value.slice(field.offset, field.type.GetSize()));
+    if (!arg) {
+      return arg.takeError();
+    }
+    auto v = format(bpftrace, c_definitions, field.type, *arg);
     if (!v) {
       return v.takeError();
     }
@@ -110,9 +142,18 @@ Result<> AsyncHandlers::print_map(const OpaqueValue &data)
 {
   auto print = data.bitcast<AsyncEvent::Print>();
   const auto &map = bpftrace.bytecode_.getMap(print.mapid);
+  return print_map(bpftrace.bytecode_.getLiveMap(bpftrace, map),
+                   print.top,
+                   print.div);
+}
+
+Result<> AsyncHandlers::print_map(const BpfMap &map,
+                                  uint32_t top,
+                                  uint32_t div)
+{
   const auto &map_info = bpftrace.resources.maps_info.at(map.name());
 
-  auto res = format(bpftrace, c_definitions, map, print.top, print.div);
+  auto res = format(bpftrace, c_definitions, map, top, div);
   if (!res) {
     return res.takeError();
   }
@@ -161,7 +202,8 @@ Result<> AsyncHandlers::print_map(const OpaqueValue &data)
 Result<> AsyncHandlers::zero_map(const OpaqueValue &data)
 {
   auto mapevent = data.bitcast<AsyncEvent::MapEvent>();
-  const auto &map = bpftrace.bytecode_.getMap(mapevent.mapid);
+  const auto &map = bpftrace.bytecode_.getLiveMap(
+      bpftrace, bpftrace.bytecode_.getMap(mapevent.mapid));
   uint64_t nvalues = map.is_per_cpu_type() ? bpftrace.ncpus_ : 1;
   return map.zero_out(nvalues);
 }
@@ -169,7 +211,21 @@ Result<> AsyncHandlers::zero_map(const OpaqueValue &data)
 Result<> AsyncHandlers::clear_map(const OpaqueValue &data)
 {
   auto mapevent = data.bitcast<AsyncEvent::MapEvent>();
-  const auto &map = bpftrace.bytecode_.getMap(mapevent.mapid);
+  const auto &map = bpftrace.bytecode_.getLiveMap(
+      bpftrace, bpftrace.bytecode_.getMap(mapevent.mapid));
+  return map.clear();
+}
+
+Result<> AsyncHandlers::rotate_map(const OpaqueValue &data)
+{
+  auto mapevent = data.bitcast<AsyncEvent::MapEvent>();
+  // Probes no longer update the map once it is rotated out, so printing and
+  // clearing it does not lose any updates.
+  const auto &map = bpftrace.bytecode_.rotateMap(
+      bpftrace, bpftrace.bytecode_.getMap(mapevent.mapid));
+  auto ok = print_map(map, 0, 1);
+  if (!ok)
+    return ok.takeError();
   return map.clear();
 }
 
@@ -24,6 +24,7 @@ enum class AsyncAction {
   print_non_map,
   strftime,
   skboutput,
+  rotate,
   // clang-format on
 };
 
@@ -44,6 +45,7 @@ public:
   Result<> print_map(const OpaqueValue &data);
   Result<> zero_map(const OpaqueValue &data);
   Result<> clear_map(const OpaqueValue &data);
+  Result<> rotate_map(const OpaqueValue &data);
   Result<> skboutput(const OpaqueValue &data);
   Result<> syscall(const OpaqueValue &data);
   Result<> cat(const OpaqueValue &data);
@@ -55,6 +57,8 @@ public:
   }
 
 private:
+  Result<> print_map(const BpfMap &map, uint32_t top, uint32_t div);
+
   BPFtrace &bpftrace;
   const ast::CDefinitions &c_definitions;
   output::Output *out;
@@ -1,7 +1,11 @@
 #include "bpfbytecode.h"
 
 #include <algorithm>
+#include <cerrno>
+#include <cstddef>
 #include <cstring>
+#include <map>
+#include <sstream>
 #include <stdexcept>
 
 #include "ast/passes/named_param.h"
@@ -15,6 +19,9 @@
 #include <bpf/bpf.h>
 #include <bpf/btf.h>
 #include <elf.h>
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 namespace bpftrace {
 
@@ -84,6 +91,11 @@ BpfBytecode::BpfBytecode(std::span<const std::byte> elf)
           *global_var_section_name_opt)] = m;
       continue;
     }
+    if (name.starts_with(ROTATED_MAP_PREFIX)) {
+      auto bpf_name = std::string(name.substr(ROTATED_MAP_PREFIX.size()));
+      rotated_maps_.emplace(bpftrace_map_name(bpf_name), BpfMap(m, bpf_name));
+      continue;
+    }
     maps_.emplace(bpftrace_map_name(bpf_map__name(m)), m);
   }
 
@@ -201,6 +213,47 @@ static bool is_stack_size_error(std::string_view log)
   return util::wildcard_match(log, tokens, true, true);
 }
 
+// Probes which may fire at a high rate, where every instruction on the path
+// through the program adds to the overhead seen by the traced workload.
+static bool is_hot_probe(ProbeType type)
+{
+  switch (type) {
+    case ProbeType::kprobe:
+    case ProbeType::kretprobe:
+    case ProbeType::uprobe:
+    case ProbeType::uretprobe:
+    case ProbeType::usdt:
+    case ProbeType::tracepoint:
+    case ProbeType::rawtracepoint:
+    case ProbeType::fentry:
+    case ProbeType::fexit:
+    case ProbeType::watchpoint:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void BpfBytecode::check_insn_budget(const std::vector<Probe> &probes,
+                                    const Config &config) const
+{
+  if (config.probe_insn_budget == 0)
+    return;
+
+  for (const auto &probe : probes) {
+    if (!is_hot_probe(probe.type))
+      continue;
+    auto cost = getProgramForProbe(probe).estimate_cost();
+    if (cost.longest_path > config.probe_insn_budget) {
+      LOG(WARNING) << "Probe " << probe.name << " may execute up to "
+                   << cost.longest_path
+                   << " instructions per event, which exceeds the budget of "
+                   << config.probe_insn_budget
+                   << " (see the probe_insn_budget config variable)";
+    }
+  }
+}
+
 Result<> BpfBytecode::load_progs(const RequiredResources &resources,
                                  const BTF &btf,
                                  BPFfeature &feature,
@@ -221,6 +274,9 @@ Result<> BpfBytecode::load_progs(const RequiredResources &resources,
   prepare_progs(resources.probes, btf, feature, config);
   prepare_progs(resources.watchpoint_probes, btf, feature, config);
 
+  check_insn_budget(resources.probes, config);
+  check_insn_budget(resources.watchpoint_probes, config);
+
   int res = bpf_object__load(bpf_object_.get());
 
   // If requested, print the entire verifier logs, even if loading succeeded.
@@ -232,8 +288,39 @@ Result<> BpfBytecode::load_progs(const RequiredResources &resources,
     }
   }
 
-  if (res == 0)
+  if (res == 0) {
+    // Report the static cost of each program next to how much work the
+    // verifier did for it. Together these are the closest proxy we have to
+    // the runtime cost of the generated code, and are useful for comparing
+    // e.g. different `opt_level` settings. The estimate is taken after
+    // loading, once libbpf has appended the subprograms that are called.
+    if (bt_verbose) {
+      for (const auto &[name, prog] : programs_) {
+        auto cost = prog.estimate_cost();
+        std::stringstream msg;
+        msg << "Program " << name << ": " << cost.insns << " instructions, "
+            << cost.longest_path << " on the longest path, "
+            << cost.helper_calls << " helper calls, " << cost.map_ops
+            << " map operations, " << cost.subprog_calls
+            << " subprogram calls to " << cost.subprograms
+            << " subprograms, " << cost.stack_bytes << " stack bytes";
+
+        // Kernels before 5.16 don't report verified_insns, and return a
+        // shorter info.
+        struct bpf_prog_info info = {};
+        __u32 info_len = sizeof(info);
+        if (prog.fd() >= 0 &&
+            bpf_prog_get_info_by_fd(prog.fd(), &info, &info_len) == 0 &&
+            info_len >= offsetof(struct bpf_prog_info, verified_insns) +
+                            sizeof(info.verified_insns))
+          msg << ", " << info.verified_insns << " instructions verified";
+        else
+          msg << ", instructions verified unavailable";
+        LOG(V1) << msg.str();
+      }
+    }
     return OK();
+  }
 
   // If loading of bpf_object failed, we try to give user some hints of what
   // could've gone wrong.
@@ -401,4 +488,45 @@ void BpfBytecode::set_map_ids(RequiredResources &resources)
   }
 }
 
+uint64_t *BpfBytecode::rotation_flag(BPFtrace &bpftrace, const BpfMap &map)
+{
+  auto map_info = bpftrace.resources.maps_info.find(map.name());
+  if (map_info == bpftrace.resources.maps_info.end() ||
+      map_info->second.rotation_index == -1)
+    return nullptr;
+
+  // Probes only read the flags of the first CPU, see IRBuilderBPF::GetMapVar
+  auto *flags = bpftrace.resources.global_vars.get_global_var(
+      bpf_object_.get(),
+      globalvars::MAP_ROTATION_SECTION_NAME,
+      section_names_to_global_vars_map_);
+  return &flags[map_info->second.rotation_index];
+}
+
+const BpfMap &BpfBytecode::getLiveMap(BPFtrace &bpftrace, const BpfMap &map)
+{
+  auto *flag = rotation_flag(bpftrace, map);
+  if (!flag || !*flag)
+    return map;
+  return rotated_maps_.at(map.name());
+}
+
+const BpfMap &BpfBytecode::rotateMap(BPFtrace &bpftrace, const BpfMap &map)
+{
+  auto *flag = rotation_flag(bpftrace, map);
+  if (!flag)
+    return map;
+
+  const auto &live = getLiveMap(bpftrace, map);
+  *flag = !*flag;
+
+  // Probes which started before the flip may still update the old map. BPF
+  // programs run in RCU read-side critical sections, so waiting for a grace
+  // period lets them finish. Sleepable programs are not covered by this.
+  if (syscall(SYS_membarrier, MEMBARRIER_CMD_GLOBAL, 0, 0) < 0)
+    LOG(V1) << "Failed to wait for probes to switch to the rotated map of "
+            << map.name() << ": " << std::strerror(errno);
+  return live;
+}
+
 } // namespace bpftrace
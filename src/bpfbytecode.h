@@ -80,6 +80,13 @@ public:
   const BpfMap &getMap(int map_id) const;
   void set_map_ids(RequiredResources &resources);
 
+  // For a map passed to rotate(), the one of its two BPF maps which probes
+  // currently update. Any other map is returned as is.
+  const BpfMap &getLiveMap(BPFtrace &bpftrace, const BpfMap &map);
+  // Makes probes update the other BPF map of a rotated map and returns the
+  // one they updated so far, which is then no longer written to.
+  const BpfMap &rotateMap(BPFtrace &bpftrace, const BpfMap &map);
+
   const std::map<std::string, BpfMap> &maps() const;
   int countStackMaps() const;
 
@@ -88,8 +95,12 @@ private:
                      const BTF &btf,
                      BPFfeature &feature,
                      const Config &config);
+  void check_insn_budget(const std::vector<Probe> &probes,
+                         const Config &config) const;
 
   bool all_progs_loaded();
+  // The flag selecting the BPF map of a rotated map, nullptr for other maps
+  uint64_t *rotation_flag(BPFtrace &bpftrace, const BpfMap &map);
 
   // We need a custom deleter for bpf_object which will call bpf_object__close.
   // Note that it is not possible to run bpf_object__close in ~BpfBytecode
@@ -103,6 +114,8 @@ private:
   std::unique_ptr<struct bpf_object, bpf_object_deleter> bpf_object_;
 
   std::map<std::string, BpfMap> maps_;
+  // The second BPF maps of rotated maps, by the name of the rotated map
+  std::map<std::string, BpfMap> rotated_maps_;
   std::map<int, BpfMap *> maps_by_id_;
   std::map<std::string, BpfProgram> programs_;
   std::unordered_map<std::string, struct bpf_map *>
@@ -112,6 +112,56 @@ Result<> BpfMap::update_elem(const void *key, const void *value) const
   return OK();
 }
 
+int BpfMap::update_batch_once(const void *keys,
+                              const void *values,
+                              uint32_t *count) const
+{
+  DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts, .elem_flags = BPF_ANY);
+  return bpf_map_update_batch(fd(), keys, values, count, &opts);
+}
+
+Result<> BpfMap::update_batch(const void *keys,
+                              const void *values,
+                              uint32_t count) const
+{
+  // Kernels before 5.6 don't know the command (EINVAL) and some map types
+  // don't implement it (ENOTSUPP): update one element at a time then. The
+  // kernel fails these before writing back the count, so it can't be used to
+  // tell how far the batch got. Elements are written with BPF_ANY, so
+  // updating them again is harmless.
+  constexpr int ENOTSUPP_ERRNO = 524;
+  const auto *k = static_cast<const uint8_t *>(keys);
+  const auto *v = static_cast<const uint8_t *>(values);
+  uint32_t done = 0;
+  bool batched = true;
+  while (done < count) {
+    size_t key_offset = static_cast<size_t>(done) * key_size_;
+    size_t value_offset = static_cast<size_t>(done) * value_size_;
+    if (!batched) {
+      auto ok = update_elem(k + key_offset, v + value_offset);
+      if (!ok)
+        return ok;
+      done++;
+      continue;
+    }
+
+    uint32_t n = count - done;
+    int err = update_batch_once(k + key_offset, v + value_offset, &n);
+    if (err == 0) {
+      // Don't loop forever on a batch that writes nothing.
+      batched = n > 0;
+      done += n;
+      continue;
+    }
+    if (err == -EINVAL || err == -ENOTSUPP_ERRNO || err == -EOPNOTSUPP) {
+      batched = false;
+      continue;
+    }
+    return make_error<BpfMapError>(name_, "update batch", err);
+  }
+  return OK();
+}
+
 Result<> BpfMap::lookup_elem(const void *key, void *value) const
 {
   auto err = bpf_map_lookup_elem(fd(), key, value);
@@ -121,6 +171,15 @@ Result<> BpfMap::lookup_elem(const void *key, void *value) const
   return OK();
 }
 
+Result<> BpfMap::delete_elem(const void *key) const
+{
+  auto err = bpf_map_delete_elem(fd(), key);
+  if (err && err != -ENOENT) {
+    return make_error<BpfMapError>(name_, "delete", err);
+  }
+  return OK();
+}
+
 Result<> BpfMap::resize(uint32_t new_size) const
 {
   auto err = bpf_map__set_max_entries(bpf_map_, new_size);
@@ -219,6 +278,45 @@ Result<TSeriesMap> BpfMap::collect_tseries_data(const MapInfo &map_info,
   return values_by_key;
 }
 
+FusedBpfMap::FusedBpfMap(const BpfMap &fused_map,
+                         const std::string &name,
+                         const MapInfo &map_info)
+    : BpfMap(fused_map.type(),
+             bpf_map_name(name),
+             map_info.key_type.GetSize(),
+             *get_fused_value_size(map_info.value_type),
+             fused_map.max_entries()),
+      fused_map_(fused_map),
+      offset_(map_info.fused_offset),
+      size_(*get_fused_value_size(map_info.value_type))
+{
+}
+
+Result<MapElements> FusedBpfMap::collect_elements(int nvalues) const
+{
+  auto fused_elements = fused_map_.collect_elements(nvalues);
+  if (!fused_elements) {
+    return fused_elements.takeError();
+  }
+
+  // Each per-CPU value of the fused map holds the values of all its members,
+  // so pick out our own slice of every one of them.
+  MapElements values_by_key;
+  for (auto &[key, fused_value] : *fused_elements) {
+    auto ncpus = static_cast<size_t>(nvalues);
+    size_t stride = fused_value.size() / ncpus;
+    auto value = OpaqueValue::alloc(size_ * ncpus, [&](char *data) {
+      for (size_t i = 0; i < ncpus; i++) {
+        memcpy(data + (i * size_),
+               fused_value.data() + (i * stride) + offset_,
+               size_);
+      }
+    });
+    values_by_key.emplace_back(std::move(key), std::move(value));
+  }
+  return values_by_key;
+}
+
 std::string to_string(MapType t)
 {
   switch (t) {
@@ -230,8 +328,6 @@ std::string to_string(MapType t)
       return "ringbuf";
     case MapType::EventLossCounter:
       return "event_loss_counter";
-    case MapType::RecursionPrevention:
-      return "recursion_prevention";
   }
   return {}; // unreached
 }
@@ -245,6 +341,20 @@ bpf_map_type get_bpf_map_type(const SizedType &val_type)
   }
 }
 
+// Returns the size a value takes within a fused map, or nothing if maps with
+// this value type can't be fused.
+std::optional<size_t> get_fused_value_size(const SizedType &val_type)
+{
+  if (val_type.IsCountTy() || val_type.IsSumTy()) {
+    return sizeof(uint64_t);
+  } else if (val_type.IsMinTy() || val_type.IsMaxTy() || val_type.IsAvgTy() ||
+             val_type.IsStatsTy()) {
+    // { value, is_set } or { total, count }
+    return 2 * sizeof(uint64_t);
+  }
+  return std::nullopt;
+}
+
 std::optional<bpf_map_type> get_bpf_map_type(const std::string &name)
 {
   auto found = BPF_MAP_TYPES.find(name);
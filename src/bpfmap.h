@@ -38,10 +38,15 @@ using TSeriesMap = std::map<OpaqueValue, TSeries>;
 
 class BpfMap {
 public:
-  BpfMap(struct bpf_map *bpf_map)
+  BpfMap(struct bpf_map *bpf_map) : BpfMap(bpf_map, bpf_map__name(bpf_map))
+  {
+  }
+
+  // A BPF map known under another name, e.g. the second map of a rotated map
+  BpfMap(struct bpf_map *bpf_map, std::string bpf_name)
       : bpf_map_(bpf_map),
         type_(bpf_map__type(bpf_map)),
-        name_(bpf_map__name(bpf_map)),
+        name_(std::move(bpf_name)),
         key_size_(bpf_map__key_size(bpf_map)),
         value_size_(bpf_map__value_size(bpf_map)),
         max_entries_(bpf_map__max_entries(bpf_map))
@@ -81,10 +86,23 @@ public:
                                                   int nvalues) const;
   Result<> zero_out(int nvalues) const;
   Result<> clear() const;
-  Result<> update_elem(const void *key, const void *value) const;
+  virtual Result<> update_elem(const void *key, const void *value) const;
+  // Updates `count` elements at once. `keys` and `values` are packed arrays,
+  // so this is not for per-cpu maps.
+  Result<> update_batch(const void *keys,
+                        const void *values,
+                        uint32_t count) const;
   Result<> lookup_elem(const void *key, void *value) const;
+  Result<> delete_elem(const void *key) const;
   Result<> resize(uint32_t new_size) const;
 
+protected:
+  // A single bpf_map_update_batch() call. Returns 0 or a negative errno, and
+  // sets `count` to the number of elements written.
+  virtual int update_batch_once(const void *keys,
+                                const void *values,
+                                uint32_t *count) const;
+
 private:
   struct bpf_map *bpf_map_;
   bpf_map_type type_;
@@ -94,6 +112,22 @@ private:
   uint32_t max_entries_;
 };
 
+// A map whose values live in a slice of the values of another BPF map, as
+// laid out by the MapFusion pass. Only reading the elements is supported.
+class FusedBpfMap : public BpfMap {
+public:
+  FusedBpfMap(const BpfMap &fused_map,
+              const std::string &name,
+              const MapInfo &map_info);
+
+  Result<MapElements> collect_elements(int nvalues) const override;
+
+private:
+  const BpfMap &fused_map_;
+  size_t offset_;
+  size_t size_;
+};
+
 // Internal map types
 enum class MapType {
   // Also update to_string
@@ -101,7 +135,6 @@ enum class MapType {
   Elapsed,
   Ringbuf,
   EventLossCounter,
-  RecursionPrevention,
 };
 
 std::string to_string(MapType t);
@@ -124,7 +157,17 @@ inline std::string bpftrace_map_name(std::string_view bpf_map_name)
   return name;
 }
 
+// A map passed to rotate() has a second BPF map with this prefix. Probes update
+// whichever of the two userspace has selected, while the other is printed.
+constexpr std::string_view ROTATED_MAP_PREFIX = "rotated_";
+
+inline std::string rotated_map_name(std::string_view bpftrace_map_name)
+{
+  return std::string{ ROTATED_MAP_PREFIX } + bpf_map_name(bpftrace_map_name);
+}
+
 bpf_map_type get_bpf_map_type(const SizedType &val_type);
+std::optional<size_t> get_fused_value_size(const SizedType &val_type);
 std::optional<bpf_map_type> get_bpf_map_type(const std::string &name);
 std::string get_bpf_map_type_str(bpf_map_type map_type);
 void add_bpf_map_types_hint(std::stringstream &hint);
@@ -1,7 +1,12 @@
+#include <algorithm>
+#include <array>
 #include <bpf/bpf.h>
 #include <elf.h>
 #include <linux/bpf.h>
 #include <linux/btf.h>
+#include <optional>
+#include <set>
+#include <vector>
 
 #include "attached_probe.h"
 #include "bpfprogram.h"
@@ -20,6 +25,142 @@ int BpfProgram::fd() const
   return bpf_program__fd(bpf_prog_);
 }
 
+static bool is_map_helper(int32_t func_id)
+{
+  switch (func_id) {
+    case BPF_FUNC_map_lookup_elem:
+    case BPF_FUNC_map_update_elem:
+    case BPF_FUNC_map_delete_elem:
+    case BPF_FUNC_map_push_elem:
+    case BPF_FUNC_map_pop_elem:
+    case BPF_FUNC_map_peek_elem:
+    case BPF_FUNC_for_each_map_elem:
+    case BPF_FUNC_map_lookup_percpu_elem:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns the instruction called by a bpf-to-bpf call, if it is within the
+// program.
+static std::optional<size_t> call_target(size_t i,
+                                         const struct bpf_insn &insn,
+                                         size_t n)
+{
+  int64_t target = static_cast<int64_t>(i) + 1 + insn.imm;
+  if (target <= static_cast<int64_t>(i) || target >= static_cast<int64_t>(n))
+    return std::nullopt;
+  return static_cast<size_t>(target);
+}
+
+ProgramCost BpfProgram::estimate_cost() const
+{
+  const struct bpf_insn *insns = bpf_program__insns(bpf_prog_);
+  const size_t n = bpf_program__insn_cnt(bpf_prog_);
+
+  ProgramCost cost;
+  cost.insns = n;
+
+  // Stack usage is the lowest offset from the frame pointer that is accessed,
+  // either directly or through a register holding r10 plus a constant (which
+  // is how pointers to stack buffers are passed to helpers).
+  std::array<std::optional<int64_t>, MAX_BPF_REG> fp_offset;
+  int64_t min_offset = 0;
+  std::set<size_t> subprograms;
+
+  for (size_t i = 0; i < n; ++i) {
+    const auto &insn = insns[i];
+    const uint8_t cls = BPF_CLASS(insn.code);
+    if (cls == BPF_JMP && BPF_OP(insn.code) == BPF_CALL) {
+      if (insn.src_reg == 0) {
+        cost.helper_calls++;
+        if (is_map_helper(insn.imm))
+          cost.map_ops++;
+      } else if (insn.src_reg == BPF_PSEUDO_CALL) {
+        cost.subprog_calls++;
+        if (auto target = call_target(i, insn, n))
+          subprograms.insert(*target);
+      }
+      for (int reg = BPF_REG_0; reg <= BPF_REG_5; ++reg)
+        fp_offset[reg].reset();
+    } else if (cls == BPF_LDX && insn.src_reg == BPF_REG_10) {
+      min_offset = std::min<int64_t>(min_offset, insn.off);
+    } else if ((cls == BPF_STX || cls == BPF_ST) &&
+               insn.dst_reg == BPF_REG_10) {
+      min_offset = std::min<int64_t>(min_offset, insn.off);
+    }
+
+    if (cls == BPF_ALU64 && insn.dst_reg < MAX_BPF_REG) {
+      auto &dst = fp_offset[insn.dst_reg];
+      if (BPF_OP(insn.code) == BPF_MOV && BPF_SRC(insn.code) == BPF_X &&
+          insn.src_reg == BPF_REG_10) {
+        dst = 0;
+      } else if (BPF_OP(insn.code) == BPF_ADD && BPF_SRC(insn.code) == BPF_K &&
+                 dst) {
+        *dst += insn.imm;
+        min_offset = std::min(min_offset, *dst);
+      } else {
+        dst.reset();
+      }
+    } else if ((cls == BPF_ALU || cls == BPF_LDX || cls == BPF_LD) &&
+               insn.dst_reg < MAX_BPF_REG) {
+      fp_offset[insn.dst_reg].reset();
+    }
+
+    // The second slot of a 64-bit immediate load only holds the upper half
+    // of the immediate; it is not an instruction of its own.
+    if (insn.code == (BPF_LD | BPF_IMM | BPF_DW))
+      ++i;
+  }
+  cost.stack_bytes = static_cast<size_t>(-min_offset);
+  cost.subprograms = subprograms.size();
+
+  // Longest path, walking the program backwards. Jumps backwards are loops;
+  // their bodies are counted once by ignoring the back edge.
+  std::vector<size_t> path(n + 1, 0);
+  for (size_t i = n; i-- > 0;) {
+    const auto &insn = insns[i];
+    const uint8_t cls = BPF_CLASS(insn.code);
+    // 64-bit immediate loads occupy two instruction slots.
+    const size_t next = (insn.code == (BPF_LD | BPF_IMM | BPF_DW)) ? i + 2
+                                                                    : i + 1;
+    auto successor = [&](int64_t target) -> size_t {
+      if (target <= static_cast<int64_t>(i) || target > static_cast<int64_t>(n))
+        return 0;
+      return path[target];
+    };
+
+    size_t longest = 0;
+    if (cls == BPF_JMP || cls == BPF_JMP32) {
+      const uint8_t op = BPF_OP(insn.code);
+      if (op == BPF_EXIT) {
+        longest = 0;
+      } else if (op == BPF_CALL) {
+        // Subprograms are appended after the code calling them, so their
+        // own longest path is already known here.
+        auto target = insn.src_reg == BPF_PSEUDO_CALL
+                          ? call_target(i, insn, n)
+                          : std::nullopt;
+        longest = successor(next) + (target ? successor(*target) : 0);
+      } else if (op == BPF_JA) {
+        int64_t off = cls == BPF_JMP32 ? insn.imm : insn.off;
+        longest = successor(static_cast<int64_t>(next) + off);
+      } else {
+        longest = std::max(
+            successor(next),
+            successor(static_cast<int64_t>(next) + insn.off));
+      }
+    } else {
+      longest = successor(next);
+    }
+    path[i] = longest + 1;
+  }
+  cost.longest_path = n > 0 ? path[0] : 0;
+
+  return cost;
+}
+
 void BpfProgram::set_prog_type(const Probe &probe)
 {
   auto prog_type = progtype(probe.type);
@@ -13,6 +13,23 @@ namespace bpftrace {
 class BpfBytecode;
 class BPFtrace;
 
+// Static estimate of the runtime cost of a BPF program, computed from its
+// instructions without loading it.
+struct ProgramCost {
+  size_t insns = 0;
+  // Number of instructions on the longest path through the program. Loop
+  // bodies are counted once.
+  size_t longest_path = 0;
+  size_t helper_calls = 0;
+  size_t map_ops = 0;
+  size_t stack_bytes = 0;
+  // Calls to BPF subprograms, and the number of distinct subprograms called.
+  // Subprograms are only appended to the program by libbpf when loading it,
+  // so before that they are not counted and neither is their cost.
+  size_t subprog_calls = 0;
+  size_t subprograms = 0;
+};
+
 // This class abstracts a single BPF program by encapsulating libbpf's
 // 'struct bpf_prog'.
 class BpfProgram {
@@ -29,6 +46,7 @@ public:
 
   int fd() const;
   struct bpf_program *bpf_prog() const;
+  ProgramCost estimate_cost() const;
 
   BpfProgram(const BpfProgram &) = delete;
   BpfProgram &operator=(const BpfProgram &) = delete;
@@ -1,5 +1,6 @@
 #include "bpfbytecode.h"
 #include "types_format.h"
+#include <algorithm>
 #include <arpa/inet.h>
 #include <bpf/bpf.h>
 #include <bpf/libbpf.h>
@@ -41,7 +42,6 @@
 #include "bpftrace.h"
 #include "btf.h"
 #include "dwarf/dwunwind.h"
-#include "dwarf/dwunwind_loader.h"
 #include "log.h"
 #include "output/capture.h"
 #include "output/discard.h"
@@ -50,6 +50,7 @@
 #include "symbols/kernel.h"
 #include "util/bpf_names.h"
 #include "util/cgroup.h"
+#include "util/hash.h"
 #include "util/paths.h"
 #include "util/strings.h"
 #include "util/system.h"
@@ -118,6 +119,44 @@ BPFtrace::~BPFtrace()
   close_pcaps();
 }
 
+// Returns the pid that the leading predicates of a probe restrict it to, i.e.
+// if one of them is `pid == N`.
+static std::optional<int> predicate_pid(ast::BlockExpr *block)
+{
+  auto is_pid = [](const ast::Expression &expr) {
+    if (auto *builtin = expr.as<ast::Builtin>())
+      return builtin->ident == "pid";
+    if (auto *call = expr.as<ast::Call>())
+      return call->func == "pid" && call->vargs.empty();
+    return false;
+  };
+  // Literals are cast to the type of pid, which keeps their value.
+  auto as_integer = [](ast::Expression expr) {
+    while (auto *cast = expr.as<ast::Cast>())
+      expr = cast->expr;
+    return expr.as<ast::Integer>();
+  };
+
+  while (block->stmts.empty()) {
+    auto *filter = block->expr.as<ast::IfExpr>();
+    auto *body = filter ? filter->left.as<ast::BlockExpr>() : nullptr;
+    if (!body || !filter->right.is<ast::None>())
+      break;
+
+    auto *cond = filter->cond.as<ast::Binop>();
+    if (cond && cond->op == ast::Operator::EQ) {
+      auto *value = is_pid(cond->left)    ? as_integer(cond->right)
+                    : is_pid(cond->right) ? as_integer(cond->left)
+                                          : nullptr;
+      if (value && value->value > 0 &&
+          value->value <= std::numeric_limits<int>::max())
+        return static_cast<int>(value->value);
+    }
+    block = body;
+  }
+  return std::nullopt;
+}
+
 Probe BPFtrace::generate_probe(const ast::AttachPoint &ap,
                                const ast::Probe &p,
                                ast::ExpansionType expansion,
@@ -141,6 +180,13 @@ Probe BPFtrace::generate_probe(const ast::AttachPoint &ap,
   probe.is_session = expansion == ast::ExpansionType::SESSION;
   probe.funcs = std::move(expanded_funcs);
   probe.bpf_prog_id = ap.bpf_prog_id;
+  // These can filter by pid when attaching, so that the probe doesn't even
+  // fire for other processes. The predicate is still checked in the program.
+  // USDT probes are left out: with a pid, libbpf resolves the binary through
+  // the process' mappings, so a library it hasn't mapped yet couldn't be
+  // attached to at all.
+  if (probe.type == ProbeType::uprobe || probe.type == ProbeType::uretprobe)
+    probe.filter_pid = predicate_pid(p.block).value_or(0);
   return probe;
 }
 
@@ -239,6 +285,8 @@ static Result<> event_printer(void *cb_cookie, void *raw_data, int size)
     return ctx->handlers.clear_map(data);
   } else if (printf_id == async_action::AsyncAction::zero) {
     return ctx->handlers.zero_map(data);
+  } else if (printf_id == async_action::AsyncAction::rotate) {
+    return ctx->handlers.rotate_map(data);
   } else if (printf_id == async_action::AsyncAction::time) {
     return ctx->handlers.time(data);
   } else if (printf_id == async_action::AsyncAction::join) {
@@ -314,6 +362,18 @@ Result<std::unique_ptr<AttachedProbe>> BPFtrace::attach_probe(
   std::optional<pid_t> pid = child_ ? std::make_optional(child_->pid())
                                     : this->pid();
 
+  if (!pid && probe.filter_pid) {
+    auto ap = AttachedProbe::make(probe, program, probe.filter_pid, safe_mode_);
+    if (ap)
+      return std::move(*ap);
+    // Attaching to a process which doesn't exist (anymore) fails, while the
+    // predicate would just never match. Attach for all processes instead.
+    auto ok = handleErrors(std::move(ap), [&](const AttachError &err) {
+      LOG(V1) << "Attaching " << probe.name << " to pid " << probe.filter_pid
+              << " failed, attaching to all processes: " << err.msg();
+    });
+  }
+
   auto ap = AttachedProbe::make(probe, program, pid, safe_mode_);
   if (!ap) {
     auto missing_probes = config_->missing_probes;
@@ -430,10 +490,6 @@ int BPFtrace::run(output::Output &out,
                   const ast::CDefinitions &c_definitions,
                   BpfBytecode bytecode)
 {
-  // temporary storage for DWARF unwind data, between parse and feed
-  std::map<TableType, std::vector<std::vector<uint8_t>>> unwind_data;
-  std::map<uint32_t, std::vector<uint8_t>> unwind_mappings;
-
   bytecode_ = std::move(bytecode);
   bytecode_.set_map_ids(resources);
 
@@ -472,15 +528,22 @@ int BPFtrace::run(output::Output &out,
 
   // map DWUNWIND_MAPPINGS is only present if dw_unwind() is used.
   bool needs_dwarf_unwind = bytecode_.hasMap(DWUNWIND_MAPPINGS);
+  // Without a target process, tables are built on demand for every process
+  // the unwinder runs into.
+  bool dwarf_on_demand = false;
   if (needs_dwarf_unwind) {
     if (procmon_)
       dwarf_pids_.emplace_back(procmon_->pid());
     if (child_)
       dwarf_pids_.emplace_back(child_->pid());
     if (dwarf_pids_.empty()) {
-      LOG(ERROR) << "dw_ustack requires a target process. "
-                    "Use -p, -c, or --dwarf-pid to specify one.";
-      return -1;
+      if (config_->dw_ustack_max_pids == 0) {
+        LOG(ERROR) << "dw_ustack requires a target process. "
+                      "Use -p, -c, or --dwarf-pid to specify one, or set "
+                      "dw_ustack_max_pids to unwind system-wide.";
+        return -1;
+      }
+      dwarf_on_demand = true;
     }
   }
 
@@ -512,8 +575,19 @@ int BPFtrace::run(output::Output &out,
     }
   }
 
-  if (needs_dwarf_unwind)
-    parse_dwarf_unwind(bytecode_, dwarf_pids_, unwind_data, unwind_mappings);
+  if (needs_dwarf_unwind) {
+    // The tables of the target processes are built before loading, as the
+    // maps are sized for them.
+    dwarf_worker_ = std::make_unique<DWARFUnwindWorker>(
+        bytecode_,
+        DWARFUnwindCapacity(dwarf_on_demand ? config_->dw_ustack_max_pids : 0,
+                            config_->dw_ustack_max_tables),
+        config_->dw_ustack_cache_dir);
+    dwarf_worker_->add_pids(dwarf_pids_);
+    int ret = dwarf_worker_->resize_maps();
+    if (ret)
+      return ret;
+  }
 
   auto ok = bytecode_.load_progs(resources, *btf_, *feature_, *config_);
   if (!ok) {
@@ -547,12 +621,6 @@ int BPFtrace::run(output::Output &out,
     return -1;
   }
 
-  if (needs_dwarf_unwind) {
-    int ret = feed_dwarf_unwind(bytecode_, unwind_data, unwind_mappings);
-    if (ret)
-      return ret;
-  }
-
   async_action::AsyncHandlers handlers(*this, c_definitions, out);
   PerfEventContext ctx(*this, handlers, out);
   err = setup_output(&ctx);
@@ -560,9 +628,16 @@ int BPFtrace::run(output::Output &out,
     return err;
   SCOPE_EXIT
   {
+    dwarf_worker_.reset();
     teardown_output();
   };
 
+  if (dwarf_worker_) {
+    err = dwarf_worker_->start(ringbuf_, dwarf_on_demand);
+    if (err)
+      return err;
+  }
+
   err = create_pcaps();
   if (err) {
     LOG(ERROR) << "Failed to create pcap file(s)";
@@ -848,6 +923,9 @@ int BPFtrace::run(output::Output &out,
                  << strerror(-err);
 #endif
 
+  if (config_->probe_stats_interval > 0 && num_attached > 0)
+    enable_probe_stats();
+
   if (has_iter_) {
     int err = run_iter();
     if (err)
@@ -859,6 +937,10 @@ int BPFtrace::run(output::Output &out,
     poll_output(out, should_drain);
   }
 
+  poll_probe_stats(out, /* force */ true);
+  probe_stats_last_.reset();
+  bpf_stats_fd_.reset();
+
 #ifdef HAVE_LIBSYSTEMD
   err = sd_notify(false, "STOPPING=1\nSTATUS=Shutting down...");
   if (err < 0)
@@ -898,15 +980,28 @@ int BPFtrace::run(output::Output &out,
   // Print maps if needed (true by default).
   if (!err && !run_tests_ && !run_benchmarks_ && !dry_run &&
       config_->print_maps_on_exit) {
-    for (const auto &[_, map] : bytecode_.maps()) {
-      if (!map.is_printable())
+    // Maps stored in a fused map have no BPF map of their own, so they are
+    // read from their slice of it instead.
+    std::vector<FusedBpfMap> fused_maps;
+    for (const auto &[name, info] : resources.maps_info) {
+      if (!info.fused_map.empty())
+        fused_maps.emplace_back(bytecode_.getMap(info.fused_map), name, info);
+    }
+    std::map<std::string, const BpfMap *> maps;
+    for (const auto &[name, map] : bytecode_.maps())
+      maps.emplace(name, &bytecode_.getLiveMap(*this, map));
+    for (const auto &map : fused_maps)
+      maps.emplace(map.name(), &map);
+
+    for (const auto &[_, map] : maps) {
+      if (!map->is_printable())
         continue;
-      auto res = format(*this, c_definitions, map);
+      auto res = format(*this, c_definitions, *map);
       if (!res) {
         std::cerr << "Error printing map: " << res.takeError();
         continue;
       }
-      out.map(map.name(), *res);
+      out.map(map->name(), *res);
     }
   }
 
@@ -997,6 +1092,7 @@ void BPFtrace::poll_output(output::Output &out, bool drain)
 
     // Handle lost events, if any
     poll_event_loss(out);
+    poll_probe_stats(out);
 
     if (do_poll_ringbuf) {
       ready = ring_buffer__poll(ringbuf_, timeout_ms);
@@ -1045,6 +1141,92 @@ void BPFtrace::poll_event_loss(output::Output &out)
   }
 }
 
+void BPFtrace::enable_probe_stats()
+{
+  // Run time statistics are collected by the kernel for as long as this fd is
+  // held open. If it fails, they may still be enabled system-wide through the
+  // kernel.bpf_stats_enabled sysctl, so we carry on and report what we get.
+  int fd = bpf_enable_stats(BPF_STATS_RUN_TIME);
+  if (fd < 0) {
+    LOG(WARNING) << "Failed to enable BPF run time statistics: "
+                 << strerror(-fd)
+                 << ". Probe stats will only be available if "
+                    "kernel.bpf_stats_enabled is set.";
+  } else {
+    bpf_stats_fd_.emplace(fd);
+  }
+
+  // Take a baseline, so that the first report does not include runs that
+  // happened before stats collection was enabled.
+  probe_stats_last_ = std::chrono::steady_clock::now();
+  output::DiscardOutput discard;
+  poll_probe_stats(discard, /* force */ true);
+}
+
+void BPFtrace::poll_probe_stats(output::Output &out, bool force)
+{
+  if (!probe_stats_last_)
+    return;
+
+  auto now = std::chrono::steady_clock::now();
+  auto period = now - *probe_stats_last_;
+  if (!force && period < std::chrono::seconds(config_->probe_stats_interval))
+    return;
+  probe_stats_last_ = now;
+
+  // Several probes can share a program (e.g. the entry and exit of a session
+  // probe), and the kernel counts its runs only once. Each program is
+  // reported once, under the names of all the probes using it.
+  std::vector<output::ProbeStats> stats;
+  std::unordered_map<__u32, size_t> reported;
+  std::set<std::pair<__u32, std::string>> named;
+  auto collect = [&](const std::vector<Probe> &probes) {
+    for (const auto &probe : probes) {
+      const auto &prog = bytecode_.getProgramForProbe(probe);
+      struct bpf_prog_info info = {};
+      __u32 info_len = sizeof(info);
+      if (prog.fd() < 0 ||
+          bpf_prog_get_info_by_fd(prog.fd(), &info, &info_len) != 0)
+        continue;
+
+      bool new_name = named.emplace(info.id, probe.name).second;
+      auto [it, inserted] = reported.try_emplace(info.id, stats.size());
+      if (!inserted) {
+        if (new_name)
+          stats[it->second].probe += ", " + probe.name;
+        continue;
+      }
+
+      auto &last = probe_run_stats_[info.id];
+      stats.push_back(output::ProbeStats{
+          .probe = probe.name,
+          .events = info.run_cnt - last.run_cnt,
+          .run_time = std::chrono::nanoseconds(info.run_time_ns -
+                                               last.run_time_ns),
+          .period = std::chrono::duration_cast<std::chrono::nanoseconds>(
+              period),
+      });
+      last.run_cnt = info.run_cnt;
+      last.run_time_ns = info.run_time_ns;
+    }
+  };
+  collect(resources.probes);
+  collect(resources.watchpoint_probes);
+
+  if (!stats.empty())
+    out.probe_stats(stats);
+
+  auto usym_stats = usyms_.stats();
+  if (usym_stats.hits + usym_stats.misses > 0) {
+    out.symbol_cache_stats(output::SymbolCacheStats{
+        .hits = usym_stats.hits,
+        .misses = usym_stats.misses,
+        .evictions = usym_stats.evictions,
+        .entries = usym_stats.entries,
+    });
+  }
+}
+
 std::optional<std::string> BPFtrace::get_watchpoint_binary_path() const
 {
   if (child_) {
@@ -1060,6 +1242,23 @@ std::optional<std::string> BPFtrace::get_watchpoint_binary_path() const
   }
 }
 
+std::string BPFtrace::stack_key(uint64_t nr_stack_frames,
+                                const OpaqueValue &raw_stack,
+                                int32_t pid,
+                                int32_t probe_id,
+                                bool ustack,
+                                const StackType &stack_type,
+                                int indent)
+{
+  size_t len = std::min<size_t>(raw_stack.size(),
+                                nr_stack_frames * stack_type.elem_size());
+  std::ostringstream key;
+  key << stack_type.name() << ":" << ustack << ":" << pid << ":" << probe_id
+      << ":" << indent << ":" << nr_stack_frames << ":";
+  key.write(raw_stack.data(), static_cast<std::streamsize>(len));
+  return key.str();
+}
+
 std::string BPFtrace::get_stack(uint64_t nr_stack_frames,
                                 const OpaqueValue &raw_stack,
                                 int32_t pid,
@@ -1067,6 +1266,140 @@ std::string BPFtrace::get_stack(uint64_t nr_stack_frames,
                                 bool ustack,
                                 StackType stack_type,
                                 int indent)
+{
+  if (!prefetched_stacks_.empty()) {
+    auto it = prefetched_stacks_.find(stack_key(
+        nr_stack_frames, raw_stack, pid, probe_id, ustack, stack_type, indent));
+    if (it != prefetched_stacks_.end())
+      return it->second.get();
+  }
+  return symbolize_stack(
+      nr_stack_frames, raw_stack, pid, probe_id, ustack, stack_type, indent);
+}
+
+void BPFtrace::prefetch_stack(uint64_t nr_stack_frames,
+                              const OpaqueValue &raw_stack,
+                              int32_t pid,
+                              int32_t probe_id,
+                              bool ustack,
+                              StackType stack_type,
+                              int indent)
+{
+  if (stack_type.mode == StackMode::raw ||
+      stack_type.mode == StackMode::build_id)
+    return;
+
+  auto key = stack_key(
+      nr_stack_frames, raw_stack, pid, probe_id, ustack, stack_type, indent);
+  if (prefetched_stacks_.contains(key))
+    return;
+
+  // Take a copy, as the frames may point into memory that is reused.
+  auto result = submit_stack(
+      nr_stack_frames,
+      OpaqueValue::from(raw_stack.data(), raw_stack.size()),
+      pid,
+      probe_id,
+      ustack,
+      stack_type,
+      indent);
+  prefetched_stacks_.emplace(std::move(key), std::move(result));
+}
+
+std::shared_future<std::string> BPFtrace::submit_stack(
+    uint64_t nr_stack_frames,
+    OpaqueValue frames,
+    int32_t pid,
+    int32_t probe_id,
+    bool ustack,
+    StackType stack_type,
+    int indent)
+{
+  return symbolizer()
+      .submit([=, this, frames = std::move(frames)] {
+        return symbolize_stack(
+            nr_stack_frames, frames, pid, probe_id, ustack, stack_type, indent);
+      })
+      .share();
+}
+
+SymbolizationWorker &BPFtrace::symbolizer()
+{
+  // Resolving a frame takes the Ksyms or Usyms lock, so more than a couple of
+  // threads would mostly wait on each other.
+  if (!symbolizer_)
+    symbolizer_ = std::make_unique<SymbolizationWorker>(
+        std::clamp(std::thread::hardware_concurrency(), 1U, 2U));
+  return *symbolizer_;
+}
+
+void BPFtrace::prefetch_interned_stack(uint64_t nr_stack_frames,
+                                       uint64_t stack_id,
+                                       int32_t pid,
+                                       int32_t probe_id,
+                                       StackType stack_type)
+{
+  InternedStack key = { .table = stack_type.table_name(),
+                        .id = stack_id,
+                        .pid = pid,
+                        .probe_id = probe_id };
+  if (stack_type.mode == StackMode::raw ||
+      stack_type.mode == StackMode::build_id ||
+      (interned_stacks_ && interned_stacks_->find(key)) ||
+      prefetched_interned_stacks_.contains(key))
+    return;
+
+  auto frames = get_stack_frames(stack_type, stack_id);
+  if (!frames)
+    return;
+  auto result = submit_stack(nr_stack_frames,
+                             std::move(*frames),
+                             pid,
+                             probe_id,
+                             !stack_type.kernel,
+                             stack_type,
+                             8);
+  prefetched_interned_stacks_.emplace(std::move(key), std::move(result));
+}
+
+void BPFtrace::prefetch_ksym(uint64_t addr)
+{
+  SymbolAddr key = { .addr = addr, .pid = -1, .probe_id = -1 };
+  if (prefetched_ksyms_.contains(key))
+    return;
+  auto result = symbolizer().submit([this, addr] {
+    return resolve_ksym_stack(addr, false, false, false).front();
+  });
+  prefetched_ksyms_.emplace(key, result.share());
+}
+
+void BPFtrace::prefetch_usym(uint64_t addr, int32_t pid, int32_t probe_id)
+{
+  SymbolAddr key = { .addr = addr, .pid = pid, .probe_id = probe_id };
+  if (prefetched_usyms_.contains(key))
+    return;
+  auto result = symbolizer().submit([this, addr, pid, probe_id] {
+    return resolve_usym_stack(addr, pid, probe_id, false, false, false)
+        .front();
+  });
+  prefetched_usyms_.emplace(key, result.share());
+}
+
+void BPFtrace::clear_prefetched_symbols()
+{
+  prefetched_stacks_.clear();
+  prefetched_interned_stacks_.clear();
+  prefetched_ksyms_.clear();
+  prefetched_usyms_.clear();
+}
+
+std::string BPFtrace::symbolize_stack(uint64_t nr_stack_frames,
+                                      const OpaqueValue &raw_stack,
+                                      int32_t pid,
+                                      int32_t probe_id,
+                                      bool ustack,
+                                      StackType stack_type,
+                                      int indent)
 {
   std::ostringstream stack;
   std::string padding(indent, ' ');
@@ -1118,6 +1451,83 @@ std::string BPFtrace::get_stack(uint64_t nr_stack_frames,
   return stack.str();
 }
 
+size_t BPFtrace::InternedStackHash::operator()(
+    const InternedStack &stack) const
+{
+  size_t seed = 0;
+  util::hash_combine(seed, stack.table);
+  util::hash_combine(seed, stack.id);
+  util::hash_combine(seed, stack.pid);
+  util::hash_combine(seed, stack.probe_id);
+  return seed;
+}
+
+std::string BPFtrace::get_interned_stack(uint64_t nr_stack_frames,
+                                         uint64_t stack_id,
+                                         int32_t pid,
+                                         int32_t probe_id,
+                                         StackType stack_type)
+{
+  if (!interned_stacks_)
+    interned_stacks_ = std::make_unique<
+        util::LRUCache<InternedStack, std::string, InternedStackHash>>(
+        config_->max_map_keys);
+
+  InternedStack key = { .table = stack_type.table_name(),
+                        .id = stack_id,
+                        .pid = pid,
+                        .probe_id = probe_id };
+  if (const auto *cached = interned_stacks_->find(key))
+    return *cached;
+
+  auto prefetched = prefetched_interned_stacks_.find(key);
+  if (prefetched != prefetched_interned_stacks_.end()) {
+    auto stack = prefetched->second.get();
+    interned_stacks_->insert(key, stack);
+    return stack;
+  }
+
+  // Evicted stacks are not cached: they are inserted again if the stack is
+  // seen again.
+  auto frames = get_stack_frames(stack_type, stack_id);
+  if (!frames)
+    return "\n        <stack evicted>\n";
+
+  std::string stack;
+  if (stack_type.mode == StackMode::build_id)
+    stack = format_build_id_stack(nr_stack_frames, *frames);
+  else
+    stack = get_stack(nr_stack_frames,
+                      *frames,
+                      pid,
+                      probe_id,
+                      !stack_type.kernel,
+                      stack_type,
+                      8);
+  interned_stacks_->insert(key, stack);
+  return stack;
+}
+
+std::optional<OpaqueValue> BPFtrace::get_stack_frames(
+    const StackType &stack_type,
+    uint64_t stack_id) const
+{
+  if (!bytecode_.hasMap(stack_type.table_name()))
+    return std::nullopt;
+  const auto &map = bytecode_.getMap(stack_type.table_name());
+  bool found = false;
+  auto frames = OpaqueValue::alloc(stack_type.limit * stack_type.elem_size(),
+                                   [&](char *data) {
+                                     auto ok = map.lookup_elem(&stack_id, data);
+                                     found = bool(ok);
+                                     if (!ok)
+                                       consumeError(ok.takeError());
+                                   });
+  if (!found)
+    return std::nullopt;
+  return frames;
+}
+
 std::string BPFtrace::resolve_uid(uint64_t addr) const
 {
   std::string file_name = "/etc/passwd";
@@ -1244,6 +1654,12 @@ std::string BPFtrace::format_timestamp(
 
 std::string BPFtrace::resolve_ksym(uint64_t addr)
 {
+  if (!prefetched_ksyms_.empty()) {
+    auto it = prefetched_ksyms_.find(
+        { .addr = addr, .pid = -1, .probe_id = -1 });
+    if (it != prefetched_ksyms_.end())
+      return it->second.get();
+  }
   auto syms = resolve_ksym_stack(addr, false, false, false);
   assert(syms.size() == 1);
   return syms.front();
@@ -1259,29 +1675,7 @@ std::vector<std::string> BPFtrace::resolve_ksym_stack(uint64_t addr,
 
 uint64_t BPFtrace::resolve_kname(const std::string &name) const
 {
-  uint64_t addr = 0;
-  std::string file_name = "/proc/kallsyms";
-
-  std::ifstream file(file_name);
-  if (file.fail()) {
-    LOG(ERROR) << strerror(errno) << ": " << file_name;
-    return addr;
-  }
-
-  std::string line;
-
-  while (std::getline(file, line) && addr == 0) {
-    auto tokens = util::split_string(line, ' ');
-
-    if (name == tokens[2]) {
-      addr = read_address_from_output(line);
-      break;
-    }
-  }
-
-  file.close();
-
-  return addr;
+  return ksyms_.resolve_name(name);
 }
 
 Result<Symbol> BPFtrace::resolve_uname(const std::string &name,
@@ -1328,12 +1722,6 @@ std::string BPFtrace::resolve_cgroup_path(uint64_t cgroup_path_id,
   return result.str().substr(0, result.str().size() - 1);
 }
 
-uint64_t BPFtrace::read_address_from_output(std::string output)
-{
-  std::string first_word = output.substr(0, output.find(" "));
-  return std::stoull(first_word, nullptr, 16);
-}
-
 static std::string resolve_inetv4(const char *inet)
 {
   char addr_cstr[INET_ADDRSTRLEN];
@@ -1366,6 +1754,12 @@ std::string BPFtrace::resolve_inet(int af, const char *inet) const
 
 std::string BPFtrace::resolve_usym(uint64_t addr, int32_t pid, int32_t probe_id)
 {
+  if (!prefetched_usyms_.empty()) {
+    auto it = prefetched_usyms_.find(
+        { .addr = addr, .pid = pid, .probe_id = probe_id });
+    if (it != prefetched_usyms_.end())
+      return it->second.get();
+  }
   auto syms = resolve_usym_stack(addr, pid, probe_id, false, false, false);
   assert(syms.size() == 1);
   return syms.front();
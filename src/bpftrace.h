@@ -1,7 +1,9 @@
 #pragma once
 
 #include <bcc/bcc_syms.h>
+#include <chrono>
 #include <cstdint>
+#include <future>
 #include <limits>
 #include <map>
 #include <memory>
@@ -23,6 +25,7 @@
 #include "bpfprogram.h"
 #include "btf.h"
 #include "config.h"
+#include "dwarf/dwunwind_worker.h"
 #include "dwarf_parser.h"
 #include "functions.h"
 #include "ksyms.h"
@@ -31,10 +34,13 @@
 #include "probe_matcher.h"
 #include "required_resources.h"
 #include "struct.h"
+#include "symbolization_worker.h"
 #include "symbols/kernel.h"
 #include "types.h"
 #include "usyms.h"
 #include "util/cpus.h"
+#include "util/fd.h"
+#include "util/lru_cache.h"
 #include "util/proc.h"
 #include "util/result.h"
 
@@ -130,6 +136,34 @@ public:
                         bool ustack,
                         StackType stack_type,
                         int indent = 0);
+  // Symbolizes an interned stack (see intern_stacks). Interned stacks are
+  // symbolized once and then served from a cache, so that printing the same
+  // stacks again on every interval stays cheap.
+  std::string get_interned_stack(uint64_t nr_stack_frames,
+                                 uint64_t stack_id,
+                                 int32_t pid,
+                                 int32_t probe_id,
+                                 StackType stack_type);
+  // Starts symbolizing a stack in the background. A later get_stack() or
+  // get_interned_stack() call for the same stack waits for the result rather
+  // than symbolizing it again, until clear_prefetched_symbols() is called.
+  void prefetch_stack(uint64_t nr_stack_frames,
+                      const OpaqueValue &raw_stack,
+                      int32_t pid,
+                      int32_t probe_id,
+                      bool ustack,
+                      StackType stack_type,
+                      int indent = 0);
+  void prefetch_interned_stack(uint64_t nr_stack_frames,
+                               uint64_t stack_id,
+                               int32_t pid,
+                               int32_t probe_id,
+                               StackType stack_type);
+  // Same for single ksym and usym values, see resolve_ksym() and
+  // resolve_usym().
+  void prefetch_ksym(uint64_t addr);
+  void prefetch_usym(uint64_t addr, int32_t pid, int32_t probe_id);
+  void clear_prefetched_symbols();
   std::string resolve_ksym(uint64_t addr);
   std::string resolve_usym(uint64_t addr, int32_t pid, int32_t probe_id);
   std::string resolve_inet(int af, const char *inet) const;
@@ -213,6 +247,8 @@ public:
   std::unique_ptr<util::ChildProc> child_;
   std::unique_ptr<util::Proc> procmon_;
   std::vector<pid_t> dwarf_pids_;
+  // Builds the unwind tables for dw_ustack and keeps them up to date.
+  std::unique_ptr<DWARFUnwindWorker> dwarf_worker_;
   std::optional<pid_t> pid() const
   {
     if (procmon_) {
@@ -229,9 +265,32 @@ public:
   std::string debuginfo_path_;
 
 private:
+  struct InternedStack {
+    std::string table;
+    uint64_t id;
+    int32_t pid;
+    int32_t probe_id;
+
+    bool operator==(const InternedStack &other) const = default;
+  };
+  struct InternedStackHash {
+    size_t operator()(const InternedStack &stack) const;
+  };
+  // A ksym (pid and probe_id are -1) or usym value.
+  struct SymbolAddr {
+    uint64_t addr;
+    int32_t pid;
+    int32_t probe_id;
+
+    auto operator<=>(const SymbolAddr &other) const = default;
+  };
+
   Ksyms ksyms_;
   Usyms usyms_;
   std::vector<std::string> params_;
+  // Sized by max_map_keys on first use, like the stack tables
+  std::unique_ptr<util::LRUCache<InternedStack, std::string, InternedStackHash>>
+      interned_stacks_;
 
   std::map<std::string, std::unique_ptr<PCAPwriter>> pcap_writers_;
 
@@ -240,6 +299,30 @@ private:
   int setup_output(void *ctx);
   int setup_skboutput_perf_buffer(void *ctx);
   void setup_ringbuf(void *ctx);
+  std::optional<OpaqueValue> get_stack_frames(const StackType &stack_type,
+                                              uint64_t stack_id) const;
+  std::string symbolize_stack(uint64_t nr_stack_frames,
+                              const OpaqueValue &raw_stack,
+                              int32_t pid,
+                              int32_t probe_id,
+                              bool ustack,
+                              StackType stack_type,
+                              int indent);
+  SymbolizationWorker &symbolizer();
+  std::shared_future<std::string> submit_stack(uint64_t nr_stack_frames,
+                                               OpaqueValue frames,
+                                               int32_t pid,
+                                               int32_t probe_id,
+                                               bool ustack,
+                                               StackType stack_type,
+                                               int indent);
+  static std::string stack_key(uint64_t nr_stack_frames,
+                               const OpaqueValue &raw_stack,
+                               int32_t pid,
+                               int32_t probe_id,
+                               bool ustack,
+                               const StackType &stack_type,
+                               int indent);
   std::vector<std::string> resolve_ksym_stack(uint64_t addr,
                                               bool show_offset,
                                               bool perf_mode,
@@ -253,7 +336,8 @@ private:
   void teardown_output();
   void poll_output(output::Output &out, bool drain = false);
   void poll_event_loss(output::Output &out);
-  static uint64_t read_address_from_output(std::string output);
+  void enable_probe_stats();
+  void poll_probe_stats(output::Output &out, bool force = false);
   struct bcc_symbol_option &get_symbol_opts();
   Probe generate_probe(const ast::AttachPoint &ap,
                        const ast::Probe &p,
@@ -264,7 +348,33 @@ private:
   struct perf_buffer *skb_perfbuf_ = nullptr;
   uint64_t event_loss_count_ = 0;
 
+  // Cumulative run statistics of each program, by program id, at the time of
+  // the last probe stats report, used to compute per-period deltas.
+  struct ProgRunStats {
+    uint64_t run_cnt = 0;
+    uint64_t run_time_ns = 0;
+  };
+  std::optional<util::FD> bpf_stats_fd_;
+  std::optional<std::chrono::steady_clock::time_point> probe_stats_last_;
+  std::unordered_map<uint32_t, ProgRunStats> probe_run_stats_;
+
   std::unordered_map<std::string, std::unique_ptr<Dwarf>> dwarves_;
+
+  // Stacks being symbolized in the background, by stack_key(). The worker
+  // comes last so that its threads are stopped before anything they use is
+  // destroyed.
+  std::unordered_map<std::string, std::shared_future<std::string>>
+      prefetched_stacks_;
+  // Interned stacks being symbolized in the background. They are looked up by
+  // id, so that their frames are only read from the stack table once.
+  std::unordered_map<InternedStack,
+                     std::shared_future<std::string>,
+                     InternedStackHash>
+      prefetched_interned_stacks_;
+  // ksym and usym values being symbolized in the background.
+  std::map<SymbolAddr, std::shared_future<std::string>> prefetched_ksyms_;
+  std::map<SymbolAddr, std::shared_future<std::string>> prefetched_usyms_;
+  std::unique_ptr<SymbolizationWorker> symbolizer_;
 };
 
 } // namespace bpftrace
@@ -460,6 +460,19 @@ std::string BTF::create_anon_btf_name(BTFId &btf_id)
 }
 
 SizedType BTF::get_stype(const BTFId &btf_id, bool resolve_structs)
+{
+  auto it = type_table_.find(btf_id);
+  if (it == type_table_.end()) {
+    auto stype = create_stype(btf_id);
+    it = type_table_.emplace(btf_id, std::move(stype)).first;
+  }
+
+  if (resolve_structs)
+    resolve_fields(it->second);
+  return it->second;
+}
+
+SizedType BTF::create_stype(const BTFId &btf_id)
 {
   const struct btf_type *t;
   BTFId id;
@@ -517,11 +530,10 @@ SizedType BTF::get_stype(const BTFId &btf_id, bool resolve_structs)
     auto name = recprefix + rname;
 
     auto record = bpftrace_->structs.LookupOrAdd(name, t->size).lock();
-    stype = CreateCStruct(name, record);
+    stype = CreateCStruct(name, std::move(record));
     if (is_anon)
       stype.SetAnon();
-    if (resolve_structs)
-      resolve_fields(id, std::move(record), 0);
+    record_ids_.try_emplace({ id.btf, name }, id.id);
   } else if (btf_is_ptr(t)) {
     const BTFId pointee_btf_id = { .btf = btf_id.btf, .id = t->type };
     std::unordered_set<std::string> tags;
@@ -532,7 +544,7 @@ SizedType BTF::get_stype(const BTFId &btf_id, bool resolve_structs)
   } else if (btf_is_array(t)) {
     auto *array = btf_array(t);
     const auto &elem_type = get_stype(
-        BTFId{ .btf = btf_id.btf, .id = array->type });
+        BTFId{ .btf = btf_id.btf, .id = array->type }, false);
     // Auto convert char arrays to strings.
     // This is the least worse option since users have come to expect
     // strings when they call `print`, `printf` or do string literal
@@ -1220,30 +1232,60 @@ __s32 BTF::find_id_in_btf(struct btf *btf,
   return -1;
 }
 
-void BTF::resolve_fields(const SizedType &type)
+BTF::BTFId BTF::find_record_id(const std::string &name) const
 {
-  BTFId type_id;
+  // Search the BTF objects in the same order as find_id does.
+  for (const auto &btf_obj : btf_objects) {
+    auto it = record_ids_.find({ btf_obj.btf, name });
+    if (it != record_ids_.end())
+      return { .btf = btf_obj.btf, .id = it->second };
+  }
+  return { .btf = nullptr, .id = 0 };
+}
 
+void BTF::resolve_fields(const SizedType &type, bool nested)
+{
   if (!type.IsCTypeTy())
     return;
 
   auto const &name = type.GetName();
   auto record = bpftrace_->structs.Lookup(name).lock();
-  if (record->HasFields())
+  if (!record)
     return;
 
-  if (type.IsAnonTy()) {
-    type_id = parse_anon_btf_name(name);
-  } else {
-    __u32 kind = type.IsCStructTy() ? BTF_KIND_STRUCT : BTF_KIND_UNION;
-    auto type_name = btf_type_str(name);
+  if (record->HasFields() && !nested)
+    return;
 
-    type_id = find_id(type_name, kind);
+  // Records which didn't come from BTF have no id here. They are still
+  // walked for embedded records which did.
+  auto type_id = find_record_id(name);
+  if (!record->HasFields()) {
+    if (!type_id.btf && type.IsAnonTy()) {
+      type_id = parse_anon_btf_name(name);
+    } else if (!type_id.btf) {
+      __u32 kind = type.IsCStructTy() ? BTF_KIND_STRUCT : BTF_KIND_UNION;
+      auto type_name = btf_type_str(name);
+
+      type_id = find_id(type_name, kind);
+    }
     if (!type_id.btf)
       return;
+
+    record_ids_.try_emplace({ type_id.btf, name }, type_id.id);
+    resolve_fields(type_id, record, 0);
   }
 
-  resolve_fields(type_id, std::move(record), 0);
+  if (!nested || nested_records_.contains({ type_id.btf, name }))
+    return;
+
+  for (const auto &field : record->fields) {
+    auto field_type = field.type;
+    while (field_type.IsArrayTy())
+      field_type = field_type.GetElementTy();
+    // Records are never embedded into themselves, so this terminates.
+    resolve_fields(field_type, true);
+  }
+  nested_records_.emplace(type_id.btf, name);
 }
 
 static std::optional<Bitfield> resolve_bitfield(
@@ -1288,7 +1330,7 @@ void BTF::resolve_fields(const BTFId &type_id,
     }
 
     record->AddField(field_name,
-                     get_stype(field_id),
+                     get_stype(field_id, false),
                      field_offset,
                      resolve_bitfield(btf_type, i));
   }
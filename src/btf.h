@@ -9,8 +9,10 @@
 #include <optional>
 #include <set>
 #include <string>
+#include <tuple>
 #include <unistd.h>
 #include <unordered_set>
+#include <utility>
 
 #include "ast/pass_manager.h"
 #include "symbols/kernel.h"
@@ -75,6 +77,11 @@ class BTF {
   struct BTFId {
     struct btf* btf;
     __u32 id;
+
+    bool operator<(const BTFId& other) const
+    {
+      return std::tie(btf, id) < std::tie(other.btf, other.id);
+    }
   };
 
 public:
@@ -118,7 +125,11 @@ public:
                                                bool skip_first_arg);
   Result<std::shared_ptr<Struct>> resolve_raw_tracepoint_args(
       std::string_view func);
-  void resolve_fields(const SizedType& type);
+  // Resolves the fields of the struct/union `type`. Fields which are
+  // themselves structs/unions are left unresolved until something touches
+  // them, unless `nested` is set, in which case the whole tree of embedded
+  // records is materialized (needed when the record is used as a value).
+  void resolve_fields(const SizedType& type, bool nested = false);
 
   int get_btf_id(std::string_view func,
                  std::string_view mod,
@@ -127,9 +138,11 @@ public:
 private:
   void load_vmlinux_btf();
   SizedType get_stype(const BTFId& btf_id, bool resolve_structs = true);
+  SizedType create_stype(const BTFId& btf_id);
   void resolve_fields(const BTFId& type_id,
                       std::shared_ptr<Struct> record,
                       __u32 start_offset);
+  BTFId find_record_id(const std::string& name) const;
   BTF::BTFId find_id(std::string_view name,
                      std::optional<__u32> kind = std::nullopt) const;
   __s32 find_id_in_btf(struct btf* btf,
@@ -179,6 +192,17 @@ private:
   std::string all_rawtracepoints_;
   std::optional<bool> has_module_btf_;
 
+  // Types created from BTF, interned by their BTF id. Records are created
+  // without fields and only resolved on demand, see resolve_fields.
+  std::map<BTFId, SizedType> type_table_;
+  // BTF ids of the records created so far, by BTF object and name, so that
+  // their fields can be resolved later without searching all BTF objects by
+  // name. A module may define a record with the same name as vmlinux.
+  std::map<std::pair<const struct btf*, std::string>, __u32> record_ids_;
+  // Records whose whole tree of embedded records has been resolved, keyed
+  // like record_ids_.
+  std::set<std::pair<const struct btf*, std::string>> nested_records_;
+
 public:
   // enum_name -> (value -> variant_name)
   std::map<std::string, std::map<uint64_t, std::string>> enum_defs_;
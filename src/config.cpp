@@ -221,6 +221,38 @@ struct ConfigParser<ConfigMissingProbes> {
   }
 };
 
+template <>
+struct ConfigParser<ConfigOptLevel> {
+  Result<OK> parse(const std::string &key,
+                   ConfigOptLevel *target,
+                   const std::string &original)
+  {
+    std::string s = util::to_lower(original);
+    if (s == "fast") {
+      *target = ConfigOptLevel::fast;
+      return OK();
+    } else if (s == "standard") {
+      *target = ConfigOptLevel::standard;
+      return OK();
+    } else if (s == "max") {
+      *target = ConfigOptLevel::max;
+      return OK();
+    } else {
+      return make_error<ParseError>(key,
+                                    "Invalid value for opt_level: valid "
+                                    "values are fast, standard, and max.");
+    }
+  }
+  Result<OK> parse(const std::string &key,
+                   [[maybe_unused]] ConfigOptLevel *target,
+                   [[maybe_unused]] uint64_t v)
+  {
+    return make_error<ParseError>(key,
+                                  "Invalid value for opt_level: valid "
+                                  "values are fast, standard, and max.");
+  }
+};
+
 template <>
 struct ConfigParser<CompatibleBPFLicense> {
   Result<OK> parse([[maybe_unused]] const std::string &key,
@@ -309,7 +341,12 @@ AnyParser parser(T fn)
 #define CONFIG_FIELD_PARSER(x) parser([](Config *config) { return &config->x; })
 const std::map<std::string, AnyParser> CONFIG_KEY_MAP = {
   { "cache_user_symbols", CONFIG_FIELD_PARSER(user_symbol_cache_type) },
+  { "compile_jobs", CONFIG_FIELD_PARSER(compile_jobs) },
   { "cpp_demangle", CONFIG_FIELD_PARSER(cpp_demangle) },
+  { "dw_ustack_cache_dir", CONFIG_FIELD_PARSER(dw_ustack_cache_dir) },
+  { "dw_ustack_max_pids", CONFIG_FIELD_PARSER(dw_ustack_max_pids) },
+  { "dw_ustack_max_tables", CONFIG_FIELD_PARSER(dw_ustack_max_tables) },
+  { "intern_stacks", CONFIG_FIELD_PARSER(intern_stacks) },
   { "lazy_symbolication", CONFIG_FIELD_PARSER(lazy_symbolication) },
   { "license", CONFIG_FIELD_PARSER(license) },
   { "log_size", CONFIG_FIELD_PARSER(log_size) },
@@ -318,12 +355,18 @@ const std::map<std::string, AnyParser> CONFIG_KEY_MAP = {
   { "max_map_keys", CONFIG_FIELD_PARSER(max_map_keys) },
   { "max_probes", CONFIG_FIELD_PARSER(max_probes) },
   { "max_strlen", CONFIG_FIELD_PARSER(max_strlen) },
+  { "max_user_symbol_caches", CONFIG_FIELD_PARSER(max_user_symbol_caches) },
+  { "max_user_symbol_cache_bytes",
+    CONFIG_FIELD_PARSER(max_user_symbol_cache_bytes) },
   { "on_stack_limit", CONFIG_FIELD_PARSER(on_stack_limit) },
+  { "opt_level", CONFIG_FIELD_PARSER(opt_level) },
   { "perf_rb_pages", CONFIG_FIELD_PARSER(perf_rb_pages) },
   { "stack_mode", CONFIG_FIELD_PARSER(stack_mode) },
   { "str_trunc_trailer", CONFIG_FIELD_PARSER(str_trunc_trailer) },
   { "missing_probes", CONFIG_FIELD_PARSER(missing_probes) },
   { "print_maps_on_exit", CONFIG_FIELD_PARSER(print_maps_on_exit) },
+  { "probe_insn_budget", CONFIG_FIELD_PARSER(probe_insn_budget) },
+  { "probe_stats_interval", CONFIG_FIELD_PARSER(probe_stats_interval) },
   { "use_blazesym", CONFIG_FIELD_PARSER(use_blazesym) },
   { "show_debug_info", CONFIG_FIELD_PARSER(show_debug_info) },
   { UNSTABLE_IMPORT_STATEMENT, CONFIG_FIELD_PARSER(unstable_import_statement) },
@@ -14,6 +14,12 @@ enum class ConfigMissingProbes {
   error,
 };
 
+enum class ConfigOptLevel {
+  fast,
+  standard,
+  max,
+};
+
 enum class ConfigUnstable {
   enable,
   warn,
@@ -59,6 +65,7 @@ public:
 
   // All configuration options.
   bool cpp_demangle = true;
+  bool intern_stacks = false;
   bool lazy_symbolication = true;
   bool print_maps_on_exit = true;
   ConfigUnstable unstable_import_statement = ConfigUnstable::error;
@@ -72,17 +79,26 @@ public:
   bool use_blazesym = false;
   bool show_debug_info = false;
 #endif
+  uint64_t compile_jobs = 1;
+  uint64_t dw_ustack_max_pids = 0;
+  uint64_t dw_ustack_max_tables = 64;
   uint64_t log_size = 1000000;
   uint64_t max_bpf_progs = 1024;
   uint64_t max_cat_bytes = 10240;
   uint64_t max_map_keys = 4096;
   uint64_t max_probes = 1024;
   uint64_t max_strlen = 1024;
+  uint64_t max_user_symbol_caches = 1024;
+  uint64_t max_user_symbol_cache_bytes = 256 * 1024 * 1024;
   uint64_t on_stack_limit = 32;
   uint64_t perf_rb_pages = 0; // See get_buffer_pages
+  uint64_t probe_insn_budget = 0;
+  uint64_t probe_stats_interval = 0;
   CompatibleBPFLicense license = CompatibleBPFLicense::GPL;
+  std::string dw_ustack_cache_dir;
   std::string str_trunc_trailer = "..";
   ConfigMissingProbes missing_probes = ConfigMissingProbes::error;
+  ConfigOptLevel opt_level = ConfigOptLevel::standard;
   StackMode stack_mode = StackMode::bpftrace;
 
   // Initialized in the constructor.
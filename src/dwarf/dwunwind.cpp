@@ -2,13 +2,18 @@
 #pragma GCC diagnostic ignored "-Wstringop-overread"
 #include <vector>
 #pragma GCC diagnostic pop
+#include <atomic>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <sys/stat.h>
+#include <thread>
+#include <unordered_set>
 
 #include "dwarf/dwunwind.h"
+#include "dwarf/dwunwind_cache.h"
 #include "dwarf/dwunwind_table.h"
 #include "log.h"
 
@@ -22,7 +27,6 @@
 
 #include "stdlib/stack/dwunwind_defs.h"
 
-const int CFT_ENTRY_SIZE = 228;
 const int CHUNK_SIZE = 256 * 1024;
 
 std::ostream &operator<<(std::ostream &os, const DWARFError &err)
@@ -283,35 +287,54 @@ invalid_expression:
   return std::make_optional<std::string>("invalid expression");
 }
 
-std::optional<uint32_t> DWARFUnwind::add_expression(llvm::DWARFExpression &expr)
+std::optional<std::vector<uint8_t>> DWARFUnwind::encode_expression(
+    llvm::DWARFExpression &expr)
 {
   auto expr_bytes = expr.getData();
   auto expr_u8 = std::vector<uint8_t>(expr_bytes.begin(), expr_bytes.end());
-  auto it = expressions_.find(expr_u8);
-  if (it != expressions_.end())
-    return it->second;
-
-  uint32_t id = expressions_.size();
-  expressions_[expr_u8] = id;
 
   //
   // preprocess expression to simplify bpf code
   // mainly we expand all arguments to 64 bits (registers to 8 bits)
   //
   std::vector<uint8_t> expr_out;
-  expr_out.reserve(256);
+  expr_out.reserve(EXPRESSION_SIZE);
 
   auto error = convert_expression(expr_u8, expr_out);
   if (error.has_value()) {
     LOG(ERROR) << "Failed to convert DWARF expression: " << error.value();
     return std::nullopt;
   }
-  expr_out.resize(256, 0);
-
-  if (table_feed_cb_(TableType::Expressions, id, expr_out))
-    return std::nullopt;
+  expr_out.resize(EXPRESSION_SIZE, 0);
+  return expr_out;
+}
 
-  return id;
+// Rewrites the expression ids of an encoded cft entry (see compile_eh_frame
+// for the layout) from ids local to an object to global ones.
+static bool relocate_expressions(std::vector<uint8_t> &entry,
+                                 const std::vector<uint32_t> &ids)
+{
+  auto relocate = [&](size_t pos, size_t size) {
+    uint64_t id = 0;
+    std::memcpy(&id, entry.data() + pos, size);
+    if (id >= ids.size())
+      return false;
+    id = ids[id];
+    std::memcpy(entry.data() + pos, &id, size);
+    return true;
+  };
+
+  uint32_t type;
+  std::memcpy(&type, entry.data() + 8, sizeof(type));
+  if (type == 2 && !relocate(12, sizeof(uint32_t)))
+    return false;
+  for (size_t reg = 0; reg < NUM_REGISTERS; reg++) {
+    size_t pos = 24 + (reg * 12);
+    std::memcpy(&type, entry.data() + pos, sizeof(type));
+    if ((type == 6 || type == 7) && !relocate(pos + 4, sizeof(uint64_t)))
+      return false;
+  }
+  return true;
 }
 
 DWARFError DWARFUnwind::add_object_file(const std::string &filename)
@@ -359,20 +382,36 @@ std::string DWARFUnwind::file_cache_key(const std::string &filename, int pid)
   return filename;
 }
 
+std::optional<DWARFError> DWARFUnwind::find_seen(const std::string &key,
+                                                 uint32_t &out_oid) const
+{
+  auto f = files_seen_.find(key);
+  if (f == files_seen_.end())
+    return std::nullopt;
+  if (!f->second.has_value())
+    return DWARFError::ParseError;
+  out_oid = *f->second;
+  return DWARFError::Success;
+}
+
 DWARFError DWARFUnwind::add_file_nopush(const std::string &filename,
                                         int pid,
                                         uint32_t &out_oid)
 {
   auto key = file_cache_key(filename, pid);
-  auto f = files_seen_.find(key);
-  if (f != files_seen_.end()) {
-    if (!f->second.has_value())
-      return DWARFError::ParseError;
-    out_oid = *f->second;
-    return DWARFError::Success;
-  }
+  if (auto seen = find_seen(key, out_oid))
+    return *seen;
 
-  DWARFError err = add_new_file(filename, pid, out_oid);
+  return add_compiled_file(key, compile_file(filename, pid), out_oid);
+}
+
+DWARFError DWARFUnwind::add_compiled_file(const std::string &key,
+                                          const CompiledObject &compiled,
+                                          uint32_t &out_oid)
+{
+  DWARFError err = compiled.err;
+  if (err == DWARFError::Success)
+    err = add_new_file(compiled, out_oid);
   if (err != DWARFError::Success) {
     files_seen_[key] = std::nullopt;
   } else {
@@ -399,37 +438,45 @@ void build_map_offsets(const llvm::object::ELFObjectFile<ELFT> *Obj,
   }
 }
 
-DWARFError DWARFUnwind::add_new_file(const std::string &filename,
-                                     int pid,
-                                     uint32_t &out_oid)
+// Doesn't touch any state but the cache, so that objects can be compiled in
+// parallel.
+DWARFUnwind::CompiledObject DWARFUnwind::compile_file(
+    const std::string &filename,
+    int pid) const
 {
-  auto oid = next_oid_;
-  if (oid == UINT16_MAX) {
-    LOG(ERROR) << "Maximum number of object IDs reached.";
-    return DWARFError::TooManyObjects;
-  }
-  if (oid == 0) {
-    std::vector<uint8_t> empty;
-    empty.resize(CFT_ENTRY_SIZE, 0);
-    if (table_feed_cb_(TableType::UnwindEntries, 0, empty))
-      return DWARFError::InternalError;
-  }
-  ++next_oid_;
-  out_oid = oid;
-
+  CompiledObject compiled;
   auto fn = resolve_path(filename, pid);
+  compiled.filename = fn;
 
-  LOG(V1) << "Adding file " << fn << " with OID " << oid;
   auto ExpectedBinary = llvm::object::createBinary(fn);
   if (!ExpectedBinary) {
     LOG(ERROR) << "Cannot open " << fn << " to extract stack walk information";
-    return DWARFError::FileNotFound;
+    compiled.err = DWARFError::FileNotFound;
+    return compiled;
   }
 
   auto *Bin = ExpectedBinary.get().getBinary();
   auto *Obj = llvm::dyn_cast<llvm::object::ObjectFile>(Bin);
-  if (!Obj)
-    return DWARFError::UnsupportedFormat;
+  if (!Obj) {
+    compiled.err = DWARFError::UnsupportedFormat;
+    return compiled;
+  }
+
+  // Compiled tables only depend on the object itself, so they can be reused
+  // from earlier runs.
+  auto build_id = llvm::toHex(llvm::object::getBuildID(Obj));
+  bool cacheable = cache_.has_value() && !build_id.empty();
+  if (cacheable) {
+    if (auto buf = cache_->load(build_id)) {
+      compiled.cached = std::move(buf);
+      if (ObjectUnwindTables::parse(compiled.bytes())) {
+        LOG(V1) << "Using cached unwind tables for " << fn;
+        return compiled;
+      }
+      LOG(V1) << "Ignoring invalid cached unwind tables for " << fn;
+      compiled.cached.reset();
+    }
+  }
 
   std::map<uint64_t, uint64_t> map_offsets;
   if (auto *ELF64LE = llvm::dyn_cast<llvm::object::ELF64LEObjectFile>(Obj)) {
@@ -445,10 +492,75 @@ DWARFError DWARFUnwind::add_new_file(const std::string &filename,
     build_map_offsets(ELF32BE, map_offsets);
   } else {
     LOG(V1) << "Not a recognized ELF object file.";
-    return DWARFError::UnsupportedFormat;
+    compiled.err = DWARFError::UnsupportedFormat;
+    return compiled;
+  }
+
+  compiled.err = compile_eh_frame(fn, map_offsets, compiled.data);
+  if (compiled.err == DWARFError::Success && cacheable)
+    cache_->store(build_id, compiled.data);
+  return compiled;
+}
+
+// Compiles the objects which haven't been seen yet on up to jobs_ threads.
+std::unordered_map<std::string, DWARFUnwind::CompiledObject> DWARFUnwind::
+    compile_new_files(const std::vector<std::string> &filenames,
+                      const std::vector<std::string> &keys,
+                      int pid) const
+{
+  std::vector<size_t> todo;
+  std::unordered_set<std::string> todo_keys;
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (!files_seen_.contains(keys[i]) && todo_keys.insert(keys[i]).second)
+      todo.push_back(i);
+  }
+
+  std::vector<CompiledObject> results(todo.size());
+  std::atomic<size_t> next = 0;
+  auto worker = [&] {
+    for (size_t i = next++; i < todo.size(); i = next++)
+      results[i] = compile_file(filenames[todo[i]], pid);
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < std::min(jobs_, todo.size()); ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  std::unordered_map<std::string, CompiledObject> compiled;
+  for (size_t i = 0; i < todo.size(); i++)
+    compiled.emplace(keys[todo[i]], std::move(results[i]));
+  return compiled;
+}
+
+DWARFError DWARFUnwind::add_new_file(const CompiledObject &compiled,
+                                     uint32_t &out_oid)
+{
+  auto oid = next_oid_;
+  if (oid == UINT16_MAX) {
+    LOG(ERROR) << "Maximum number of object IDs reached.";
+    return DWARFError::TooManyObjects;
+  }
+  if (oid == 0) {
+    std::vector<uint8_t> empty;
+    empty.resize(CFT_ENTRY_SIZE, 0);
+    if (table_feed_cb_(TableType::UnwindEntries, 0, empty))
+      return DWARFError::InternalError;
   }
+  ++next_oid_;
+  out_oid = oid;
 
-  return read_eh_frame(fn, oid, map_offsets);
+  LOG(V1) << "Adding file " << compiled.filename << " with OID " << oid;
+  auto tables = ObjectUnwindTables::parse(compiled.bytes());
+  if (!tables) {
+    LOG(BUG) << "Failed to read back compiled unwind tables for "
+             << compiled.filename;
+    return DWARFError::InternalError;
+  }
+  return add_object_tables(oid, *tables);
 }
 
 #if LLVM_VERSION_MAJOR >= 21
@@ -474,10 +586,12 @@ DWARFError DWARFUnwind::push_current_table()
   return DWARFError::Success;
 }
 
-DWARFError DWARFUnwind::read_eh_frame(
+// Compiles the .eh_frame (or .debug_frame) of an object into the format used
+// by our eBPF program, see ObjectUnwindTables.
+DWARFError DWARFUnwind::compile_eh_frame(
     const std::string &filename,
-    uint32_t oid,
-    const std::map<uint64_t, uint64_t> &map_offsets)
+    const std::map<uint64_t, uint64_t> &map_offsets,
+    std::vector<uint8_t> &out)
 {
 #if LLVM_VERSION_MAJOR >= 21
   auto ExpectedBinary = llvm::object::createBinary(filename);
@@ -511,6 +625,23 @@ DWARFError DWARFUnwind::read_eh_frame(
   int rowCount = 0;
   std::map<uint64_t, uint32_t> rows;
 
+  // ids are local to this object
+  std::map<std::vector<uint8_t>, uint32_t> expression_ids;
+  std::vector<std::vector<uint8_t>> expressions;
+  std::map<std::vector<uint8_t>, uint32_t> entry_ids;
+  std::vector<std::vector<uint8_t>> entries;
+  auto add_expression =
+      [&](llvm::DWARFExpression &expr) -> std::optional<uint32_t> {
+    auto encoded = encode_expression(expr);
+    if (!encoded.has_value())
+      return std::nullopt;
+    auto [it, inserted] = expression_ids.emplace(*encoded,
+                                                 expressions.size());
+    if (inserted)
+      expressions.emplace_back(std::move(*encoded));
+    return it->second;
+  };
+
   std::vector<uint8_t> s;
   s.reserve(CFT_ENTRY_SIZE);
   std::vector<uint8_t> rs;
@@ -677,17 +808,11 @@ DWARFError DWARFUnwind::read_eh_frame(
           return DWARFError::InternalError;
         }
 
-        auto it = entries_.find(s);
-        uint32_t id;
-        if (it != entries_.end()) {
-          id = it->second;
-        } else {
-          id = entries_.size() + 1; // reserve 0 for no entry
-          entries_[s] = id;
-
-          if (table_feed_cb_(TableType::UnwindEntries, id, s))
-            return DWARFError::InternalError;
-        }
+        // reserve 0 for no entry
+        auto [it, inserted] = entry_ids.emplace(s, entries.size() + 1);
+        if (inserted)
+          entries.emplace_back(s);
+        uint32_t id = it->second;
 
         auto start = row.getAddress() - map_offset;
         // start may override end
@@ -718,12 +843,63 @@ DWARFError DWARFUnwind::read_eh_frame(
 
   LOG(V1) << "Summary: Found " << fdeCount << " FDEs and " << rowCount
           << " rows.";
-  LOG(V1) << "expressions: " << expressions_.size()
-          << ", entries: " << entries_.size() << ", rows: " << rows.size();
+  LOG(V1) << "expressions: " << expressions.size()
+          << ", entries: " << entries.size() << ", rows: " << rows.size();
+
+  out = ObjectUnwindTables::serialize(expressions, entries, rows);
+  return DWARFError::Success;
+#else
+  // avoid unused parameter warnings when DWARF_UNWIND is not defined
+  (void)filename;
+  (void)map_offsets;
+  (void)out;
+  return DWARFError::UnsupportedFormat;
+#endif
+}
+
+// Feeds the tables of an object, translating its local expression and cft
+// entry ids to global ones. Both are deduplicated across objects.
+DWARFError DWARFUnwind::add_object_tables(uint32_t oid,
+                                          const ObjectUnwindTables &tables)
+{
+  std::vector<uint32_t> expression_ids;
+  expression_ids.reserve(tables.num_expressions());
+  for (size_t i = 0; i < tables.num_expressions(); i++) {
+    auto expr = tables.expression(i);
+    std::vector<uint8_t> e(expr.begin(), expr.end());
+    auto it = expressions_.find(e);
+    if (it == expressions_.end()) {
+      uint32_t id = expressions_.size();
+      it = expressions_.emplace(std::move(e), id).first;
+      if (table_feed_cb_(TableType::Expressions, id, it->first))
+        return DWARFError::InternalError;
+    }
+    expression_ids.push_back(it->second);
+  }
+
+  // indexed by local entry id + 1, 0 stays 0
+  std::vector<uint32_t> entry_ids(tables.num_entries() + 1, 0);
+  for (size_t i = 0; i < tables.num_entries(); i++) {
+    auto entry = tables.entry(i);
+    std::vector<uint8_t> s(entry.begin(), entry.end());
+    if (!relocate_expressions(s, expression_ids))
+      return DWARFError::ParseError;
+    auto it = entries_.find(s);
+    if (it == entries_.end()) {
+      uint32_t id = entries_.size() + 1; // reserve 0 for no entry
+      it = entries_.emplace(std::move(s), id).first;
+      if (table_feed_cb_(TableType::UnwindEntries, id, it->first))
+        return DWARFError::InternalError;
+    }
+    entry_ids[i + 1] = it->second;
+  }
 
   std::vector<std::pair<uint64_t, uint64_t>> table_entries;
-  for (const auto &row : rows) {
-    table_entries.emplace_back(row.first, row.second);
+  table_entries.reserve(tables.rows().size());
+  for (const auto &row : tables.rows()) {
+    if (row.entry >= entry_ids.size())
+      return DWARFError::ParseError;
+    table_entries.emplace_back(row.file_offset, entry_ids[row.entry]);
   }
   size_t start = 0;
   while (start < table_entries.size()) {
@@ -756,22 +932,8 @@ DWARFError DWARFUnwind::read_eh_frame(
   }
 
   return DWARFError::Success;
-#else
-  // avoid unused parameter warnings when DWARF_UNWIND is not defined
-  (void)filename;
-  (void)oid;
-  (void)map_offsets;
-  return DWARFError::UnsupportedFormat;
-#endif
 }
 
-struct ProcessMapEntry {
-  uint64_t vm_start;
-  uint64_t vm_end;
-  uint64_t offset;
-  std::string file_path;
-};
-
 std::vector<ProcessMapEntry> read_process_maps(int pid)
 {
   std::vector<ProcessMapEntry> maps;
@@ -818,20 +980,60 @@ std::vector<ProcessMapEntry> read_process_maps(int pid)
   return maps;
 }
 
-DWARFError DWARFUnwind::add_pid(pid_t pid)
+// Field 26 of /proc/<pid>/stat, 0 if it can't be read. The comm field may
+// contain spaces, so fields are counted from its closing parenthesis.
+static uint64_t read_start_code(pid_t pid)
+{
+  std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+  std::string stat((std::istreambuf_iterator<char>(file)),
+                   std::istreambuf_iterator<char>());
+  auto comm_end = stat.rfind(')');
+  if (comm_end == std::string::npos)
+    return 0;
+
+  std::istringstream fields(stat.substr(comm_end + 1));
+  std::string field;
+  for (int i = 3; i <= 26; i++) {
+    if (!(fields >> field))
+      return 0;
+  }
+  return std::strtoull(field.c_str(), nullptr, 10);
+}
+
+DWARFError DWARFUnwind::add_pid(pid_t pid, bool skip_failed_files)
 {
   auto maps = read_process_maps(pid);
-  // output mapping vector, reserve room for nentries record at the beginning
-  std::vector<uint8_t> s = { 0, 0, 0, 0, 0, 0, 0, 0 };
+  // output mapping vector, reserve room for the header at the beginning. The
+  // start of the code segment lets the unwinder detect an exec.
+  std::vector<uint8_t> s;
+  s.reserve(MAPPING_HEADER_SIZE + (MAX_MAPPINGS * MAPPING_ENTRY_SIZE));
+  append_u64(s, 0);
+  append_u64(s, read_start_code(pid));
   int num_entries = 0;
-  s.reserve((MAX_MAPPINGS * 24) + 8);
 
+  // New objects are compiled in parallel up front. They are added in the
+  // order of the mappings afterwards, so that ids don't depend on scheduling.
+  std::vector<std::string> filenames;
+  std::vector<std::string> keys;
   for (const auto &map : maps) {
+    filenames.push_back(map.file_path);
+    keys.push_back(file_cache_key(map.file_path, pid));
+  }
+  auto compiled = compile_new_files(filenames, keys, pid);
+
+  for (size_t i = 0; i < maps.size(); i++) {
+    const auto &map = maps[i];
     uint32_t oid;
-    auto err = add_file_nopush(map.file_path, pid, oid);
+    auto seen = find_seen(keys[i], oid);
+    auto err = seen ? *seen
+                    : add_compiled_file(keys[i], compiled.at(keys[i]), oid);
     if (err != DWARFError::Success) {
       LOG(V1) << "File " << map.file_path << " not added: Error " << err;
-      return err;
+      // Running out of space affects every file, not just this one.
+      if (!skip_failed_files || err == DWARFError::TooManyObjects ||
+          err == DWARFError::InternalError)
+        return err;
+      continue;
     }
     auto e = table_mappings_.find(oid);
     if (e == table_mappings_.end()) {
@@ -854,8 +1056,9 @@ DWARFError DWARFUnwind::add_pid(pid_t pid)
       auto table_id = me.table_id;
       auto table_offset = me.table_offset;
 
-      s.reserve(s.size() + 24);
+      s.reserve(s.size() + MAPPING_ENTRY_SIZE);
       append_u64(s, start);
+      append_u64(s, map.vm_end);
       append_u64(s, offset);
       append_u32(s, table_id);
       append_u32(s, table_offset);
@@ -876,7 +1079,7 @@ DWARFError DWARFUnwind::add_pid(pid_t pid)
     s[i] = nentries[i];
 
   // fill up to expected size
-  s.resize((MAX_MAPPINGS * 24) + 8, 0);
+  s.resize(MAPPING_HEADER_SIZE + (MAX_MAPPINGS * MAPPING_ENTRY_SIZE), 0);
 
   if (table_feed_cb_(TableType::Mappings, pid, s))
     return DWARFError::InternalError;
@@ -1,18 +1,26 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <map>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include "dwarf/dwunwind_cache.h"
 #include "llvm/DebugInfo/DWARF/DWARFDebugFrame.h"
 
 #define DWUNWIND_MAPPINGS "dwunwind_mappings"
 #define DWUNWIND_OFFSETMAPS "dwunwind_offsetmaps"
 #define DWUNWIND_CFTS "dwunwind_cfts"
 #define DWUNWIND_EXPRESSIONS "dwunwind_expressions"
+#define DWUNWIND_ON_DEMAND "dwunwind_on_demand"
+#define DWUNWIND_REQUESTS "dwunwind_requests"
+#define DWUNWIND_REQUESTED "dwunwind_requested"
 
 enum class DWARFError {
   Success = 0,
@@ -30,6 +38,16 @@ struct TableMapping {
   uint64_t table_offset;
 };
 
+struct ProcessMapEntry {
+  uint64_t vm_start;
+  uint64_t vm_end;
+  uint64_t offset;
+  std::string file_path;
+};
+
+// Returns the executable, file-backed mappings of a process.
+std::vector<ProcessMapEntry> read_process_maps(int pid);
+
 enum class TableType {
   UnwindTable,
   UnwindEntries,
@@ -48,20 +66,69 @@ public:
   }
 
   DWARFError add_object_file(const std::string &filename);
-  DWARFError add_pid(pid_t pid);
+  // Builds the tables for all objects mapped by a process. With
+  // `skip_failed_files`, objects which can't be read are left out instead of
+  // failing the whole process.
+  DWARFError add_pid(pid_t pid, bool skip_failed_files = false);
+
+  // Caches compiled tables of objects with a build-id in `dir`. Disabled if
+  // `dir` is empty.
+  void set_cache_dir(const std::string &dir)
+  {
+    if (dir.empty())
+      cache_.reset();
+    else
+      cache_.emplace(dir);
+  }
+
+  // Compiles the tables of up to `jobs` new objects at once. The tables fed
+  // don't depend on it.
+  void set_jobs(size_t jobs)
+  {
+    jobs_ = std::max<size_t>(jobs, 1);
+  }
 
 private:
-  std::optional<uint32_t> add_expression(llvm::DWARFExpression &expr);
-  DWARFError add_new_file(const std::string &filename,
-                          int pid,
-                          uint32_t &out_oid);
+  // The tables of an object, compiled or loaded from the cache but not yet
+  // added.
+  struct CompiledObject {
+    DWARFError err = DWARFError::Success;
+    std::string filename;
+    std::unique_ptr<llvm::MemoryBuffer> cached;
+    std::vector<uint8_t> data;
+
+    std::span<const uint8_t> bytes() const
+    {
+      if (cached)
+        return { reinterpret_cast<const uint8_t *>(cached->getBufferStart()),
+                 cached->getBufferSize() };
+      return data;
+    }
+  };
+
+  static std::optional<std::vector<uint8_t>> encode_expression(
+      llvm::DWARFExpression &expr);
+  CompiledObject compile_file(const std::string &filename, int pid) const;
+  std::unordered_map<std::string, CompiledObject> compile_new_files(
+      const std::vector<std::string> &filenames,
+      const std::vector<std::string> &keys,
+      int pid) const;
+  std::optional<DWARFError> find_seen(const std::string &key,
+                                      uint32_t &out_oid) const;
+  DWARFError add_new_file(const CompiledObject &compiled, uint32_t &out_oid);
+  DWARFError add_compiled_file(const std::string &key,
+                               const CompiledObject &compiled,
+                               uint32_t &out_oid);
   DWARFError add_file_nopush(const std::string &filename,
                              int pid,
                              uint32_t &out_oid);
   DWARFError push_current_table();
-  DWARFError read_eh_frame(const std::string &filename,
-                           uint32_t oid,
-                           const std::map<uint64_t, uint64_t> &map_offsets);
+  static DWARFError compile_eh_frame(
+      const std::string &filename,
+      const std::map<uint64_t, uint64_t> &map_offsets,
+      std::vector<uint8_t> &out);
+  DWARFError add_object_tables(uint32_t oid,
+                               const ObjectUnwindTables &tables);
   static std::string resolve_path(const std::string &filename, int pid);
   std::string file_cache_key(const std::string &filename, int pid);
 
@@ -74,4 +141,6 @@ private:
   std::unordered_map<std::string, uint32_t> tables_;
   std::vector<uint8_t> current_table_;
   std::unordered_map<std::string, std::optional<uint32_t>> files_seen_;
+  std::optional<UnwindTableCache> cache_;
+  size_t jobs_ = std::max(1U, std::thread::hardware_concurrency());
 };
@@ -0,0 +1,173 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dwarf/dwunwind_cache.h"
+#include "log.h"
+
+namespace {
+
+// Bump the version whenever the encoding of expressions, cft entries or rows
+// changes, so that stale cache files are rebuilt.
+const char CACHE_MAGIC[8] = { 'B', 'T', 'D', 'W', 'U', 'N', 'W', 0 };
+const uint32_t CACHE_VERSION = 1;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t pad;
+  uint64_t num_expressions;
+  uint64_t num_entries;
+  uint64_t num_rows;
+};
+
+// Rows are read in place, so they have to be aligned.
+size_t align_rows(size_t offset)
+{
+  return (offset + alignof(ObjectUnwindTables::Row) - 1) &
+         ~(alignof(ObjectUnwindTables::Row) - 1);
+}
+
+// Returns whether `path` is a directory (or regular file) that nobody but
+// root or the current user can have written to. Missing paths are quietly
+// rejected.
+bool trusted(const std::string &path, bool dir)
+{
+  struct stat st;
+  if (lstat(path.c_str(), &st) != 0)
+    return false;
+
+  std::string reason;
+  if (dir ? !S_ISDIR(st.st_mode) : !S_ISREG(st.st_mode))
+    reason = dir ? "not a directory" : "not a regular file";
+  else if (st.st_uid != 0 && st.st_uid != geteuid())
+    reason = "not owned by root or the current user";
+  else if (st.st_mode & (S_IWGRP | S_IWOTH))
+    reason = "writable by group or others";
+  if (reason.empty())
+    return true;
+
+  LOG(WARNING) << "Ignoring unwind table cache " << path << ": " << reason;
+  return false;
+}
+
+} // namespace
+
+std::vector<uint8_t> ObjectUnwindTables::serialize(
+    const std::vector<std::vector<uint8_t>> &expressions,
+    const std::vector<std::vector<uint8_t>> &entries,
+    const std::map<uint64_t, uint32_t> &rows)
+{
+  Header header = {};
+  std::memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.version = CACHE_VERSION;
+  header.num_expressions = expressions.size();
+  header.num_entries = entries.size();
+  header.num_rows = rows.size();
+
+  std::vector<uint8_t> data(sizeof(header));
+  std::memcpy(data.data(), &header, sizeof(header));
+  for (const auto &expr : expressions)
+    data.insert(data.end(), expr.begin(), expr.end());
+  for (const auto &entry : entries)
+    data.insert(data.end(), entry.begin(), entry.end());
+  data.resize(align_rows(data.size()), 0);
+  for (const auto &[file_offset, entry] : rows) {
+    Row row = { .file_offset = file_offset, .entry = entry, .pad = 0 };
+    const auto *bytes = reinterpret_cast<const uint8_t *>(&row);
+    data.insert(data.end(), bytes, bytes + sizeof(row));
+  }
+  return data;
+}
+
+std::optional<ObjectUnwindTables> ObjectUnwindTables::parse(
+    std::span<const uint8_t> data)
+{
+  Header header;
+  if (data.size() < sizeof(header))
+    return std::nullopt;
+  std::memcpy(&header, data.data(), sizeof(header));
+  if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != CACHE_VERSION)
+    return std::nullopt;
+
+  size_t expressions_size = header.num_expressions * EXPRESSION_SIZE;
+  size_t entries_size = header.num_entries * CFT_ENTRY_SIZE;
+  size_t rows_offset = align_rows(sizeof(header) + expressions_size +
+                                  entries_size);
+  if (data.size() != rows_offset + (header.num_rows * sizeof(Row)) ||
+      reinterpret_cast<uintptr_t>(data.data()) % alignof(Row) != 0)
+    return std::nullopt;
+
+  ObjectUnwindTables tables;
+  tables.expressions_ = data.subspan(sizeof(header), expressions_size);
+  tables.entries_ = data.subspan(sizeof(header) + expressions_size,
+                                 entries_size);
+  tables.rows_ = std::span<const Row>(
+      reinterpret_cast<const Row *>(data.data() + rows_offset),
+      header.num_rows);
+  return tables;
+}
+
+std::string UnwindTableCache::path(const std::string &build_id) const
+{
+  return dir_ + "/" + build_id + ".dwu";
+}
+
+std::unique_ptr<llvm::MemoryBuffer> UnwindTableCache::load(
+    const std::string &build_id) const
+{
+  if (!trusted(dir_, true) || !trusted(path(build_id), false))
+    return nullptr;
+  auto buf = llvm::MemoryBuffer::getFile(path(build_id),
+                                         /*IsText=*/false,
+                                         /*RequiresNullTerminator=*/false);
+  if (!buf)
+    return nullptr;
+  return std::move(*buf);
+}
+
+void UnwindTableCache::store(const std::string &build_id,
+                             const std::vector<uint8_t> &data) const
+{
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  if (fs::create_directories(dir_, ec))
+    fs::permissions(dir_,
+                    fs::perms::owner_all | fs::perms::group_read |
+                        fs::perms::group_exec | fs::perms::others_read |
+                        fs::perms::others_exec,
+                    ec);
+  if (ec) {
+    LOG(V1) << "Cannot create unwind table cache " << dir_ << ": "
+            << ec.message();
+    return;
+  }
+  if (!trusted(dir_, true))
+    return;
+
+  // Write to a temporary file first, so that concurrent runs never see a
+  // partial cache file.
+  auto tmp = path(build_id) + "." + std::to_string(getpid());
+  {
+    std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    if (!file) {
+      LOG(V1) << "Cannot write unwind table cache file " << tmp;
+      fs::remove(tmp, ec);
+      return;
+    }
+  }
+  fs::permissions(tmp,
+                  fs::perms::owner_read | fs::perms::owner_write |
+                      fs::perms::group_read | fs::perms::others_read,
+                  ec);
+  fs::rename(tmp, path(build_id), ec);
+  if (ec) {
+    LOG(V1) << "Cannot write unwind table cache file " << path(build_id)
+            << ": " << ec.message();
+    fs::remove(tmp, ec);
+  }
+}
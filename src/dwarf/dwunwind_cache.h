@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "llvm/Support/MemoryBuffer.h"
+
+const int CFT_ENTRY_SIZE = 228;
+const int EXPRESSION_SIZE = 256;
+
+// The unwind tables of a single object file, as compiled from its .eh_frame.
+// Expression and cft entry ids are local to the object, so that the tables
+// don't depend on what else is loaded and can be cached across runs.
+//
+// The serialized form is used as is, both in memory and mmapped from the
+// cache: header, expressions, cft entries, rows.
+class ObjectUnwindTables {
+public:
+  struct Row {
+    uint64_t file_offset;
+    // Local cft entry id + 1, 0 marks the end of an FDE
+    uint32_t entry;
+    uint32_t pad;
+  };
+
+  static std::vector<uint8_t> serialize(
+      const std::vector<std::vector<uint8_t>> &expressions,
+      const std::vector<std::vector<uint8_t>> &entries,
+      const std::map<uint64_t, uint32_t> &rows);
+
+  // Returns nullopt if `data` is not a valid serialized form.
+  static std::optional<ObjectUnwindTables> parse(
+      std::span<const uint8_t> data);
+
+  size_t num_expressions() const
+  {
+    return expressions_.size() / EXPRESSION_SIZE;
+  }
+  std::span<const uint8_t> expression(size_t i) const
+  {
+    return expressions_.subspan(i * EXPRESSION_SIZE, EXPRESSION_SIZE);
+  }
+  size_t num_entries() const
+  {
+    return entries_.size() / CFT_ENTRY_SIZE;
+  }
+  std::span<const uint8_t> entry(size_t i) const
+  {
+    return entries_.subspan(i * CFT_ENTRY_SIZE, CFT_ENTRY_SIZE);
+  }
+  std::span<const Row> rows() const
+  {
+    return rows_;
+  }
+
+private:
+  std::span<const uint8_t> expressions_;
+  std::span<const uint8_t> entries_;
+  std::span<const Row> rows_;
+};
+
+// Compiled unwind tables on disk, one file per build-id.
+//
+// The tables are fed to the BPF programs without further checks, so the
+// directory and files are only used if they are owned by root or the current
+// user and are not writable by anyone else.
+class UnwindTableCache {
+public:
+  explicit UnwindTableCache(std::string dir) : dir_(std::move(dir))
+  {
+  }
+
+  // Returns the cached tables for `build_id`, mapped into memory.
+  std::unique_ptr<llvm::MemoryBuffer> load(const std::string &build_id) const;
+  void store(const std::string &build_id,
+             const std::vector<uint8_t> &data) const;
+
+private:
+  std::string path(const std::string &build_id) const;
+
+  std::string dir_;
+};
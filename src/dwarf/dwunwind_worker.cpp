@@ -0,0 +1,446 @@
+#include <algorithm>
+#include <bpf/libbpf.h>
+#include <cerrno>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "bpfmap.h"
+#include "dwarf/dwunwind_worker.h"
+#include "log.h"
+#include "stdlib/stack/dwunwind_defs.h"
+
+namespace bpftrace {
+
+namespace {
+
+// Must match struct dwunwind_request in stdlib/stack/dwunwind.bpf.c
+struct UnwindRequest {
+  uint32_t tgid;
+  uint32_t pad;
+  uint64_t ip;
+};
+
+// The number of cft entries and expressions grows with the size of the
+// offsetmaps; these ratios leave room for typical binaries.
+const uint32_t ENTRIES_PER_TABLE = 1024;
+const uint32_t EXPRESSIONS_PER_TABLE = 16;
+
+// Bytes of values copied into a single batch update. Offsetmaps are large, so
+// this bounds the extra memory used while inserting many of them.
+const size_t MAX_BATCH_SIZE = 4 << 20;
+
+bool process_exited(pid_t pid)
+{
+  return kill(pid, 0) != 0 && errno == ESRCH;
+}
+
+// Whether `ip` is within one of the vmas of a mapping table.
+bool mapping_covers(const std::vector<uint8_t> &mapping, uint64_t ip)
+{
+  if (mapping.size() < MAPPING_HEADER_SIZE)
+    return false;
+  uint64_t nentries;
+  std::memcpy(&nentries, mapping.data(), sizeof(nentries));
+  nentries = std::min<uint64_t>(nentries, MAX_MAPPINGS);
+  for (uint64_t i = 0; i < nentries; i++) {
+    uint64_t vma[2];
+    std::memcpy(vma,
+                mapping.data() + MAPPING_HEADER_SIZE +
+                    (i * MAPPING_ENTRY_SIZE),
+                sizeof(vma));
+    if (ip >= vma[0] && ip < vma[1])
+      return true;
+  }
+  return false;
+}
+
+// The vma of `pid` which contains `ip`, or the page of `ip` if it can't be
+// found.
+std::pair<uint64_t, uint64_t> find_vma(pid_t pid, uint64_t ip)
+{
+  std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+  for (std::string line; std::getline(maps, line);) {
+    uint64_t start = 0;
+    uint64_t end = 0;
+    if (std::sscanf(line.c_str(), "%" SCNx64 "-%" SCNx64, &start, &end) != 2)
+      continue;
+    if (ip >= start && ip < end)
+      return { start, end };
+  }
+  const uint64_t page = 4096;
+  return { ip & ~(page - 1), (ip & ~(page - 1)) + page };
+}
+
+const char *table_map_name(TableType type)
+{
+  switch (type) {
+    case TableType::UnwindTable:
+      return DWUNWIND_OFFSETMAPS;
+    case TableType::UnwindEntries:
+      return DWUNWIND_CFTS;
+    case TableType::Expressions:
+      return DWUNWIND_EXPRESSIONS;
+    case TableType::Mappings:
+      return DWUNWIND_MAPPINGS;
+  }
+  return nullptr;
+}
+
+} // namespace
+
+DWARFUnwindCapacity::DWARFUnwindCapacity(uint32_t pids, uint32_t tables)
+    : pids(pids),
+      tables(tables),
+      entries(tables * ENTRIES_PER_TABLE),
+      expressions(tables * EXPRESSIONS_PER_TABLE)
+{
+}
+
+DWARFUnwindWorker::DWARFUnwindWorker(const BpfBytecode &bytecode,
+                                     DWARFUnwindCapacity capacity,
+                                     std::string cache_dir)
+    : bytecode_(bytecode),
+      capacity_(capacity),
+      cache_dir_(std::move(cache_dir))
+{
+  reset();
+}
+
+DWARFUnwindWorker::~DWARFUnwindWorker()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void DWARFUnwindWorker::add_pids(const std::vector<pid_t> &pids)
+{
+  for (pid_t pid : pids) {
+    auto err = unwind_->add_pid(pid);
+    if (err != DWARFError::Success)
+      LOG(ERROR) << "Failed to build unwind tables for pid " << pid << ": "
+                 << err;
+  }
+}
+
+int DWARFUnwindWorker::resize_maps()
+{
+  auto pending = [this](TableType type) -> uint32_t {
+    auto it = pending_tables_.find(type);
+    if (it == pending_tables_.end() || it->second.empty())
+      return 0;
+    return it->second.rbegin()->first + 1;
+  };
+  // The configured capacity is headroom for the processes and objects which
+  // show up while running, on top of what the targets already use.
+  capacity_.pids = std::max<uint32_t>(
+      capacity_.pids + static_cast<uint32_t>(pending_mappings_.size()), 1);
+  capacity_.tables += pending(TableType::UnwindTable);
+  capacity_.entries += pending(TableType::UnwindEntries);
+  capacity_.expressions += pending(TableType::Expressions);
+
+  const std::pair<TableType, uint32_t> sizes[] = {
+    { TableType::Mappings, capacity_.pids },
+    { TableType::UnwindTable, capacity_.tables },
+    { TableType::UnwindEntries, capacity_.entries },
+    { TableType::Expressions, capacity_.expressions },
+  };
+  for (const auto &[type, size] : sizes) {
+    auto ret = bytecode_.getMap(table_map_name(type)).resize(size);
+    if (!ret) {
+      LOG(ERROR) << "Failed to resize unwind table: " << ret.takeError();
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int DWARFUnwindWorker::start(struct ring_buffer *ringbuf, bool on_demand)
+{
+  if (flush())
+    return -1;
+  live_ = true;
+  on_demand_ = on_demand;
+
+  int err = ring_buffer__add(ringbuf,
+                             bytecode_.getMap(DWUNWIND_REQUESTS).fd(),
+                             handle_request,
+                             this);
+  if (err) {
+    LOG(ERROR) << "Failed to add unwind table requests to ring buffer: "
+               << strerror(-err);
+    return -1;
+  }
+
+  thread_ = std::thread(&DWARFUnwindWorker::run, this);
+
+  uint32_t key = 0;
+  uint32_t mode = on_demand ? DWUNWIND_REQUESTS_ALL
+                            : DWUNWIND_REQUESTS_UPDATES;
+  auto ret = bytecode_.getMap(DWUNWIND_ON_DEMAND).update_elem(&key, &mode);
+  if (!ret) {
+    LOG(ERROR) << "Failed to enable unwind table requests: "
+               << ret.takeError();
+    return -1;
+  }
+  return 0;
+}
+
+// Called while polling the ring buffer: only queue the request, building the
+// tables can take a while.
+int DWARFUnwindWorker::handle_request(void *ctx, void *data, size_t size)
+{
+  auto *worker = static_cast<DWARFUnwindWorker *>(ctx);
+  if (size < sizeof(UnwindRequest))
+    return 0;
+
+  UnwindRequest request;
+  std::memcpy(&request, data, sizeof(request));
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex_);
+    worker->queue_.push_back(
+        { .pid = static_cast<pid_t>(request.tgid), .ip = request.ip });
+  }
+  worker->cv_.notify_one();
+  return 0;
+}
+
+void DWARFUnwindWorker::run()
+{
+  while (true) {
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (stop_)
+        return;
+      request = queue_.front();
+      queue_.pop_front();
+    }
+    build(request);
+  }
+}
+
+// Objects already known are not parsed again, so for a process with tables
+// this only adds the new objects and rewrites its mapping table.
+void DWARFUnwindWorker::build(const Request &request)
+{
+  // A new image replaces any code generated by the previous one.
+  if (request.ip == 0) {
+    jit_ranges_.erase(request.pid);
+  } else if (in_jit_range(request.pid, request.ip)) {
+    clear_request(request.pid);
+    return;
+  }
+
+  if (!add_pid(request.pid)) {
+    if (process_exited(request.pid)) {
+      forget(request.pid);
+      return;
+    }
+    // Leave the request in place so that the process isn't reported again.
+    if (!tables_full_)
+      return;
+
+    // Target processes without tables are not reported, so rebuild theirs
+    // right away.
+    std::vector<pid_t> targets;
+    if (!on_demand_)
+      std::ranges::copy_if(lru_,
+                           std::back_inserter(targets),
+                           [&](pid_t pid) { return pid != request.pid; });
+    LOG(V1) << "Unwind tables full, dropping the tables of " << pids_.size()
+            << " processes";
+    reset();
+    for (pid_t pid : targets)
+      add_pid(pid);
+    if (!add_pid(request.pid))
+      return;
+  }
+
+  // Addresses outside of any object file (e.g. JIT code) stay uncovered.
+  // Remember their range, so that the next reports from it are answered
+  // without rebuilding anything, while later exec, mmap and dlopen still get
+  // reported.
+  if (request.ip != 0 && !mapping_covers(last_mapping_, request.ip))
+    jit_ranges_[request.pid].push_back(find_vma(request.pid, request.ip));
+  clear_request(request.pid);
+}
+
+bool DWARFUnwindWorker::in_jit_range(pid_t pid, uint64_t ip) const
+{
+  auto it = jit_ranges_.find(pid);
+  if (it == jit_ranges_.end())
+    return false;
+  return std::ranges::any_of(it->second, [ip](const auto &range) {
+    return ip >= range.first && ip < range.second;
+  });
+}
+
+void DWARFUnwindWorker::clear_request(pid_t pid)
+{
+  uint32_t key = pid;
+  auto ret = bytecode_.getMap(DWUNWIND_REQUESTED).delete_elem(&key);
+  if (!ret)
+    LOG(WARNING) << "Failed to clear unwind table request: "
+                 << ret.takeError();
+}
+
+bool DWARFUnwindWorker::add_pid(pid_t pid)
+{
+  tables_full_ = false;
+  last_mapping_.clear();
+  auto err = unwind_->add_pid(pid, true);
+  if (err == DWARFError::TooManyObjects)
+    tables_full_ = true;
+  if (tables_full_) {
+    // All tables are about to be rebuilt, don't bother inserting these.
+    pending_tables_.clear();
+    pending_mappings_.clear();
+  } else if (flush()) {
+    // Objects which were compiled still got ids, so their tables are inserted
+    // even if the process failed.
+    return false;
+  }
+  if (err == DWARFError::Success)
+    return true;
+  LOG(V1) << "Failed to build unwind tables for pid " << pid << ": " << err;
+  return false;
+}
+
+// Tables are only buffered here and inserted by flush(), a whole process at a
+// time.
+int DWARFUnwindWorker::feed(TableType type,
+                            uint32_t key,
+                            const std::vector<uint8_t> &value)
+{
+  if (type == TableType::Mappings) {
+    // Mappings are keyed by pid and come last, once all tables of the
+    // process have been fed.
+    touch(static_cast<pid_t>(key));
+    last_mapping_ = value;
+    pending_mappings_[key] = value;
+    return 0;
+  }
+  if (live_ && key >= capacity(type)) {
+    tables_full_ = true;
+    return -1;
+  }
+  pending_tables_[type][key] = value;
+  return 0;
+}
+
+uint32_t DWARFUnwindWorker::capacity(TableType type) const
+{
+  switch (type) {
+    case TableType::UnwindTable:
+      return capacity_.tables;
+    case TableType::UnwindEntries:
+      return capacity_.entries;
+    case TableType::Expressions:
+      return capacity_.expressions;
+    case TableType::Mappings:
+      // Bounded by the eviction in touch()
+      break;
+  }
+  return UINT32_MAX;
+}
+
+// The mappings refer to the other tables, so they go last.
+int DWARFUnwindWorker::flush()
+{
+  for (const auto &[type, entries] : pending_tables_) {
+    if (insert(type, entries))
+      return -1;
+  }
+  if (insert(TableType::Mappings, pending_mappings_))
+    return -1;
+  pending_tables_.clear();
+  pending_mappings_.clear();
+  return 0;
+}
+
+int DWARFUnwindWorker::insert(
+    TableType type,
+    const std::map<uint32_t, std::vector<uint8_t>> &entries)
+{
+  const auto &map = bytecode_.getMap(table_map_name(type));
+  std::vector<uint32_t> keys;
+  std::vector<uint8_t> values;
+  for (auto it = entries.begin(); it != entries.end();) {
+    keys.push_back(it->first);
+    values.insert(values.end(), it->second.begin(), it->second.end());
+    ++it;
+    if (values.size() < MAX_BATCH_SIZE && it != entries.end())
+      continue;
+
+    auto ret = map.update_batch(keys.data(), values.data(), keys.size());
+    if (!ret) {
+      LOG(WARNING) << "Failed to add unwind entries: " << ret.takeError();
+      return -1;
+    }
+    keys.clear();
+    values.clear();
+  }
+  return 0;
+}
+
+void DWARFUnwindWorker::touch(pid_t pid)
+{
+  auto it = pids_.find(pid);
+  if (it != pids_.end()) {
+    lru_.splice(lru_.end(), lru_, it->second);
+    return;
+  }
+
+  while (live_ && !lru_.empty() && lru_.size() >= capacity_.pids) {
+    auto victim = std::ranges::find_if(lru_, process_exited);
+    if (victim == lru_.end())
+      victim = lru_.begin();
+    forget(*victim);
+  }
+  pids_[pid] = lru_.insert(lru_.end(), pid);
+}
+
+void DWARFUnwindWorker::forget(pid_t pid)
+{
+  uint32_t key = pid;
+  // Errors are not fatal here: at worst the process keeps stale tables until
+  // the next reset.
+  auto ret = bytecode_.getMap(DWUNWIND_MAPPINGS).delete_elem(&key);
+  if (!ret)
+    LOG(V1) << "Failed to drop unwind mapping: " << ret.takeError();
+  ret = bytecode_.getMap(DWUNWIND_REQUESTED).delete_elem(&key);
+  if (!ret)
+    LOG(V1) << "Failed to clear unwind table request: " << ret.takeError();
+
+  auto it = pids_.find(pid);
+  if (it != pids_.end()) {
+    lru_.erase(it->second);
+    pids_.erase(it);
+  }
+  jit_ranges_.erase(pid);
+}
+
+void DWARFUnwindWorker::reset()
+{
+  while (!lru_.empty())
+    forget(lru_.front());
+  unwind_ = std::make_unique<DWARFUnwind>(
+      [this](TableType t, uint32_t k, const std::vector<uint8_t> &v) {
+        return feed(t, k, v);
+      });
+  unwind_->set_cache_dir(cache_dir_);
+  pending_tables_.clear();
+  pending_mappings_.clear();
+}
+
+} // namespace bpftrace
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bpfbytecode.h"
+#include "dwarf/dwunwind.h"
+
+struct ring_buffer;
+
+namespace bpftrace {
+
+// Number of entries in the unwind maps, on top of the tables of the target
+// processes.
+struct DWARFUnwindCapacity {
+  DWARFUnwindCapacity(uint32_t pids, uint32_t tables);
+
+  uint32_t pids;
+  uint32_t tables;
+  uint32_t entries;
+  uint32_t expressions;
+};
+
+// Builds unwind tables and keeps them up to date while the probes are
+// running.
+//
+// The tables of the target processes are built before the programs are
+// loaded, so that the maps can be sized for them. Afterwards, the BPF unwinder
+// reports processes whose mappings have changed (exec, mmap, dlopen) and, in
+// on-demand mode, processes without tables. The tables of new objects are
+// added and only the mapping table of the reported process is rewritten.
+//
+// Tables are shared: an object file mapped by several processes is parsed
+// once. When there is no room for another process, the tables of exited
+// processes are dropped first, then those of the least recently reported one.
+// When the shared tables are full, all of them are dropped and rebuilt.
+class DWARFUnwindWorker {
+public:
+  DWARFUnwindWorker(const BpfBytecode &bytecode,
+                    DWARFUnwindCapacity capacity,
+                    std::string cache_dir);
+  ~DWARFUnwindWorker();
+
+  DWARFUnwindWorker(const DWARFUnwindWorker &) = delete;
+  DWARFUnwindWorker &operator=(const DWARFUnwindWorker &) = delete;
+
+  // Builds the tables of the target processes. They are kept in memory until
+  // the worker is started.
+  void add_pids(const std::vector<pid_t> &pids);
+
+  // Sizes the unwind maps, before the programs are loaded.
+  int resize_maps();
+
+  // Inserts the tables of the target processes and enables requests from the
+  // unwinder. They are read as part of polling `ringbuf` and handled on a
+  // separate thread. With `on_demand`, tables are also built for processes
+  // which have none.
+  int start(struct ring_buffer *ringbuf, bool on_demand);
+
+private:
+  struct Request {
+    pid_t pid;
+    uint64_t ip;
+  };
+
+  static int handle_request(void *ctx, void *data, size_t size);
+  void run();
+  void build(const Request &request);
+  bool in_jit_range(pid_t pid, uint64_t ip) const;
+  void clear_request(pid_t pid);
+  bool add_pid(pid_t pid);
+  int feed(TableType type, uint32_t key, const std::vector<uint8_t> &value);
+  uint32_t capacity(TableType type) const;
+  int flush();
+  int insert(TableType type,
+             const std::map<uint32_t, std::vector<uint8_t>> &entries);
+  void touch(pid_t pid);
+  void forget(pid_t pid);
+  void reset();
+
+  const BpfBytecode &bytecode_;
+  DWARFUnwindCapacity capacity_;
+  std::string cache_dir_;
+  std::unique_ptr<DWARFUnwind> unwind_;
+  bool on_demand_ = false;
+  bool tables_full_ = false;
+  std::vector<uint8_t> last_mapping_;
+
+  // Tables not inserted yet: those built before the maps exist, then those of
+  // the process being added. They are inserted with batch updates.
+  bool live_ = false;
+  std::map<TableType, std::map<uint32_t, std::vector<uint8_t>>>
+      pending_tables_;
+  std::map<uint32_t, std::vector<uint8_t>> pending_mappings_;
+
+  // Processes with tables, least recently reported first.
+  std::list<pid_t> lru_;
+  std::unordered_map<pid_t, std::list<pid_t>::iterator> pids_;
+  // Address ranges not backed by an object file (e.g. JIT code), per process.
+  std::unordered_map<pid_t, std::vector<std::pair<uint64_t, uint64_t>>>
+      jit_ranges_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Request> queue_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+} // namespace bpftrace
@@ -282,9 +282,13 @@ SizedType GlobalVars::get_sized_type(const std::string &global_var_name,
     return make_rw_type(1, CreateUInt64());
   }
 
-  if (global_var_name == JOIN_BUFFER) {
-    return make_rw_type(1,
-                        CreateArray(resources.join_value_size, CreateInt8()));
+  if (global_var_name == RECURSION_PREVENTION) {
+    return make_rw_type(1, CreateUInt64());
+  }
+
+  if (global_var_name == MAP_ROTATION) {
+    assert(resources.rotated_maps > 0);
+    return make_rw_type(resources.rotated_maps, CreateUInt64());
   }
 
   if (!config.type) {
@@ -321,6 +325,8 @@ void GlobalVars::check_index(const std::string &global_var_name,
     assert(index < resources.variable_buffers);
   } else if (global_var_name == MAP_KEY_BUFFER) {
     assert(index < resources.map_key_buffers);
+  } else if (global_var_name == MAP_ROTATION) {
+    assert(index < resources.rotated_maps);
   }
 }
 
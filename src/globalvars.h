@@ -132,8 +132,9 @@ constexpr std::string_view WRITE_MAP_VALUE_BUFFER = "__bt__write_map_val_buf";
 constexpr std::string_view VARIABLE_BUFFER = "__bt__var_buf";
 constexpr std::string_view MAP_KEY_BUFFER = "__bt__map_key_buf";
 constexpr std::string_view EVENT_LOSS_COUNTER = "__bt__event_loss_counter";
-constexpr std::string_view JOIN_BUFFER = "__bt__join_buf";
+constexpr std::string_view RECURSION_PREVENTION = "__bt__recursion_prevention";
 constexpr std::string_view CHILD_PID = "__bt__child_pid";
+constexpr std::string_view MAP_ROTATION = "__bt__map_rotation";
 
 // Section names
 constexpr std::string_view RO_SECTION_NAME = ".rodata";
@@ -152,7 +153,9 @@ constexpr std::string_view VARIABLE_BUFFER_SECTION_NAME = ".data.var_buf";
 constexpr std::string_view MAP_KEY_BUFFER_SECTION_NAME = ".data.map_key_buf";
 constexpr std::string_view EVENT_LOSS_COUNTER_SECTION_NAME =
     ".data.event_loss_counter";
-constexpr std::string_view JOIN_BUFFER_SECTION_NAME = ".data.join_buf";
+constexpr std::string_view RECURSION_PREVENTION_SECTION_NAME =
+    ".data.recursion_prevention";
+constexpr std::string_view MAP_ROTATION_SECTION_NAME = ".data.map_rotation";
 
 struct GlobalVarConfig {
   std::string section;
@@ -184,6 +187,10 @@ const std::unordered_map<std::string_view, GlobalVarConfig>
       { EVENT_LOSS_COUNTER,
         { .section = std::string(EVENT_LOSS_COUNTER_SECTION_NAME),
           .type = GlobalVarConfig::opt_unsigned } },
+      { RECURSION_PREVENTION,
+        { .section = std::string(RECURSION_PREVENTION_SECTION_NAME) } },
+      { MAP_ROTATION,
+        { .section = std::string(MAP_ROTATION_SECTION_NAME) } },
       { FMT_STRINGS_BUFFER,
         { .section = std::string(FMT_STRINGS_BUFFER_SECTION_NAME) } },
       { ANON_STRUCT_BUFFER,
@@ -200,7 +207,6 @@ const std::unordered_map<std::string_view, GlobalVarConfig>
         { .section = std::string(VARIABLE_BUFFER_SECTION_NAME) } },
       { MAP_KEY_BUFFER,
         { .section = std::string(MAP_KEY_BUFFER_SECTION_NAME) } },
-      { JOIN_BUFFER, { .section = std::string(JOIN_BUFFER_SECTION_NAME) } },
       { CHILD_PID,
         { .section = std::string(RO_SECTION_NAME),
           .type = GlobalVarConfig::opt_unsigned } },
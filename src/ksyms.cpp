@@ -2,6 +2,7 @@
 #include <sstream>
 
 #include "ksyms.h"
+#include "log.h"
 #include "scopeguard.h"
 
 namespace {
@@ -72,6 +73,33 @@ Ksyms::~Ksyms()
 #endif
 }
 
+const symbols::Kallsyms *Ksyms::kallsyms() const
+{
+  std::call_once(kallsyms_once_, [this] {
+    auto table = symbols::Kallsyms::open();
+    if (table) {
+      kallsyms_.emplace(std::move(*table));
+    } else {
+      LOG(WARNING) << "Unable to load kernel symbols: " << table.takeError();
+    }
+  });
+  return kallsyms_ ? &*kallsyms_ : nullptr;
+}
+
+std::string Ksyms::resolve_kallsyms(const symbols::Kallsyms &table,
+                                    uint64_t addr,
+                                    bool show_offset)
+{
+  auto sym = table.lookup(addr);
+  if (!sym)
+    return stringify_addr(addr);
+
+  std::string symbol(sym->name);
+  if (show_offset)
+    symbol += "+" + std::to_string(sym->offset);
+  return symbol;
+}
+
 std::string Ksyms::resolve_bcc(uint64_t addr, bool show_offset)
 {
   struct bcc_symbol ksym;
@@ -172,6 +200,21 @@ std::vector<std::string> Ksyms::resolve(uint64_t addr,
                                         [[maybe_unused]] bool perf_mode,
                                         [[maybe_unused]] bool show_debug_info)
 {
+#ifdef HAVE_BLAZESYM
+  // Only blazesym can report inlined functions and source locations. As
+  // show_debug_info defaults to true in blazesym builds, the kallsyms table is
+  // only used there once it is turned off.
+  if (config_.use_blazesym && show_debug_info) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resolve_blazesym(addr, show_offset, perf_mode, show_debug_info);
+  }
+#endif
+  if (const auto *table = kallsyms())
+    return std::vector<std::string>{ resolve_kallsyms(*table,
+                                                      addr,
+                                                      show_offset) };
+
+  std::lock_guard<std::mutex> lock(mutex_);
 #ifdef HAVE_BLAZESYM
   if (config_.use_blazesym)
     return resolve_blazesym(addr, show_offset, perf_mode, show_debug_info);
@@ -179,4 +222,11 @@ std::vector<std::string> Ksyms::resolve(uint64_t addr,
   return std::vector<std::string>{ resolve_bcc(addr, show_offset) };
 }
 
+uint64_t Ksyms::resolve_name(const std::string &name) const
+{
+  if (const auto *table = kallsyms())
+    return table->address(name);
+  return 0;
+}
+
 } // namespace bpftrace
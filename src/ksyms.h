@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <mutex>
 #include <optional>
 #include <string>
 
@@ -9,10 +10,12 @@
 #endif
 
 #include "config.h"
+#include "symbols/kallsyms.h"
 
 namespace bpftrace {
 class Config;
 
+// Resolves kernel addresses. This may be used from several threads.
 class Ksyms {
 public:
   Ksyms(const Config &config);
@@ -25,10 +28,21 @@ public:
                                    bool perf_mode,
                                    bool show_debug_info);
 
+  // Returns the address of the kernel symbol `name`, or 0 if not found.
+  uint64_t resolve_name(const std::string &name) const;
+
 private:
   const Config &config_;
   void *ksyms_{ nullptr };
 
+  // Loaded on first use; std::nullopt if /proc/kallsyms could not be read, in
+  // which case addresses are resolved through blazesym or bcc.
+  const symbols::Kallsyms *kallsyms() const;
+  mutable std::optional<symbols::Kallsyms> kallsyms_;
+  mutable std::once_flag kallsyms_once_;
+  // Guards the bcc and blazesym symbolizers.
+  std::mutex mutex_;
+
 #ifdef HAVE_BLAZESYM
   blaze_symbolizer *symbolizer_{ nullptr };
 
@@ -42,6 +56,9 @@ private:
                                             bool show_debug_info);
 #endif
 
+  std::string resolve_kallsyms(const symbols::Kallsyms &table,
+                               uint64_t addr,
+                               bool show_offset);
   std::string resolve_bcc(uint64_t addr, bool show_offset);
 };
 } // namespace bpftrace
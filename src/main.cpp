@@ -23,6 +23,7 @@
 #include "ast/passes/codegen_llvm.h"
 #include "ast/passes/control_flow_analyser.h"
 #include "ast/passes/macro_expansion.h"
+#include "ast/passes/map_fusion.h"
 #include "ast/passes/map_sugar.h"
 #include "ast/passes/named_param.h"
 #include "ast/passes/parse_passes.h"
@@ -34,6 +35,7 @@
 #include "ast/passes/types/pre_type_check.h"
 #include "ast/passes/types/type_resolver.h"
 #include "ast/passes/types/type_system.h"
+#include "ast/passes/unroll_lowering.h"
 #include "benchmark.h"
 #include "bpffeature.h"
 #include "bpftrace.h"
@@ -145,7 +147,8 @@ void usage(std::ostream& out)
   out << std::endl;
   out << "    -o, --output FILE" << std::endl;
   out << "                   redirect bpftrace output to FILE" << std::endl;
-  out << "    -f FORMAT      output format ('text', 'json')" << std::endl;
+  out << "    -f FORMAT      output format ('text', 'json', 'folded')"
+      << std::endl;
   out << "    -B MODE        output buffering mode ('line', 'full', 'none')" << std::endl;
   out << "    -q, --quiet    keep messages quiet" << std::endl;
   out << "    -k, --warnings emit a warning when probe read helpers return an error" << std::endl;
@@ -375,11 +378,14 @@ struct Args {
 
 void CreateDynamicPasses(std::function<void(ast::Pass&& pass)> add)
 {
+  add(ast::CreateUnrollLoweringPass());
   add(ast::CreateClangBuildPass());
   add(ast::CreateTypeSystemPass());
   add(ast::CreatePreTypeCheckPass());
   add(ast::CreateTypeResolverPass());
+  add(ast::CreateRecursionCheckPass());
   add(ast::CreateResourcePass());
+  add(ast::CreateMapFusionPass());
 }
 
 void CreateAotPasses(std::function<void(ast::Pass&& pass)> add)
@@ -389,7 +395,9 @@ void CreateAotPasses(std::function<void(ast::Pass&& pass)> add)
   add(ast::CreateTypeSystemPass());
   add(ast::CreatePreTypeCheckPass());
   add(ast::CreateTypeResolverPass());
+  add(ast::CreateRecursionCheckPass());
   add(ast::CreateResourcePass());
+  add(ast::CreateMapFusionPass());
 }
 
 ast::Pass printPass(const std::string& name)
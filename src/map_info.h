@@ -87,13 +87,29 @@ struct MapInfo {
   int max_entries = -1;
   bpf_map_type bpf_type = BPF_MAP_TYPE_HASH;
   bool is_scalar = false;
+  // Set when the map has no BPF map of its own and its values are stored at
+  // `fused_offset` bytes into the values of the named fused map instead.
+  std::string fused_map;
+  size_t fused_offset = 0;
+  // Set for maps passed to rotate(), to the index of the global flag which
+  // selects which of their two BPF maps probes update.
+  int rotation_index = -1;
 
 private:
   friend class cereal::access;
   template <typename Archive>
   void serialize(Archive &archive)
   {
-    archive(key_type, value_type, detail, id, max_entries, bpf_type, is_scalar);
+    archive(key_type,
+            value_type,
+            detail,
+            id,
+            max_entries,
+            bpf_type,
+            is_scalar,
+            fused_map,
+            fused_offset,
+            rotation_index);
   }
 };
 
@@ -80,6 +80,14 @@ public:
     error_count++;
     nested_.runtime_error(retcode, info);
   }
+  void probe_stats(const std::vector<ProbeStats> &stats) override
+  {
+    nested_.probe_stats(stats);
+  }
+  void symbol_cache_stats(const SymbolCacheStats &stats) override
+  {
+    nested_.symbol_cache_stats(stats);
+  }
 
   size_t error_count = 0;
   size_t lost_events_count = 0;
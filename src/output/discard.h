@@ -59,6 +59,14 @@ public:
                      [[maybe_unused]] const RuntimeErrorInfo &info) override
   {
   }
+  void probe_stats(
+      [[maybe_unused]] const std::vector<ProbeStats> &stats) override
+  {
+  }
+  void symbol_cache_stats(
+      [[maybe_unused]] const SymbolCacheStats &stats) override
+  {
+  }
 };
 
 } // namespace bpftrace::output
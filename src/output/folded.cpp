@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <optional>
+#include <sstream>
+
+#include "output/folded.h"
+#include "util/strings.h"
+
+namespace bpftrace::output {
+
+static std::optional<uint64_t> count_value(const Value &value)
+{
+  if (!std::holds_alternative<Primitive>(value.variant))
+    return std::nullopt;
+  const auto &p = std::get<Primitive>(value.variant);
+  if (std::holds_alternative<uint64_t>(p.variant))
+    return std::get<uint64_t>(p.variant);
+  if (std::holds_alternative<int64_t>(p.variant))
+    return static_cast<uint64_t>(std::get<int64_t>(p.variant));
+  return std::nullopt;
+}
+
+// Drops the offset from a frame, e.g. "do_mmap+1" or "spin+37@file.c:14".
+static std::string strip_offset(const std::string &frame)
+{
+  for (auto plus = frame.find('+'); plus != std::string::npos;
+       plus = frame.find('+', plus + 1)) {
+    auto end = frame.find_first_not_of("0123456789", plus + 1);
+    if (plus + 1 == frame.size() || end == plus + 1)
+      continue;
+    if (end == std::string::npos)
+      return frame.substr(0, plus);
+    if (frame[end] == ' ' || frame[end] == '@')
+      return frame.substr(0, plus) + frame.substr(end);
+  }
+  return frame;
+}
+
+// Stacks are formatted with one indented frame per line, innermost first.
+static std::string fold_stack(const std::string &stack)
+{
+  std::vector<std::string> frames;
+  for (auto &line : util::split_string(stack, '\n', true)) {
+    util::trim(line);
+    if (!line.empty())
+      frames.emplace_back(strip_offset(line));
+  }
+  std::ranges::reverse(frames);
+  return util::str_join(frames, ";");
+}
+
+static std::string fold_key(const Primitive &key, const SizedType &key_type)
+{
+  std::vector<Primitive> parts;
+  std::vector<bool> part_is_stack;
+  if (key_type.IsTupleTy() &&
+      std::holds_alternative<Primitive::Tuple>(key.variant)) {
+    parts = std::get<Primitive::Tuple>(key.variant).values;
+    for (const auto &field : key_type.GetFields())
+      part_is_stack.push_back(field.type.IsStack());
+  } else {
+    parts.push_back(key);
+    part_is_stack.push_back(key_type.IsStack());
+  }
+
+  std::vector<std::string> fields;
+  std::vector<std::string> stacks;
+  for (size_t i = 0; i < parts.size(); i++) {
+    const auto &part = parts[i];
+    if (i < part_is_stack.size() && part_is_stack[i] &&
+        std::holds_alternative<std::string>(part.variant)) {
+      stacks.emplace_back(fold_stack(std::get<std::string>(part.variant)));
+    } else {
+      std::stringstream ss;
+      ss << part;
+      fields.emplace_back(ss.str());
+    }
+  }
+  fields.insert(fields.end(), stacks.rbegin(), stacks.rend());
+  return util::str_join(fields, ";");
+}
+
+void FoldedOutput::map(const std::string &name, const Value &value)
+{
+  const auto *m = std::get_if<Value::OrderedMap>(&value.variant);
+  auto info = maps_info_.find(name);
+  if (!m || info == maps_info_.end() ||
+      !std::ranges::all_of(m->values, [](const auto &entry) {
+        return count_value(entry.second).has_value();
+      })) {
+    err_text_.map(name, value);
+    return;
+  }
+
+  for (const auto &[key, count] : m->values) {
+    out_ << fold_key(key, info->second.key_type) << " "
+         << *count_value(count) << std::endl;
+  }
+}
+
+} // namespace bpftrace::output
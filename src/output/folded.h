@@ -0,0 +1,40 @@
+#pragma once
+
+#include <iostream>
+#include <map>
+#include <string>
+
+#include "map_info.h"
+#include "output/text.h"
+
+namespace bpftrace::output {
+
+// Prints maps counting stacks in the folded format read by flame graph tools:
+// one line per key, with the frames of the key's stacks separated by `;` and
+// followed by the count. Frames are printed without their offsets, so that
+// samples from the same function are merged.
+//
+// The other key fields (e.g. `comm`) come first, then the stacks in reverse
+// order, each from its outermost frame. So `@[kstack, ustack, comm]` gives
+// "comm;user frames;kernel frames count". Stacks are told apart by the map's
+// key type. Maps whose values are not counts are printed as text to `err`, so
+// that `out` only holds folded stacks; all other output is printed as text.
+class FoldedOutput : public TextOutput {
+public:
+  explicit FoldedOutput(const std::map<std::string, MapInfo> &maps_info,
+                        std::ostream &out = std::cout,
+                        std::ostream &err = std::cerr)
+      : TextOutput(out, err),
+        maps_info_(maps_info),
+        out_(out),
+        err_text_(err, err) {};
+
+  void map(const std::string &name, const Value &value) override;
+
+private:
+  const std::map<std::string, MapInfo> &maps_info_;
+  std::ostream &out_;
+  TextOutput err_text_;
+};
+
+} // namespace bpftrace::output
@@ -526,6 +526,32 @@ void JsonOutput::benchmark_result(const std::vector<std::string> &all_benches,
   emit_data(out_, "benchmark_result", all_benches[index], result);
 }
 
+void JsonOutput::probe_stats(const std::vector<ProbeStats> &stats)
+{
+  Primitive::Array probes;
+  for (const auto &s : stats) {
+    Primitive::Record probe;
+    probe.fields.emplace_back("probe", s.probe);
+    probe.fields.emplace_back("events", s.events);
+    probe.fields.emplace_back("run_time_ns",
+                              static_cast<uint64_t>(s.run_time.count()));
+    probe.fields.emplace_back("events_per_sec", s.events_per_sec());
+    probe.fields.emplace_back("ns_per_event", s.ns_per_event());
+    probes.values.emplace_back(std::move(probe));
+  }
+  emit_data(out_, "probe_stats", std::nullopt, probes);
+}
+
+void JsonOutput::symbol_cache_stats(const SymbolCacheStats &stats)
+{
+  Primitive::Record record;
+  record.fields.emplace_back("hits", stats.hits);
+  record.fields.emplace_back("misses", stats.misses);
+  record.fields.emplace_back("evictions", stats.evictions);
+  record.fields.emplace_back("entries", stats.entries);
+  emit_data(out_, "symbol_cache_stats", std::nullopt, record);
+}
+
 void JsonOutput::end()
 {
   // Nothing emitted.
@@ -23,6 +23,8 @@ public:
   void lost_events(uint64_t lost) override;
   void attached_probes(uint64_t num_probes) override;
   void runtime_error(int retcode, const RuntimeErrorInfo &info) override;
+  void probe_stats(const std::vector<ProbeStats> &stats) override;
+  void symbol_cache_stats(const SymbolCacheStats &stats) override;
   void end() override;
 
   void test_result(const std::vector<std::string> &all_tests,
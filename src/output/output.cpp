@@ -33,6 +33,21 @@ bool Primitive::Record::operator==(const Record &other) const
   return fields == other.fields;
 }
 
+double ProbeStats::events_per_sec() const
+{
+  if (period.count() == 0)
+    return 0;
+  return static_cast<double>(events) * 1e9 /
+         static_cast<double>(period.count());
+}
+
+double ProbeStats::ns_per_event() const
+{
+  if (events == 0)
+    return 0;
+  return static_cast<double>(run_time.count()) / static_cast<double>(events);
+}
+
 std::ostream &operator<<(std::ostream &out, const Primitive &p)
 {
   TextOutput output(out);
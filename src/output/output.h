@@ -129,6 +129,26 @@ struct Value {
   Variant variant;
 };
 
+// Runtime statistics for a single probe, as reported by the kernel when BPF
+// stats are enabled. Covers the period since the previous report.
+struct ProbeStats {
+  std::string probe;
+  uint64_t events = 0;
+  std::chrono::nanoseconds run_time{ 0 };
+  std::chrono::nanoseconds period{ 0 };
+
+  double events_per_sec() const;
+  double ns_per_event() const;
+};
+
+// Lookups in the user symbol caches since tracing started.
+struct SymbolCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  uint64_t entries = 0;
+};
+
 // Abstract class for output.
 //
 // This should be overriden by individual implementations.
@@ -161,6 +181,8 @@ public:
   virtual void lost_events(uint64_t lost) = 0;
   virtual void attached_probes(uint64_t num_probes) = 0;
   virtual void runtime_error(int retcode, const RuntimeErrorInfo& info) = 0;
+  virtual void probe_stats(const std::vector<ProbeStats>& stats) = 0;
+  virtual void symbol_cache_stats(const SymbolCacheStats& stats) = 0;
 
   // Testing hooks.
   virtual void test_result(const std::vector<std::string>& all_tests,
@@ -737,6 +737,51 @@ void TextOutput::benchmark_result(const std::vector<std::string> &all_benches,
   out_ << std::endl;
 }
 
+void TextOutput::probe_stats(const std::vector<ProbeStats> &stats)
+{
+  const std::string PROBE = "Probe";
+  const std::string EVENTS = "Events";
+  const std::string EVENTS_PER_SEC = "Events/s";
+  const std::string NS_PER_EVENT = "ns/event";
+  size_t longest_name = std::max(static_cast<size_t>(40), PROBE.size());
+  size_t column_width = 15;
+
+  for (const auto &s : stats) {
+    longest_name = std::max(longest_name, s.probe.size());
+  }
+
+  out_ << std::left << std::setw(longest_name + 1) << std::setfill(' ')
+       << PROBE;
+  out_ << std::left << std::setw(column_width) << EVENTS;
+  out_ << std::left << std::setw(column_width) << EVENTS_PER_SEC;
+  out_ << std::left << NS_PER_EVENT;
+  out_ << std::endl;
+  out_ << std::string(longest_name + 1 + (2 * column_width) +
+                          NS_PER_EVENT.size(),
+                      '-')
+       << std::endl;
+
+  for (const auto &s : stats) {
+    out_ << std::left << std::setw(longest_name + 1) << s.probe;
+    out_ << std::left << std::setw(column_width) << s.events;
+    out_ << std::left << std::setw(column_width) << std::fixed
+         << std::setprecision(1) << s.events_per_sec();
+    out_ << std::left << std::fixed << std::setprecision(1)
+         << s.ns_per_event();
+    out_ << std::endl;
+  }
+  out_.unsetf(std::ios_base::floatfield);
+  out_ << std::setprecision(6) << std::endl;
+}
+
+void TextOutput::symbol_cache_stats(const SymbolCacheStats &stats)
+{
+  out_ << "User symbol cache: " << stats.hits << " hits, " << stats.misses
+       << " misses, " << stats.evictions << " evictions, " << stats.entries
+       << " entries" << std::endl
+       << std::endl;
+}
+
 void TextOutput::end()
 {
   out_ << std::endl;
@@ -118,6 +118,7 @@ struct Probe {
   uint64_t address = 0;
   uint64_t func_offset = 0;
   uint64_t bpf_prog_id = 0;
+  int filter_pid = 0; // for uprobes, pid from a predicate
   std::set<std::string> funcs;
   bool is_session = false;
 
@@ -140,6 +141,7 @@ private:
             mode,
             address,
             func_offset,
+            filter_pid,
             funcs);
   }
 };
@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <istream>
 #include <ostream>
+#include <set>
 #include <string>
 #include <tuple>
 #include <unordered_set>
@@ -189,11 +190,8 @@ public:
   std::unordered_map<ast::Call *, size_t> non_map_print_args_id_map;
   std::vector<std::tuple<std::string, long>> skboutput_args_;
   std::unordered_map<ast::Call *, size_t> skboutput_args_id_map;
-  // While max fmtstring args size is not used at runtime, the size
-  // calculation requires taking into account struct alignment semantics,
-  // and that is tricky enough that we want to minimize repetition of
-  // such logic in the codebase. So keep it in resource analysis
-  // rather than duplicating it in CodegenResources.
+  // Required for sizing of the scratch buffer used to build format string
+  // records which carry strings (see AsyncEvent::StringRef).
   uint64_t max_fmtstring_args_size = 0;
 
   // Required for sizing of tuple/record scratch buffer
@@ -220,7 +218,8 @@ public:
   size_t map_key_buffers = 0;
   size_t max_map_key_size = 0;
 
-  size_t join_value_size = 0;
+  // Required for sizing of the flags selecting the BPF maps of rotated maps
+  size_t rotated_maps = 0;
 
   // Async argument metadata that codegen creates. Ideally ResourceAnalyser
   // pass should be collecting this, but it's complex to move the logic.
@@ -231,9 +230,14 @@ public:
 
   // Map metadata
   std::map<std::string, MapInfo> maps_info;
+  // Maps holding the values of several co-keyed aggregation maps, which are
+  // then accessed with a single lookup (see MapFusion pass)
+  std::map<std::string, MapInfo> fused_maps_info;
   globalvars::GlobalVars global_vars;
   bool using_skboutput = false;
   bool needs_elapsed_map = false;
+  // Stack types whose frames are stored in a stack table (see intern_stacks)
+  std::set<StackType> interned_stacks;
 
   // Probe metadata
   //
@@ -273,8 +277,10 @@ private:
             printf_args,
             probe_ids,
             maps_info,
+            fused_maps_info,
             global_vars,
             using_skboutput,
+            interned_stacks,
             probes,
             signal_probes,
             begin_probes,
@@ -9,6 +9,7 @@
 
 #include "log.h"
 #include "output/buffer_mode.h"
+#include "output/folded.h"
 #include "output/json.h"
 #include "output/text.h"
 #include "run_bpftrace.h"
@@ -216,9 +217,12 @@ int run_bpftrace(BPFtrace &bpftrace,
     output = std::make_unique<output::TextOutput>(*os);
   } else if (output_format == "json") {
     output = std::make_unique<output::JsonOutput>(*os);
+  } else if (output_format == "folded") {
+    output = std::make_unique<output::FoldedOutput>(
+        bpftrace.resources.maps_info, *os);
   } else {
     LOG(ERROR) << "Invalid output format \"" << output_format << "\"\n"
-               << "Valid formats: 'text', 'json'";
+               << "Valid formats: 'text', 'json', 'folded'";
     return 1;
   }
 
@@ -35,6 +35,9 @@
  *     revert to frame-based stack unwinding.
  *     The mapping table maps the IP (vma) to the (adjusted) elf-file offset,
  *     and gives the offsetmap id and start position in the offsetmap.
+ *     If the process has exec'd since the mapping table was built, or the
+ *     IP is outside of all known vmas (e.g. a library loaded with dlopen),
+ *     user space is asked to update the mapping table of the process.
  *  2) An offsetmap maps from a file offset to the cft entry, which contains
  *     the unwind ruleset for that location. Only the cft entry id is stored, as
  *     a ruleset can occur many times. This makes the representation very
@@ -53,8 +56,10 @@
 #pragma pack(1)
 struct mapping {
   u64 nentries;
+  u64 start_code;  /* mm->start_code when built, 0 if unknown */
   struct map_entry {
     u64 vma_start;
+    u64 vma_end;
     u64 offset;
     u32 offsetmap_id;
     u32 start_in_map;
@@ -234,6 +239,72 @@ struct {
   __type(value, struct dwunwind_state);
 } dwunwind_state_scratch SEC(".maps");
 
+/*
+ * processes without tables (on-demand mode only) and processes whose
+ * mappings have changed are reported to user space, which builds the
+ * tables and inserts them while the probes are running
+ */
+struct dwunwind_request {
+  u32 tgid;
+  u32 pad;
+  u64 ip;
+};
+
+struct {
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, u32);
+  __type(value, u32);
+} dwunwind_on_demand SEC(".maps");
+
+struct {
+  __uint(type, BPF_MAP_TYPE_RINGBUF);
+  __uint(max_entries, 65536);
+} dwunwind_requests SEC(".maps");
+
+/* processes reported and not yet handled by user space */
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 4096);
+  __type(key, u32);
+  __type(value, u8);
+} dwunwind_requested SEC(".maps");
+
+/*
+ * Ask user space for the tables of a process, once until the request
+ * has been handled. Tables for processes without any (`unknown`) are
+ * only built in on-demand mode, updates are also made for the target
+ * processes. Returns false if the request can't be handled.
+ */
+static bool
+request_tables(u32 tgid, u64 ip, bool unknown)
+{
+  u32 zero = 0;
+  u32 *mode = bpf_map_lookup_elem(&dwunwind_on_demand, &zero);
+  if (mode == NULL || *mode == DWUNWIND_REQUESTS_DISABLED)
+    return false;
+  if (unknown && *mode != DWUNWIND_REQUESTS_ALL)
+    return false;
+
+  u8 one = 1;
+  if (bpf_map_update_elem(&dwunwind_requested, &tgid, &one, BPF_NOEXIST) != 0)
+    return true;  /* already requested */
+
+  struct dwunwind_request *req =
+    bpf_ringbuf_reserve(&dwunwind_requests, sizeof(*req), 0);
+  if (req == NULL) {
+    /* ring is full, try again next time */
+    bpf_map_delete_elem(&dwunwind_requested, &tgid);
+    return true;
+  }
+  req->tgid = tgid;
+  req->pad = 0;
+  req->ip = ip;
+  bpf_ringbuf_submit(req, 0);
+  INFO("requested tables for tgid %d ip %lx", tgid, ip);
+  return true;
+}
+
 
 static struct map_entry *
 find_mapping(struct mapping *m, u64 ip)
@@ -648,6 +719,7 @@ unwind_step(void)
   struct mapping *m = bpf_map_lookup_elem(&dwunwind_mappings, &s->tgid);
   if (m == NULL) {
     INFO("no mapping found");
+    request_tables(s->tgid, 0, true);
     return -1;
   }
 
@@ -668,8 +740,9 @@ unwind_step(void)
   regs_v_n = regs_v_o;
 
   struct map_entry *me = find_mapping(m, regs_o[RIP]);
-  if (me == NULL) {
+  if (me == NULL || regs_o[RIP] >= me->vma_end) {
     LOG("no map entry found");
+    request_tables(s->tgid, regs_o[RIP], false);
     return -1;
   }
 
@@ -856,9 +929,12 @@ long __ustack_dwunwind(void *ctx, u64 *buf, u32 buf_size, u32 tgid)
 
   u64 *buf_start = buf;
 
-  /* test if we have a mapping for this pid */
-  void *m = bpf_map_lookup_elem(&dwunwind_mappings, &tgid);
-  if (m == NULL)
+  /*
+   * test if we have a mapping for this pid. Without one, in on-demand
+   * mode only the current frame is known until the tables are loaded
+   */
+  struct mapping *m = bpf_map_lookup_elem(&dwunwind_mappings, &tgid);
+  if (m == NULL && !request_tables(tgid, 0, true))
     return -2;
 
   task = bpf_get_current_task_btf();
@@ -872,6 +948,13 @@ long __ustack_dwunwind(void *ctx, u64 *buf, u32 buf_size, u32 tgid)
     LOG("no mm struct");
     return 0;
   }
+  u64 start_code = BPF_CORE_READ(mm, start_code);
+  if (m != NULL && m->start_code != 0 && m->start_code != start_code) {
+    INFO("process has exec'd, mapping is stale");
+    request_tables(tgid, 0, false);
+    m = NULL;
+  }
+
   u64 stack_top = BPF_CORE_READ(mm, start_stack);
   INFO("start stack: %lx", stack_top);
 
@@ -935,6 +1018,8 @@ long __ustack_dwunwind(void *ctx, u64 *buf, u32 buf_size, u32 tgid)
   }
 
   *buf++ = s->regs_map[RIP];
+  if (m == NULL)
+    goto done;
   int nframes = buf_size / sizeof(u64);
   for (int i = 1; i < MAX_STACK_FRAMES && i < nframes; ++i) {
     int ret;
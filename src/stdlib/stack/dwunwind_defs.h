@@ -3,6 +3,13 @@
 
 // NOLINTBEGIN(modernize-macro-to-enum) - shared with BPF C code
 #define MAX_MAPPINGS 1000
+#define MAPPING_HEADER_SIZE 16 // nentries, start_code
+#define MAPPING_ENTRY_SIZE 32
+
+// Values of the dwunwind_on_demand map
+#define DWUNWIND_REQUESTS_DISABLED 0
+#define DWUNWIND_REQUESTS_UPDATES 1 // only for processes with tables
+#define DWUNWIND_REQUESTS_ALL 2
 #define NUM_REGISTERS 17 // 16 + RIP
 
 #define MAX_EXPR_INSTRUCTIONS 32
@@ -0,0 +1,55 @@
+#include <algorithm>
+
+#include "symbolization_worker.h"
+
+namespace bpftrace {
+
+SymbolizationWorker::SymbolizationWorker(size_t jobs)
+    : jobs_(std::max<size_t>(jobs, 1))
+{
+}
+
+SymbolizationWorker::~SymbolizationWorker()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    queue_.clear();
+  }
+  cv_.notify_all();
+  for (auto &thread : threads_)
+    thread.join();
+}
+
+std::future<std::string> SymbolizationWorker::submit(
+    std::function<std::string()> job)
+{
+  std::packaged_task<std::string()> task(std::move(job));
+  auto result = task.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(std::move(task));
+    if (threads_.size() < jobs_ && threads_.size() < queue_.size())
+      threads_.emplace_back(&SymbolizationWorker::run, this);
+  }
+  cv_.notify_one();
+  return result;
+}
+
+void SymbolizationWorker::run()
+{
+  while (true) {
+    std::packaged_task<std::string()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (stop_)
+        return;
+      task = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    task();
+  }
+}
+
+} // namespace bpftrace
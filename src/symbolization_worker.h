@@ -0,0 +1,40 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bpftrace {
+
+// Runs symbolization jobs on a pool of background threads, so that symbols
+// can be resolved ahead of the output that needs them.
+//
+// Threads are started with the first job. Jobs that have not started when the
+// worker is destroyed are dropped, and their futures report a broken promise.
+class SymbolizationWorker {
+public:
+  explicit SymbolizationWorker(size_t jobs);
+  ~SymbolizationWorker();
+
+  SymbolizationWorker(const SymbolizationWorker &) = delete;
+  SymbolizationWorker &operator=(const SymbolizationWorker &) = delete;
+
+  std::future<std::string> submit(std::function<std::string()> job);
+
+private:
+  void run();
+
+  size_t jobs_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::packaged_task<std::string()>> queue_;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+};
+
+} // namespace bpftrace
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <unordered_map>
+
+#include "symbols/kallsyms.h"
+
+namespace bpftrace::symbols {
+
+static std::optional<uint64_t> parse_hex(std::string_view str)
+{
+  if (str.starts_with("0x"))
+    str.remove_prefix(2);
+  uint64_t value = 0;
+  auto [ptr, ec] = std::from_chars(
+      str.data(), str.data() + str.size(), value, 16);
+  if (ec != std::errc() || ptr != str.data() + str.size())
+    return std::nullopt;
+  return value;
+}
+
+// Splits off the next field of `line`, separated by spaces or tabs.
+static std::string_view next_field(std::string_view &line)
+{
+  auto start = line.find_first_not_of(" \t");
+  if (start == std::string_view::npos) {
+    line = {};
+    return {};
+  }
+  line.remove_prefix(start);
+  auto end = std::min(line.find_first_of(" \t"), line.size());
+  auto field = line.substr(0, end);
+  line.remove_prefix(end);
+  return field;
+}
+
+Result<Kallsyms> Kallsyms::open(const std::string &kallsyms_path,
+                                const std::string &modules_path)
+{
+  std::ifstream kallsyms(kallsyms_path);
+  if (kallsyms.fail())
+    return make_error<SystemError>("Error reading " + kallsyms_path);
+
+  // Without modules (or without access to their addresses) the table is
+  // still usable, just less strict for module addresses.
+  std::ifstream modules(modules_path);
+  return parse(kallsyms, modules);
+}
+
+Kallsyms Kallsyms::parse(std::istream &kallsyms, std::istream &modules)
+{
+  Kallsyms table;
+  table.modules_.push_back(Module{ .name = "vmlinux" });
+
+  std::unordered_map<std::string, uint32_t> module_ids;
+  struct Symbol {
+    uint64_t addr;
+    Entry entry;
+  };
+  std::vector<Symbol> symbols;
+
+  // /proc/kallsyms format: addr type name [module]
+  for (std::string line; std::getline(kallsyms, line);) {
+    std::string_view rest = line;
+    auto addr = parse_hex(next_field(rest));
+    auto type = next_field(rest);
+    auto name = next_field(rest);
+    auto module = next_field(rest);
+    // Addresses read as zero when kernel pointers are restricted.
+    if (!addr || *addr == 0 || type.empty() || name.empty())
+      continue;
+
+    uint32_t module_id = 0;
+    if (module.size() > 2 && module.front() == '[' && module.back() == ']') {
+      module = module.substr(1, module.size() - 2);
+      auto [it, inserted] = module_ids.try_emplace(std::string(module),
+                                                   table.modules_.size());
+      if (inserted)
+        table.modules_.push_back(Module{ .name = std::string(module) });
+      module_id = it->second;
+    }
+
+    symbols.push_back(Symbol{
+        .addr = *addr,
+        .entry = { .name = static_cast<uint32_t>(table.names_.size()),
+                   .module = module_id } });
+    table.names_.append(name);
+    table.names_.push_back('\0');
+  }
+
+  // /proc/modules format: name size refcount deps state addr
+  for (std::string line; std::getline(modules, line);) {
+    std::string_view rest = line;
+    auto name = next_field(rest);
+    auto size = next_field(rest);
+    next_field(rest);
+    next_field(rest);
+    next_field(rest);
+    auto start = parse_hex(next_field(rest));
+    uint64_t size_value = 0;
+    if (std::from_chars(size.data(), size.data() + size.size(), size_value)
+            .ec != std::errc())
+      continue;
+    auto it = module_ids.find(std::string(name));
+    if (it == module_ids.end() || !start || *start == 0)
+      continue;
+    table.modules_[it->second].end = *start + size_value;
+  }
+
+  table.by_name_.reserve(symbols.size());
+  for (const auto &sym : symbols)
+    table.by_name_.emplace_back(sym.entry.name, sym.addr);
+  std::ranges::stable_sort(table.by_name_, {}, [&](const auto &sym) {
+    return table.name(sym.first);
+  });
+
+  // /proc/kallsyms is mostly, but not entirely, sorted. Where several symbols
+  // share an address, the first one listed wins the address lookup.
+  std::ranges::stable_sort(symbols, {}, &Symbol::addr);
+  auto [first, last] = std::ranges::unique(symbols, {}, &Symbol::addr);
+  symbols.erase(first, last);
+
+  table.addrs_.reserve(symbols.size());
+  table.entries_.reserve(symbols.size());
+  for (const auto &sym : symbols) {
+    table.addrs_.push_back(sym.addr);
+    table.entries_.push_back(sym.entry);
+  }
+  return table;
+}
+
+std::string_view Kallsyms::name(uint32_t offset) const
+{
+  return { names_.data() + offset };
+}
+
+std::optional<KernelSymbol> Kallsyms::lookup(uint64_t addr) const
+{
+  if (addrs_.empty() || addr < addrs_.front())
+    return std::nullopt;
+
+  // Find the last address that is <= addr. The loop has a fixed trip count
+  // for a given table size and the comparison compiles to a conditional move,
+  // so there are no mispredicted branches on the way down.
+  const uint64_t *base = addrs_.data();
+  size_t n = addrs_.size();
+  while (n > 1) {
+    size_t half = n / 2;
+    base = (base[half] <= addr) ? base + half : base;
+    n -= half;
+  }
+
+  const auto &entry = entries_[base - addrs_.data()];
+  const auto &module = modules_[entry.module];
+  if (module.end != 0 && addr >= module.end)
+    return std::nullopt;
+
+  return KernelSymbol{
+    .name = name(entry.name),
+    .module = module.name,
+    .offset = addr - *base,
+  };
+}
+
+uint64_t Kallsyms::address(std::string_view sym_name) const
+{
+  auto by_name = [&](const auto &sym) { return name(sym.first); };
+  auto it = std::ranges::lower_bound(by_name_, sym_name, {}, by_name);
+  if (it == by_name_.end() || name(it->first) != sym_name)
+    return 0;
+  return it->second;
+}
+
+} // namespace bpftrace::symbols
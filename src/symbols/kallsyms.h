@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "util/result.h"
+
+namespace bpftrace::symbols {
+
+// A kernel symbol found by `Kallsyms::lookup`. The views are valid for the
+// lifetime of the table.
+struct KernelSymbol {
+  std::string_view name;
+  // "vmlinux" for symbols of the kernel image itself.
+  std::string_view module;
+  uint64_t offset;
+};
+
+// Sorted in-memory copy of /proc/kallsyms, along with the address ranges of
+// loaded modules from /proc/modules so that addresses past the end of a
+// module are not attributed to its last symbol.
+//
+// The table is built once and lookups do not allocate, so whole kernel stacks
+// can be symbolized without going through the file or a library per address.
+class Kallsyms {
+public:
+  static Result<Kallsyms> open(const std::string &kallsyms_path =
+                                   "/proc/kallsyms",
+                               const std::string &modules_path =
+                                   "/proc/modules");
+  static Kallsyms parse(std::istream &kallsyms, std::istream &modules);
+
+  // Returns the symbol containing `addr`, i.e. the closest symbol at or below
+  // `addr` within the same module.
+  std::optional<KernelSymbol> lookup(uint64_t addr) const;
+
+  // Returns the address of the symbol named `name`, or 0 if there is none.
+  // Aliases, i.e. symbols that share their address with another one, are
+  // found too. If several symbols have the same name, the first one listed
+  // wins.
+  uint64_t address(std::string_view name) const;
+
+  size_t size() const
+  {
+    return addrs_.size();
+  }
+
+private:
+  Kallsyms() = default;
+
+  struct Entry {
+    uint32_t name;
+    uint32_t module;
+  };
+  struct Module {
+    std::string name;
+    // End of the module's memory, or 0 if it is not known (e.g. for vmlinux
+    // and BPF programs).
+    uint64_t end = 0;
+  };
+
+  std::string_view name(uint32_t offset) const;
+
+  // Symbol addresses, sorted, with their entries at the same index. These are
+  // kept apart so the search only touches the addresses. Only the first symbol
+  // listed at each address is kept here.
+  std::vector<uint64_t> addrs_;
+  std::vector<Entry> entries_;
+  // Every symbol, including aliases, as (name, address) sorted by name.
+  std::vector<std::pair<uint32_t, uint64_t>> by_name_;
+  // All symbol names, each followed by a NUL.
+  std::string names_;
+  // The first module is always "vmlinux".
+  std::vector<Module> modules_;
+};
+
+} // namespace bpftrace::symbols
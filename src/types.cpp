@@ -1,5 +1,6 @@
 #include <cassert>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 
 #include "ast/async_event_types.h"
@@ -130,16 +131,38 @@ std::string to_string(Type ty)
   return ss.str();
 }
 
+// Names are interned, so equal names are usually the same pointer and the
+// string comparison is only needed to order different names.
+static std::strong_ordering compare_names(const SizedType &a,
+                                          const SizedType &b)
+{
+  if (&a.GetName() == &b.GetName())
+    return std::strong_ordering::equal;
+  return a.GetName() <=> b.GetName();
+}
+
+// Compares the types pointed to by `a` and `b` without copying them. Address
+// spaces are not part of the ordering, so there is no need to go through
+// GetPointeeTy().
+static std::strong_ordering compare_elements(
+    const std::shared_ptr<SizedType> &a,
+    const std::shared_ptr<SizedType> &b)
+{
+  if (a == b)
+    return std::strong_ordering::equal;
+  return *a <=> *b;
+}
+
 bool SizedType::IsCompatible(const SizedType &t) const
 {
   if (t.GetTy() != type_)
     return false;
 
   if (IsCTypeTy())
-    return t.GetName() == GetName();
+    return compare_names(*this, t) == 0;
 
   if (IsPtrTy())
-    return GetPointeeTy().IsCompatible(t.GetPointeeTy());
+    return element_type_->IsCompatible(*t.element_type_);
 
   if (IsTupleTy()) {
     if (GetFieldCount() != t.GetFieldCount())
@@ -202,25 +225,25 @@ std::strong_ordering SizedType::operator<=>(const SizedType &t) const
     return cmp;
 
   if (IsCTypeTy()) {
-    if (auto cmp = GetName() <=> t.GetName(); cmp != 0)
+    if (auto cmp = compare_names(*this, t); cmp != 0)
       return cmp;
     return GetSize() <=> t.GetSize();
   }
 
   if (IsEnumTy() || t.IsEnumTy()) {
-    if (auto cmp = GetName() <=> t.GetName(); cmp != 0)
+    if (auto cmp = compare_names(*this, t); cmp != 0)
       return cmp;
     return GetSize() <=> t.GetSize();
   }
 
   if (IsPtrTy()) {
-    return GetPointeeTy() <=> t.GetPointeeTy();
+    return compare_elements(element_type_, t.element_type_);
   }
 
   if (IsArrayTy()) {
     if (auto cmp = GetNumElements() <=> t.GetNumElements(); cmp != 0)
       return cmp;
-    return GetElementTy() <=> t.GetElementTy();
+    return compare_elements(element_type_, t.element_type_);
   }
 
   if (IsTupleTy()) {
@@ -261,6 +284,19 @@ std::strong_ordering SizedType::operator<=>(const SizedType &t) const
   return is_signed_ <=> t.is_signed_;
 }
 
+const std::string *SizedType::InternName(const std::string &name)
+{
+  if (name.empty())
+    return nullptr;
+
+  // Never shrinks: the set of distinct type names in a program is small and
+  // the returned pointers must stay valid for as long as any type does.
+  static std::mutex mutex;
+  static std::unordered_set<std::string> names;
+  std::lock_guard<std::mutex> lock(mutex);
+  return &*names.insert(name).first;
+}
+
 bool SizedType::IsByteArray() const
 {
   return type_ == Type::string || type_ == Type::usym_t ||
@@ -403,7 +439,7 @@ SizedType CreateUInt64()
 SizedType CreateEnum(size_t bits, const std::string &name)
 {
   auto ty = CreateUInt(bits);
-  ty.name_ = name;
+  ty.name_ = SizedType::InternName(name);
   return ty;
 }
 
@@ -444,7 +480,7 @@ SizedType CreateCStruct(const std::string &name)
 {
   assert(!name.empty());
   auto ty = SizedType(Type::c_type, 0);
-  ty.name_ = name;
+  ty.name_ = SizedType::InternName(name);
   return ty;
 }
 
@@ -462,7 +498,7 @@ SizedType CreateCStruct(const std::string &name, std::weak_ptr<Struct> record)
   // A named type, stored in the `StructManager`.
   assert(!name.empty() && !record.expired());
   auto ty = SizedType(Type::c_type, record.lock()->size);
-  ty.name_ = name;
+  ty.name_ = SizedType::InternName(name);
   ty.inner_struct_ = std::move(record);
   return ty;
 }
@@ -471,7 +507,8 @@ SizedType CreateStack(bool kernel, StackType stack)
 {
   // These sizes are based on the stack struct (see
   // IRBuilderBPF::GetStackStructType)
-  auto base_size = (stack.limit * stack.elem_size()) + 8;
+  size_t base_size = stack.interned ? 16
+                                    : (stack.limit * stack.elem_size()) + 8;
   auto st = SizedType(kernel ? Type::kstack_t : Type::ustack_t,
                       kernel ? base_size : (base_size + 8));
   st.stack_type = stack;
@@ -479,6 +516,13 @@ SizedType CreateStack(bool kernel, StackType stack)
   return st;
 }
 
+SizedType CreateStackFrames(const SizedType &stack)
+{
+  StackType frames = stack.stack_type;
+  frames.interned = false;
+  return CreateStack(frames.kernel, frames);
+}
+
 SizedType CreateMin(bool is_signed)
 {
   return { Type::min_t, 8, is_signed };
@@ -125,6 +125,9 @@ struct StackType {
   // Since ustacks and kstacks have different structs
   // we need to make sure the names a different.
   bool kernel = true;
+  // Interned stacks only carry a hash of their frames, which are stored once
+  // in a stack table map (see table_name()).
+  bool interned = false;
 
   bool operator==(const StackType &obj) const
   {
@@ -139,13 +142,24 @@ struct StackType {
     if (auto cmp = mode <=> obj.mode; cmp != 0)
       return cmp;
 
-    return kernel <=> obj.kernel;
+    if (auto cmp = kernel <=> obj.kernel; cmp != 0)
+      return cmp;
+
+    return interned <=> obj.interned;
   }
 
   std::string name() const
   {
     std::string prefix = kernel ? "k" : "u";
     return prefix + "stack_" + STACK_MODE_NAME_MAP.at(mode) + "_" +
+           std::to_string(limit) + (interned ? "_interned" : "");
+  }
+
+  // The map holding the frames of interned stacks, keyed by their hash.
+  std::string table_name() const
+  {
+    std::string prefix = kernel ? "k" : "u";
+    return "stacks_" + prefix + STACK_MODE_NAME_MAP.at(mode) + "_" +
            std::to_string(limit);
   }
 
@@ -160,7 +174,7 @@ private:
   template <typename Archive>
   void serialize(Archive &archive)
   {
-    archive(limit, mode, kernel);
+    archive(limit, mode, kernel, interned);
   }
 };
 
@@ -198,7 +212,10 @@ private:
   size_t size_bits_ = 0;                    // size in bits
   std::shared_ptr<SizedType> element_type_; // for "container" and pointer
                                             // (like) types
-  std::string name_; // name of this type, for named types like struct and enum
+  // Name of this type, for named types like struct and enum. Names are
+  // interned (see InternName), so copying a type never copies its name and
+  // types with the same name share the same pointer. Null if unnamed.
+  const std::string *name_ = nullptr;
   std::variant<std::shared_ptr<Struct>, std::weak_ptr<Struct>>
       inner_struct_; // inner struct for records and tuples: if a shared_ptr, it
                      // is an anonymous type, if it is a weak_ptr, then it is
@@ -207,17 +224,40 @@ private:
   bool is_signed_ = false;
   bool sign_flexible_ = false;
   bool is_anon_ = false;
-  bool ctx_ = false;                              // Is bpf program context
-  std::unordered_set<std::string> btf_type_tags_; // Only populated for
-                                                  // Type::pointer
+  bool ctx_ = false; // Is bpf program context
+  // Only populated for Type::pointer. Shared between copies as the tags are
+  // never modified once set.
+  std::shared_ptr<const std::unordered_set<std::string>> btf_type_tags_;
   size_t num_elements_ = 0; // Only populated for array types
 
   std::shared_ptr<Struct> inner_struct() const;
 
+  static const std::string *InternName(const std::string &name);
+  static inline const std::string empty_name_;
+  static inline const std::unordered_set<std::string> empty_btf_type_tags_;
+
   friend class cereal::access;
   template <typename Archive>
-  void serialize(Archive &archive)
+  void save(Archive &archive) const
+  {
+    archive(type_,
+            stack_type,
+            is_internal,
+            is_funcarg,
+            is_anon_,
+            funcarg_idx,
+            is_signed_,
+            element_type_,
+            GetName(),
+            ctx_,
+            as_,
+            size_bits_,
+            inner_struct_);
+  }
+  template <typename Archive>
+  void load(Archive &archive)
   {
+    std::string name;
     archive(type_,
             stack_type,
             is_internal,
@@ -226,11 +266,12 @@ private:
             funcarg_idx,
             is_signed_,
             element_type_,
-            name_,
+            name,
             ctx_,
             as_,
             size_bits_,
             inner_struct_);
+    name_ = InternName(name);
   }
 
 public:
@@ -262,13 +303,17 @@ public:
   void SetBtfTypeTags(std::unordered_set<std::string> &&tags)
   {
     assert(IsPtrTy());
-    btf_type_tags_ = std::move(tags);
+    if (tags.empty())
+      btf_type_tags_.reset();
+    else
+      btf_type_tags_ = std::make_shared<const std::unordered_set<std::string>>(
+          std::move(tags));
   }
 
   const std::unordered_set<std::string> &GetBtfTypeTags() const
   {
     assert(IsPtrTy());
-    return btf_type_tags_;
+    return btf_type_tags_ ? *btf_type_tags_ : empty_btf_type_tags_;
   }
 
   bool IsCtxAccess() const
@@ -358,12 +403,12 @@ public:
 
   const std::string &GetName() const
   {
-    return name_;
+    return name_ ? *name_ : empty_name_;
   }
 
   std::string_view GetBaseName() const
   {
-    std::string_view name = name_;
+    std::string_view name = GetName();
     if (name.starts_with(STRUCT_PREFIX))
       return name.substr(STRUCT_PREFIX.length());
     if (name.starts_with(UNION_PREFIX))
@@ -421,7 +466,7 @@ public:
   }
   bool IsEnumTy() const
   {
-    return IsIntTy() && !name_.empty();
+    return IsIntTy() && name_;
   }
   bool IsNoneTy() const
   {
@@ -509,11 +554,11 @@ public:
   };
   bool IsCStructTy() const
   {
-    return IsCTypeTy() && name_.starts_with(STRUCT_PREFIX);
+    return IsCTypeTy() && GetName().starts_with(STRUCT_PREFIX);
   };
   bool IsCUnionTy() const
   {
-    return IsCTypeTy() && name_.starts_with(UNION_PREFIX);
+    return IsCTypeTy() && GetName().starts_with(UNION_PREFIX);
   };
   bool IsCTypedefTy() const
   {
@@ -622,6 +667,8 @@ SizedType CreateTuple(std::shared_ptr<Struct> &&tuple);
 SizedType CreateRecord(std::shared_ptr<Struct> &&record);
 
 SizedType CreateStack(bool kernel, StackType st = StackType());
+// The stack holding all frames of `stack`, which may be interned.
+SizedType CreateStackFrames(const SizedType &stack);
 
 SizedType CreateMin(bool is_signed);
 SizedType CreateMax(bool is_signed);
@@ -7,6 +7,7 @@
 #include "bpftrace.h"
 #include "log.h"
 #include "required_resources.h"
+#include "scopeguard.h"
 #include "types_format.h"
 #include "util/stats.h"
 
@@ -43,6 +44,75 @@ std::string format_build_id_stack(uint64_t nr_stack_frames,
   return stack.str();
 }
 
+// Starts symbolizing the stacks and symbols in `value` in the background, so
+// that they are ready by the time `value` is formatted.
+static void prefetch_symbols(BPFtrace &bpftrace,
+                            const SizedType &type,
+                            const OpaqueValue &value)
+{
+  switch (type.GetTy()) {
+    case Type::kstack_t: {
+      auto num_frames = value.bitcast<uint64_t>(0);
+      constexpr size_t stack_offset = sizeof(uint64_t);
+      if (type.stack_type.interned) {
+        auto stack_id = value.slice(stack_offset).bitcast<uint64_t>();
+        bpftrace.prefetch_interned_stack(
+            num_frames, stack_id, -1, -1, type.stack_type);
+        break;
+      }
+      auto len = type.stack_type.elem_size() * type.stack_type.limit;
+      bpftrace.prefetch_stack(num_frames,
+                              value.slice(stack_offset, len),
+                              -1,
+                              -1,
+                              false,
+                              type.stack_type,
+                              8);
+      break;
+    }
+    case Type::ustack_t: {
+      auto pid = value.bitcast<int32_t>(0);
+      auto probe_id = value.bitcast<int32_t>(1);
+      auto num_frames =
+          value.slice(sizeof(uint64_t), sizeof(uint64_t)).bitcast<uint64_t>(0);
+      constexpr size_t stack_offset = sizeof(uint64_t) * 2;
+      if (type.stack_type.interned) {
+        auto stack_id = value.slice(stack_offset).bitcast<uint64_t>();
+        bpftrace.prefetch_interned_stack(
+            num_frames, stack_id, pid, probe_id, type.stack_type);
+        break;
+      }
+      auto len = type.stack_type.elem_size() * type.stack_type.limit;
+      bpftrace.prefetch_stack(num_frames,
+                              value.slice(stack_offset, len),
+                              pid,
+                              probe_id,
+                              true,
+                              type.stack_type,
+                              8);
+      break;
+    }
+    case Type::ksym_t:
+      bpftrace.prefetch_ksym(value.bitcast<uint64_t>());
+      break;
+    case Type::usym_t:
+      bpftrace.prefetch_usym(value.bitcast<uint64_t>(),
+                             value.slice(8, 4).bitcast<int32_t>(),
+                             value.slice(12, 4).bitcast<int32_t>());
+      break;
+    case Type::record:
+    case Type::tuple:
+      for (const auto &field : type.GetFields()) {
+        prefetch_symbols(bpftrace,
+                        field.type,
+                        value.slice(field.offset, field.type.GetSize()));
+      }
+      break;
+    default:
+      break;
+  }
+}
+
 Result<output::Primitive> format(BPFtrace &bpftrace,
                                  const ast::CDefinitions &c_definitions,
                                  const SizedType &type,
@@ -73,8 +143,13 @@ Result<output::Primitive> format(BPFtrace &bpftrace,
     }
     case Type::kstack_t: {
       auto num_frames = value.bitcast<uint64_t>(0);
-      auto limit = type.stack_type.limit;
       constexpr size_t stack_offset = sizeof(uint64_t);
+      if (type.stack_type.interned) {
+        auto stack_id = value.slice(stack_offset).bitcast<uint64_t>();
+        return bpftrace.get_interned_stack(
+            num_frames, stack_id, -1, -1, type.stack_type);
+      }
+      auto limit = type.stack_type.limit;
       auto len = type.stack_type.elem_size() * limit;
       const auto raw_stack = value.slice(stack_offset, len);
 
@@ -86,9 +161,13 @@ Result<output::Primitive> format(BPFtrace &bpftrace,
       auto probe_id = value.bitcast<int32_t>(1);
       auto num_frames =
           value.slice(sizeof(uint64_t), sizeof(uint64_t)).bitcast<uint64_t>(0);
-      auto limit = type.stack_type.limit;
       constexpr size_t stack_offset = sizeof(uint64_t) * 2;
-
+      if (type.stack_type.interned) {
+        auto stack_id = value.slice(stack_offset).bitcast<uint64_t>();
+        return bpftrace.get_interned_stack(
+            num_frames, stack_id, pid, probe_id, type.stack_type);
+      }
+      auto limit = type.stack_type.limit;
       auto len = type.stack_type.elem_size() * limit;
       const auto raw_stack = value.slice(stack_offset, len);
 
@@ -615,6 +694,20 @@ Result<output::Value> format(BPFtrace &bpftrace,
       div = 1;
     }
 
+    // Symbolize the stacks and symbols in the keys to print in the
+    // background, while the entries before them are formatted.
+    SCOPE_EXIT
+    {
+      bpftrace.clear_prefetched_symbols();
+    };
+    for (size_t j = top && total_counts_by_key.size() > top
+                        ? total_counts_by_key.size() - top
+                        : 0;
+         j < total_counts_by_key.size();
+         j++) {
+      prefetch_symbols(bpftrace, key_type, total_counts_by_key[j].first);
+    }
+
     for (const auto &[key, count] : total_counts_by_key) {
       if (top && total_counts_by_key.size() > top &&
           i++ < (total_counts_by_key.size() - top))
@@ -744,9 +837,21 @@ Result<output::Value> format(BPFtrace &bpftrace,
     div = 1;
   }
 
+  // Symbolize the stacks and symbols in the entries to print in the
+  // background, while the entries before them are formatted.
+  SCOPE_EXIT
+  {
+    bpftrace.clear_prefetched_symbols();
+  };
+  size_t total = values_by_key->size();
+  for (size_t j = top && total > top ? total - top : 0; j < total; j++) {
+    const auto &[key, value] = (*values_by_key)[j];
+    prefetch_symbols(bpftrace, key_type, key);
+    prefetch_symbols(bpftrace, value_type, value);
+  }
+
   // Print as a regular map.
   size_t done = 0;
-  size_t total = values_by_key->size();
   for (auto &[key, value] : *values_by_key) {
     if (top && total > top && done++ < (total - top)) {
       continue;
@@ -25,6 +25,10 @@ private:
   SizedType ty_;
 };
 
+// Formats a ustack collected in build_id mode.
+std::string format_build_id_stack(uint64_t nr_stack_frames,
+                                  const OpaqueValue &raw_stack);
+
 // sorts map data by key. This is exposed as a function for testability,
 // but it is generally an internal implementation detail.
 void sort_by_key(
@@ -1,10 +1,16 @@
 #include "types.h"
 #include <bcc/bcc_elf.h>
 #include <bcc/bcc_syms.h>
+#include <cinttypes>
+#include <cstdio>
 #include <fstream>
+#include <limits>
 #include <sstream>
+#include <sys/stat.h>
+#include <utility>
 
 #include "config.h"
+#include "cxxdemangler/cxxdemangler.h"
 #include "log.h"
 #include "scopeguard.h"
 #include "usyms.h"
@@ -106,28 +112,264 @@ void add_symbols(const blaze_sym *sym,
 
 namespace bpftrace {
 
-Usyms::Usyms(const Config &config) : config_(config)
+// A limit of zero means the caches are unbounded.
+static size_t cache_capacity(const Config &config)
 {
+  if (config.max_user_symbol_caches == 0)
+    return std::numeric_limits<size_t>::max();
+  return config.max_user_symbol_caches;
 }
 
-Usyms::~Usyms()
+// A limit of zero means the symbol tables are unbounded.
+static size_t cache_bytes(const Config &config)
 {
-  for (const auto &pair : exe_sym_) {
-    if (pair.second.second)
-      bcc_free_symcache(pair.second.second, pair.second.first);
-  }
+  if (config.max_user_symbol_cache_bytes == 0)
+    return std::numeric_limits<size_t>::max();
+  return config.max_user_symbol_cache_bytes;
+}
 
-  for (const auto &pair : pid_sym_) {
-    if (pair.second)
-      bcc_free_symcache(pair.second, pair.first);
+// A rough estimate of the memory used by a symbol table: a tree node per
+// symbol plus the names that are too long to be stored inline.
+static size_t estimate_bytes(
+    const std::map<uintptr_t, elf_symbol, std::greater<>> &table)
+{
+  const size_t node_bytes = sizeof(std::pair<const uintptr_t, elf_symbol>) +
+                            4 * sizeof(void *);
+  const size_t inline_capacity = std::string().capacity();
+  size_t bytes = 0;
+  for (const auto &[_, sym] : table) {
+    bytes += node_bytes;
+    if (sym.name.capacity() > inline_capacity)
+      bytes += sym.name.capacity() + 1;
   }
+  return bytes;
+}
+
+static std::string file_key(const struct stat &st)
+{
+  return std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino) + ":" +
+         std::to_string(st.st_mtim.tv_sec);
+}
+
+Usyms::Usyms(const Config &config)
+    : config_(config),
+      exe_sym_(cache_capacity(config)),
+      pid_sym_(cache_capacity(config)),
+      // bounded by their size in object_symbols() instead
+      object_symbols_(std::numeric_limits<size_t>::max()),
+      pid_mappings_(cache_capacity(config)),
+      path_keys_(cache_capacity(config)),
+      pid_keys_(cache_capacity(config))
+{
+}
 
+Usyms::~Usyms()
+{
 #ifdef HAVE_BLAZESYM
   if (symbolizer_)
     blaze_symbolizer_free(symbolizer_);
 #endif
 }
 
+Usyms::Symcache::~Symcache()
+{
+  if (cache_)
+    bcc_free_symcache(cache_, pid_);
+}
+
+Usyms::Symcache::Symcache(Symcache &&other) noexcept
+    : pid_(other.pid_), cache_(std::exchange(other.cache_, nullptr))
+{
+}
+
+Usyms::Symcache &Usyms::Symcache::operator=(Symcache &&other) noexcept
+{
+  if (this != &other) {
+    if (cache_)
+      bcc_free_symcache(cache_, pid_);
+    pid_ = other.pid_;
+    cache_ = std::exchange(other.cache_, nullptr);
+  }
+  return *this;
+}
+
+std::string Usyms::object_key(const std::string &path)
+{
+  if (path.empty())
+    return path;
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    if (const auto *key = path_keys_.find(path))
+      return *key;
+    return path;
+  }
+  auto key = file_key(st);
+  path_keys_.insert(path, key);
+  return key;
+}
+
+std::string Usyms::object_key(int pid, const std::string &path)
+{
+  if (const auto *cached = pid_keys_.find(pid); cached && cached->first == path)
+    return cached->second;
+  auto key = object_key(path);
+  pid_keys_.insert(pid, { path, key });
+  return key;
+}
+
+Usyms::ObjectSymbols &Usyms::object_symbols(const std::string &key,
+                                            const std::string &path)
+{
+  if (auto *cached = object_symbols_.find(key)) {
+    hits_++;
+    return *cached;
+  }
+  misses_++;
+
+  ObjectSymbols symbols;
+  symbols.table = util::get_symbol_table_for_elf(path);
+  symbols.bytes = estimate_bytes(symbols.table);
+  bcc_elf_load_sectioncb add_segment =
+      [](uint64_t v_addr, uint64_t mem_sz, uint64_t file_offset, void *p) {
+        auto *segments = static_cast<std::vector<ObjectSymbols::Segment> *>(p);
+        segments->push_back({ .v_addr = v_addr,
+                              .mem_sz = mem_sz,
+                              .file_offset = file_offset });
+        return 0;
+      };
+  bcc_elf_foreach_load_section(path.c_str(), add_segment, &symbols.segments);
+
+  // The new table is always kept, even if it is over the limit on its own, so
+  // that the symbol being resolved can be found.
+  while (object_symbols_.size() > 0 &&
+         object_symbols_bytes_ + symbols.bytes > cache_bytes(config_)) {
+    object_symbols_bytes_ -= object_symbols_.least_recent()->bytes;
+    object_symbols_.evict_least_recent();
+  }
+  object_symbols_bytes_ += symbols.bytes;
+  object_symbols_.insert(key, std::move(symbols));
+  return *object_symbols_.find(key);
+}
+
+const std::vector<Usyms::Mapping> &Usyms::pid_mappings(int pid)
+{
+  if (const auto *cached = pid_mappings_.find(pid))
+    return *cached;
+
+  std::vector<Mapping> mappings;
+  const std::string proc = "/proc/" + std::to_string(pid);
+  std::ifstream maps(proc + "/maps");
+  for (std::string line; std::getline(maps, line);) {
+    std::istringstream iss(line);
+    std::string range;
+    std::string perms;
+    std::string dev;
+    std::string path;
+    uint64_t offset = 0;
+    uint64_t inode = 0;
+    if (!(iss >> range >> perms >> std::hex >> offset >> dev >> std::dec >>
+          inode))
+      continue;
+    iss >> std::ws;
+    std::getline(iss, path);
+    // Only code in mapped files has symbols here. The rest, e.g. the vdso or
+    // JIT code described by perf maps, is left to bcc.
+    if (inode == 0 || perms.find('x') == std::string::npos || path.empty() ||
+        path[0] != '/')
+      continue;
+
+    Mapping mapping = {
+      .file_offset = offset,
+      .path = std::move(path),
+      .map_file = proc + "/map_files/" + range,
+    };
+    if (std::sscanf(range.c_str(),
+                    "%" SCNx64 "-%" SCNx64,
+                    &mapping.start,
+                    &mapping.end) != 2)
+      continue;
+    struct stat st;
+    if (stat(mapping.map_file.c_str(), &st) != 0)
+      continue;
+    mapping.key = file_key(st);
+    mappings.push_back(std::move(mapping));
+  }
+
+  pid_mappings_.insert(pid, std::move(mappings));
+  return *pid_mappings_.find(pid);
+}
+
+std::optional<std::string> Usyms::resolve_mapped(uint64_t addr,
+                                                 int32_t pid,
+                                                 bool show_offset,
+                                                 bool perf_mode)
+{
+  const Mapping *mapping = nullptr;
+  for (const auto &m : pid_mappings(pid)) {
+    if (addr >= m.start && addr < m.end) {
+      mapping = &m;
+      break;
+    }
+  }
+  if (!mapping)
+    return std::nullopt;
+
+  // The address is translated to the virtual address of the object that the
+  // symbols are given in: first to an offset in the file through the mapping,
+  // then through the loadable segment containing that offset.
+  const auto &symbols = object_symbols(mapping->key, mapping->map_file);
+  const uint64_t file_offset = addr - mapping->start + mapping->file_offset;
+  std::optional<uint64_t> v_addr;
+  for (const auto &segment : symbols.segments) {
+    if (file_offset >= segment.file_offset &&
+        file_offset < segment.file_offset + segment.mem_sz) {
+      v_addr = file_offset - segment.file_offset + segment.v_addr;
+      break;
+    }
+  }
+  if (!v_addr)
+    return std::nullopt;
+
+  auto sym = symbols.table.lower_bound(*v_addr);
+  if (sym == symbols.table.end() ||
+      (*v_addr != sym->second.start && *v_addr >= sym->second.end))
+    return std::nullopt;
+
+  std::ostringstream symbol;
+  char *demangled = nullptr;
+  if (config_.cpp_demangle &&
+      util::symbol_has_cpp_mangled_signature(sym->second.name))
+    demangled = cxxdemangle(sym->second.name.c_str());
+  if (demangled) {
+    symbol << demangled;
+    ::free(demangled);
+  } else {
+    symbol << sym->second.name;
+  }
+  if (show_offset)
+    symbol << "+" << *v_addr - sym->second.start;
+  if (perf_mode)
+    symbol << " (" << mapping->path << ")";
+  return symbol.str();
+}
+
+Usyms::Stats Usyms::stats() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats stats = {
+    .hits = hits_,
+    .misses = misses_,
+    .evictions = exe_sym_.evictions() + pid_sym_.evictions() +
+                 object_symbols_.evictions(),
+    .entries = exe_sym_.size() + pid_sym_.size() + object_symbols_.size(),
+  };
+#ifdef HAVE_BLAZESYM
+  stats.evictions += blazesym_evictions_;
+  stats.entries += blazesym_sources_.size();
+#endif
+  return stats;
+}
+
 void Usyms::cache_bcc(const std::string &elf_file, std::optional<int> opt_pid)
 {
   const auto cache_type = config_.user_symbol_cache_type;
@@ -135,16 +377,16 @@ void Usyms::cache_bcc(const std::string &elf_file, std::optional<int> opt_pid)
   // binary is not present at symbol resolution time
   // note: this only makes sense with ASLR disabled, since with ASLR offsets
   // might be different
-  if (cache_type == UserSymbolCacheType::per_program &&
-      !symbol_table_cache_.contains(elf_file))
-    symbol_table_cache_[elf_file] = util::get_symbol_table_for_elf(elf_file);
+  if (cache_type == UserSymbolCacheType::per_program)
+    object_symbols(object_key(elf_file), elf_file);
 
   if (cache_type == UserSymbolCacheType::per_pid) {
     // preload symbol tables from running processes
     // this allows symbol resolution for processes that are running at probe
     // attach time (either a specific PID or all matching processes), but not at
-    // symbol resolution time, even with ASLR enabled, since BCC symcache
-    // records the offsets
+    // symbol resolution time, even with ASLR enabled, since the mappings of the
+    // process are recorded. The symbols of the objects are shared by all of
+    // them.
     auto pids = opt_pid.has_value() ? std::vector<int>{ *opt_pid }
                                     : util::get_pids_for_program(elf_file);
     if (!pids) {
@@ -153,7 +395,8 @@ void Usyms::cache_bcc(const std::string &elf_file, std::optional<int> opt_pid)
       return;
     }
     for (int pid : *pids) {
-      pid_sym_[pid] = bcc_symcache_new(pid, &get_symbol_opts());
+      for (const auto &mapping : pid_mappings(pid))
+        object_symbols(mapping.key, mapping.map_file);
     }
   }
 }
@@ -170,6 +413,25 @@ struct blaze_symbolizer *Usyms::create_symbolizer() const
   return blaze_symbolizer_new_opts(&opts);
 }
 
+void Usyms::track_blazesym_source(const std::string &source)
+{
+  if (blazesym_sources_.contains(source)) {
+    hits_++;
+    return;
+  }
+  misses_++;
+
+  if (blazesym_sources_.size() >= cache_capacity(config_)) {
+    blazesym_evictions_ += blazesym_sources_.size();
+    blazesym_sources_.clear();
+    if (symbolizer_) {
+      blaze_symbolizer_free(symbolizer_);
+      symbolizer_ = nullptr;
+    }
+  }
+  blazesym_sources_.insert(source);
+}
+
 void Usyms::cache_blazesym(const std::string &elf_file,
                            std::optional<int> opt_pid)
 {
@@ -177,17 +439,18 @@ void Usyms::cache_blazesym(const std::string &elf_file,
   if (cache_type == UserSymbolCacheType::none)
     return;
 
-  if (symbolizer_ == nullptr) {
-    symbolizer_ = create_symbolizer();
-    if (symbolizer_ == nullptr)
-      return;
-  }
-
   // preload symbol table for executable to make it available even if the
   // binary is not present at symbol resolution time
   // note: this only makes sense with ASLR disabled, since with ASLR offsets
   // might be different
   if (cache_type == UserSymbolCacheType::per_program) {
+    track_blazesym_source("exe:" + object_key(elf_file));
+    if (symbolizer_ == nullptr) {
+      symbolizer_ = create_symbolizer();
+      if (symbolizer_ == nullptr)
+        return;
+    }
+
     blaze_cache_src_elf cache = {
       .type_size = sizeof(cache),
       .path = elf_file.c_str(),
@@ -205,6 +468,13 @@ void Usyms::cache_blazesym(const std::string &elf_file,
       return;
     }
     for (int pid : *pids) {
+      track_blazesym_source("pid:" + std::to_string(pid));
+      if (symbolizer_ == nullptr) {
+        symbolizer_ = create_symbolizer();
+        if (symbolizer_ == nullptr)
+          return;
+      }
+
       blaze_cache_src_process cache = {
         .type_size = sizeof(cache),
         .pid = static_cast<uint32_t>(pid),
@@ -219,6 +489,7 @@ void Usyms::cache_blazesym(const std::string &elf_file,
 
 void Usyms::cache(const std::string &elf_file, std::optional<int> pid)
 {
+  std::lock_guard<std::mutex> lock(mutex_);
 #ifdef HAVE_BLAZESYM
   if (config_.use_blazesym) {
     cache_blazesym(elf_file, pid);
@@ -240,19 +511,16 @@ std::string Usyms::resolve_bcc(uint64_t addr,
   void *psyms = nullptr;
 
   if (cache_type == UserSymbolCacheType::per_program) {
+    auto key = object_key(pid, pid_exe);
     if (!pid_exe.empty()) {
       // try to resolve symbol directly from program file
       // this might work when the process does not exist anymore, but cannot
       // resolve all symbols, e.g. those in a dynamically linked library
-      std::map<uintptr_t, elf_symbol, std::greater<>> &symbol_table =
-          symbol_table_cache_.contains(pid_exe)
-              ? symbol_table_cache_[pid_exe]
-              : (symbol_table_cache_[pid_exe] = util::get_symbol_table_for_elf(
-                     pid_exe));
-      auto sym = symbol_table.lower_bound(addr);
+      const SymbolTable *symbol_table = &object_symbols(key, pid_exe).table;
+      auto sym = symbol_table->lower_bound(addr);
       // address has to be either the start of the symbol (for symbols of
       // length 0) or in [start, end)
-      if (sym != symbol_table.end() &&
+      if (sym != symbol_table->end() &&
           (addr == sym->second.start ||
            (addr >= sym->second.start && addr < sym->second.end))) {
         symbol << sym->second.name;
@@ -263,21 +531,28 @@ std::string Usyms::resolve_bcc(uint64_t addr,
         return symbol.str();
       }
     }
-    if (!exe_sym_.contains(pid_exe)) {
+    if (auto *cached = exe_sym_.find(key)) {
+      hits_++;
+      psyms = cached->get();
+    } else {
       // not cached, create new ProcSyms cache
+      misses_++;
       psyms = bcc_symcache_new(pid, &get_symbol_opts());
-      exe_sym_[pid_exe] = std::make_pair(pid, psyms);
-    } else {
-      psyms = exe_sym_[pid_exe].second;
+      exe_sym_.insert(key, Symcache(pid, psyms));
     }
   } else if (cache_type == UserSymbolCacheType::per_pid) {
-    // cache user symbols per pid
-    if (!pid_sym_.contains(pid)) {
+    if (auto sym = resolve_mapped(addr, pid, show_offset, perf_mode))
+      return *sym;
+    // what is not in the symbols of a mapped object is resolved by bcc, which
+    // also reads perf maps and separate debug files
+    if (auto *cached = pid_sym_.find(pid)) {
+      hits_++;
+      psyms = cached->get();
+    } else {
       // not cached, create new ProcSyms cache
+      misses_++;
       psyms = bcc_symcache_new(pid, &get_symbol_opts());
-      pid_sym_[pid] = psyms;
-    } else {
-      psyms = pid_sym_[pid];
+      pid_sym_.insert(pid, Symcache(pid, psyms));
     }
   } else {
     // no user symbol caching, create new bcc cache
@@ -330,13 +605,18 @@ std::vector<std::string> Usyms::resolve_blazesym_impl(
   std::vector<std::string> str_syms;
   const blaze_sym *sym;
 
+  auto cache_type = config_.user_symbol_cache_type;
+  if (cache_type == UserSymbolCacheType::per_program)
+    track_blazesym_source("exe:" + object_key(pid, pid_exe));
+  else if (cache_type == UserSymbolCacheType::per_pid)
+    track_blazesym_source("pid:" + std::to_string(pid));
+
   if (symbolizer_ == nullptr) {
     symbolizer_ = create_symbolizer();
     if (symbolizer_ == nullptr)
       return str_syms;
   }
 
-  auto cache_type = config_.user_symbol_cache_type;
   SCOPE_EXIT
   {
     if (cache_type == UserSymbolCacheType::none) {
@@ -427,6 +707,7 @@ std::vector<std::string> Usyms::resolve(uint64_t addr,
                                         bool perf_mode,
                                         [[maybe_unused]] bool show_debug_info)
 {
+  std::lock_guard<std::mutex> lock(mutex_);
 #ifdef HAVE_BLAZESYM
   if (config_.use_blazesym)
     return resolve_blazesym(
@@ -4,12 +4,18 @@
 #include <bcc/bcc_syms.h>
 #include <cstdint>
 #include <map>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #ifdef HAVE_BLAZESYM
 #include <blazesym.h>
 #endif
 
+#include "util/lru_cache.h"
 #include "util/symbols.h"
 
 namespace bpftrace {
@@ -18,8 +24,16 @@ using util::elf_symbol;
 
 class Config;
 
+// Resolves user addresses. This may be used from several threads.
 class Usyms {
 public:
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t entries = 0;
+  };
+
   Usyms(const Config& config);
   ~Usyms();
 
@@ -34,13 +48,96 @@ public:
                                    bool perf_mode,
                                    bool show_debug_info);
 
+  // Lookups in the symbol caches of processes and programs.
+  Stats stats() const;
+
 private:
+  // Owns a bcc symbol cache.
+  class Symcache {
+  public:
+    Symcache(int pid, void* cache) : pid_(pid), cache_(cache) {};
+    ~Symcache();
+    Symcache(Symcache&& other) noexcept;
+    Symcache& operator=(Symcache&& other) noexcept;
+    Symcache(const Symcache&) = delete;
+    Symcache& operator=(const Symcache&) = delete;
+
+    void* get() const
+    {
+      return cache_;
+    }
+
+  private:
+    int pid_;
+    void* cache_;
+  };
+  using SymbolTable = std::map<uintptr_t, elf_symbol, std::greater<>>;
+
+  // The symbols of an ELF object, shared by every process that maps it.
+  struct ObjectSymbols {
+    // A loadable segment, which maps file offsets to the virtual addresses
+    // that the symbols are given in.
+    struct Segment {
+      uint64_t v_addr;
+      uint64_t mem_sz;
+      uint64_t file_offset;
+    };
+
+    SymbolTable table;
+    std::vector<Segment> segments;
+    // Estimated memory used by the table
+    size_t bytes = 0;
+  };
+
+  // An executable, file backed mapping of a process.
+  struct Mapping {
+    uint64_t start;
+    uint64_t end;
+    uint64_t file_offset;
+    std::string path;
+    // Where the object can be read even if it has been removed or lives in
+    // another mount namespace, i.e. /proc/<pid>/map_files/<start>-<end>
+    std::string map_file;
+    std::string key;
+  };
+
+  // Programs are identified by their device and inode rather than by path, so
+  // that their symbols are shared by all processes running them. The key of a
+  // path is remembered, so that objects cached up front are still found once
+  // they have been removed or replaced.
+  std::string object_key(const std::string& path);
+  // Same, but memoized for the process, so that resolving its addresses does
+  // not stat its executable every time.
+  std::string object_key(int pid, const std::string& path);
+
   const Config& config_;
   // note: exe_sym_ is used when layout is same for all instances of program
-  std::map<std::string, std::pair<int, void*>> exe_sym_; // exe -> (pid, cache)
-  std::map<int, void*> pid_sym_;                         // pid -> cache
-  std::map<std::string, std::map<uintptr_t, elf_symbol, std::greater<>>>
-      symbol_table_cache_;
+  util::LRUCache<std::string, Symcache> exe_sym_; // object -> cache
+  util::LRUCache<int, Symcache> pid_sym_;         // pid -> cache
+  // object -> symbols, bounded by max_user_symbol_cache_bytes
+  util::LRUCache<std::string, ObjectSymbols> object_symbols_;
+  size_t object_symbols_bytes_ = 0;
+  util::LRUCache<int, std::vector<Mapping>> pid_mappings_; // pid -> mappings
+  util::LRUCache<std::string, std::string> path_keys_; // path -> key
+  // pid -> (executable, key)
+  util::LRUCache<int, std::pair<std::string, std::string>> pid_keys_;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+  // Guards all of the caches and symbolizers.
+  mutable std::mutex mutex_;
+
+  // Loads the symbols of an object if they are not cached. The reference is
+  // valid until the next call.
+  ObjectSymbols& object_symbols(const std::string& key,
+                                const std::string& path);
+  const std::vector<Mapping>& pid_mappings(int pid);
+  // Resolves an address of a process through the symbols of the object mapped
+  // at it. Returns nothing if it is not in a mapped object, e.g. in JIT code,
+  // or the object has no symbol for it.
+  std::optional<std::string> resolve_mapped(uint64_t addr,
+                                            int32_t pid,
+                                            bool show_offset,
+                                            bool perf_mode);
 
   void cache_bcc(const std::string& elf_file, std::optional<int> opt_pid);
   std::string resolve_bcc(uint64_t addr,
@@ -52,6 +149,13 @@ private:
 
 #ifdef HAVE_BLAZESYM
   blaze_symbolizer* symbolizer_{ nullptr };
+  // Processes or programs that the symbolizer holds symbols for. blazesym
+  // cannot drop individual ones, so the whole symbolizer is dropped when there
+  // are too many.
+  std::unordered_set<std::string> blazesym_sources_;
+  uint64_t blazesym_evictions_ = 0;
+
+  void track_blazesym_source(const std::string& source);
 
   blaze_symbolizer* create_symbolizer() const;
   void cache_blazesym(const std::string& elf_file, std::optional<int> opt_pid);
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace bpftrace::util {
+
+// A map holding at most `capacity` entries. Inserting into a full cache drops
+// the least recently used entry.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class LRUCache {
+public:
+  explicit LRUCache(size_t capacity) : capacity_(capacity)
+  {
+  }
+
+  // Returns nullptr if `key` is not cached. The pointer is valid until the
+  // next insert().
+  V *find(const K &key)
+  {
+    auto it = index_.find(key);
+    if (it == index_.end())
+      return nullptr;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return &it->second->second;
+  }
+
+  void insert(const K &key, V value)
+  {
+    if (auto *cached = find(key)) {
+      *cached = std::move(value);
+      return;
+    }
+    if (capacity_ == 0)
+      return;
+    if (entries_.size() >= capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+      evictions_++;
+    }
+    entries_.emplace_front(key, std::move(value));
+    index_.emplace(key, entries_.begin());
+  }
+
+  // Returns nullptr if the cache is empty.
+  V *least_recent()
+  {
+    if (entries_.empty())
+      return nullptr;
+    return &entries_.back().second;
+  }
+
+  void evict_least_recent()
+  {
+    if (entries_.empty())
+      return;
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+    evictions_++;
+  }
+
+  size_t size() const
+  {
+    return entries_.size();
+  }
+
+  // Number of entries dropped to make room for new ones.
+  size_t evictions() const
+  {
+    return evictions_;
+  }
+
+  void clear()
+  {
+    index_.clear();
+    entries_.clear();
+  }
+
+private:
+  using Entries = std::list<std::pair<K, V>>;
+
+  size_t capacity_;
+  size_t evictions_ = 0;
+  // Most recently used first
+  Entries entries_;
+  std::unordered_map<K, typename Entries::iterator, Hash> index_;
+};
+
+} // namespace bpftrace::util
@@ -924,4 +924,33 @@ TYPED_TEST(ASTTest, Comparison)
   }
 }
 
+TEST(ASTContext, NodeArena)
+{
+  ASTContext ctx;
+  SourceLocation loc;
+
+  // Enough nodes to span several arena blocks.
+  std::vector<Integer *> nodes;
+  for (uint64_t i = 0; i < 10000; ++i) {
+    nodes.push_back(ctx.make_node<Integer>(loc, i));
+  }
+  EXPECT_EQ(ctx.node_count(), 10000U);
+
+  for (uint64_t i = 0; i < nodes.size(); ++i) {
+    EXPECT_EQ(nodes[i]->value, i);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(nodes[i]) % alignof(Integer), 0U);
+  }
+
+  auto *cloned = clone(ctx, nodes[42]->loc, nodes[42]);
+  EXPECT_NE(cloned, nodes[42]);
+  EXPECT_EQ(*cloned, *nodes[42]);
+  EXPECT_EQ(ctx.node_count(), 10001U);
+
+  ctx.clear();
+  EXPECT_EQ(ctx.node_count(), 0U);
+  auto *node = ctx.make_node<Integer>(loc, 1UL);
+  EXPECT_EQ(node->value, 1U);
+  EXPECT_EQ(ctx.node_count(), 1U);
+}
+
 } // namespace bpftrace::test::ast
@@ -32,6 +32,18 @@ public:
   AsyncHandlers handlers;
 };
 
+// Strings only hold an AsyncEvent::StringRef in the fixed-size part of the
+// record, and are packed after it.
+template <typename T>
+constexpr size_t slot_size()
+{
+  if constexpr (std::is_same_v<T, std::string>) {
+    return sizeof(AsyncEvent::StringRef);
+  } else {
+    return sizeof(T);
+  }
+}
+
 // Process string type argument - handle const char*
 template <typename T, typename... R>
 void build_each_field(std::vector<Field> &fields,
@@ -51,7 +63,7 @@ void build_each_field(std::vector<Field> &fields,
   fields.push_back(Field{
       .name = "arg", .type = ty, .offset = offset, .bitfield = std::nullopt });
   if constexpr (sizeof...(R) != 0) {
-    build_each_field(fields, offset + ty.GetSize(), rest...);
+    build_each_field(fields, offset + slot_size<T>(), rest...);
   }
 }
 
@@ -74,7 +86,22 @@ Result<std::string> handler_proxy(AsyncActionTest &test,
 
   auto fields = build_fields(args...);
   auto arg_data = OpaqueValue::from(static_cast<uint64_t>(id));
-  arg_data = (arg_data + ... + OpaqueValue::from<Args>(args));
+  auto strings = OpaqueValue::alloc(0);
+  auto strings_offset = static_cast<uint32_t>((0 + ... + slot_size<Args>()));
+  [[maybe_unused]] auto pack = [&]<typename T>(const T &arg) {
+    if constexpr (std::is_same_v<T, std::string>) {
+      auto length = static_cast<uint32_t>(arg.size() + 1);
+      auto ref = AsyncEvent::StringRef{ .offset = strings_offset,
+                                        .length = length };
+      strings = strings + OpaqueValue::from(arg);
+      strings_offset += length;
+      return OpaqueValue::from(ref);
+    } else {
+      return OpaqueValue::from<T>(arg);
+    }
+  };
+  ((arg_data = arg_data + pack(args)), ...);
+  arg_data = arg_data + strings;
 
   static_assert((id == AsyncAction::syscall || id == AsyncAction::cat ||
                  id == AsyncAction::printf) &&
@@ -366,6 +393,67 @@ TEST_F(AsyncActionTest, printf)
       << "printf_handler should format multiple arguments correctly";
 }
 
+TEST_F(AsyncActionTest, printf_packed_strings)
+{
+  // Strings are sent with only the bytes that were read, which may be fewer
+  // than their type's size. A string filling its type has no NUL byte, and is
+  // printed as truncated.
+  std::vector<Field> fields = {
+    Field{ .name = "a",
+           .type = CreateString(16),
+           .offset = 0,
+           .bitfield = std::nullopt },
+    Field{ .name = "b",
+           .type = CreateString(4),
+           .offset = 8,
+           .bitfield = std::nullopt },
+  };
+  bpftrace->resources.printf_args.emplace_back(
+      FormatString("%s %s"), fields, PrintfSeverity::NONE, SourceInfo());
+
+  auto data = OpaqueValue::from(static_cast<uint64_t>(AsyncAction::printf)) +
+              OpaqueValue::from(AsyncEvent::StringRef{ .offset = 16,
+                                                       .length = 4 }) +
+              OpaqueValue::from(AsyncEvent::StringRef{ .offset = 20,
+                                                       .length = 4 }) +
+              OpaqueValue::from(std::string("abc")) +
+              OpaqueValue::from<char>('w') + OpaqueValue::from<char>('x') +
+              OpaqueValue::from<char>('y') + OpaqueValue::from<char>('z');
+
+  auto ok = handlers.printf(data);
+  ASSERT_TRUE(bool(ok));
+  EXPECT_EQ(out.str(), "abc wxyz..");
+}
+
+TEST_F(AsyncActionTest, printf_packed_strings_out_of_bounds)
+{
+  std::vector<Field> fields = {
+    Field{ .name = "a",
+           .type = CreateString(16),
+           .offset = 0,
+           .bitfield = std::nullopt },
+  };
+  bpftrace->resources.printf_args.emplace_back(
+      FormatString("%s"), fields, PrintfSeverity::NONE, SourceInfo());
+
+  // The string reaches past the end of the record.
+  auto data = OpaqueValue::from(static_cast<uint64_t>(AsyncAction::printf)) +
+              OpaqueValue::from(AsyncEvent::StringRef{ .offset = 8,
+                                                       .length = 8 }) +
+              OpaqueValue::from(std::string("abc"));
+  auto ok = handlers.printf(data);
+  EXPECT_FALSE(bool(ok));
+  consumeError(std::move(ok));
+
+  // The record is too short to even hold the reference.
+  auto short_ok = handlers.printf(
+      OpaqueValue::from(static_cast<uint64_t>(AsyncAction::printf)) +
+      OpaqueValue::from<uint32_t>(8));
+  EXPECT_FALSE(bool(short_ok));
+  consumeError(std::move(short_ok));
+  EXPECT_EQ(out.str(), "");
+}
+
 TEST_F(AsyncActionTest, print_non_map)
 {
   struct TestCase {
@@ -9,9 +9,14 @@
 
 namespace bpftrace::test::bpfbytecode {
 
-BpfBytecode codegen(const std::string &input)
+BpfBytecode codegen(const std::string &input,
+                    uint64_t compile_jobs = 1,
+                    ConfigOptLevel opt_level = ConfigOptLevel::standard,
+                    size_t *partitions = nullptr)
 {
   auto bpftrace = get_mock_bpftrace();
+  bpftrace->config_->compile_jobs = compile_jobs;
+  bpftrace->config_->opt_level = opt_level;
 
   ast::ASTContext ast("stdin", input);
 
@@ -32,10 +37,38 @@ BpfBytecode codegen(const std::string &input)
   std::stringstream out;
   ast.diagnostics().emit(out);
   EXPECT_TRUE(ast.diagnostics().ok()) << out.str();
+  if (partitions) {
+    *partitions = ok->get<ast::CompiledModule>().partitions;
+  }
   auto &output = ok->get<BpfBytecode>();
   return std::move(output);
 }
 
+// Returns the unoptimized IR for `input`.
+std::string ir(const std::string &input)
+{
+  auto bpftrace = get_mock_bpftrace();
+  ast::ASTContext ast("stdin", input);
+
+  std::stringstream out;
+  auto ok = ast::PassManager()
+                .put(ast)
+                .put<BPFtrace>(*bpftrace)
+                .put(get_mock_function_info())
+                .add(ast::AllParsePasses())
+                .add(ast::CreateLLVMInitPass())
+                .add(ast::CreateClangBuildPass())
+                .add(ast::CreateTypeSystemPass())
+                .add(ast::CreateTypeResolverPass())
+                .add(ast::CreateCompilePass())
+                .add(ast::CreateDumpIRPass(out))
+                .run();
+  if (!ok) {
+    EXPECT_TRUE(bool(ok)) << ok.takeError();
+  }
+  return out.str();
+}
+
 TEST(bpfbytecode, create_programs)
 {
   auto bytecode = codegen("kprobe:f { 1 }");
@@ -53,4 +86,243 @@ TEST(bpfbytecode, create_programs)
             "s_kprobe_f_1");
 }
 
+TEST(bpfbytecode, create_programs_parallel)
+{
+  auto bytecode = codegen("kprobe:f { @a = 1 } kprobe:g { @a = 2 }", 4);
+
+  Probe f;
+  f.type = ProbeType::kprobe;
+  f.name = "kprobe:f";
+  f.index = 1;
+
+  Probe g;
+  g.type = ProbeType::kprobe;
+  g.name = "kprobe:g";
+  g.index = 2;
+
+  EXPECT_EQ(std::string_view{ bpf_program__name(
+                bytecode.getProgramForProbe(f).bpf_prog()) },
+            "kprobe_f_1");
+  EXPECT_EQ(std::string_view{ bpf_program__name(
+                bytecode.getProgramForProbe(g).bpf_prog()) },
+            "kprobe_g_2");
+}
+
+TEST(bpfbytecode, create_programs_parallel_matches_serial)
+{
+  const std::string prog = R"(
+    kprobe:f { @a[tid] = count(); if (pid > 1) { printf("%d\n", pid) } }
+    kprobe:g { @b = hist(arg0); @c[comm] = sum(arg1) }
+    kprobe:h { $x = 0; unroll(4) { $x++ } @d[cpu] = $x }
+  )";
+  size_t partitions = 0;
+  auto serial = codegen(prog, 1);
+  auto parallel = codegen(prog, 3, ConfigOptLevel::standard, &partitions);
+  EXPECT_GT(partitions, 1);
+
+  int index = 1;
+  for (const auto *name : { "kprobe:f", "kprobe:g", "kprobe:h" }) {
+    Probe probe;
+    probe.type = ProbeType::kprobe;
+    probe.name = name;
+    probe.index = index++;
+
+    const auto *a = serial.getProgramForProbe(probe).bpf_prog();
+    const auto *b = parallel.getProgramForProbe(probe).bpf_prog();
+    ASSERT_EQ(bpf_program__insn_cnt(a), bpf_program__insn_cnt(b)) << name;
+
+    // Map and global variable references are only resolved when loading and
+    // their placeholders depend on the section layout, so leave them out.
+    const struct bpf_insn *ia = bpf_program__insns(a);
+    const struct bpf_insn *ib = bpf_program__insns(b);
+    for (size_t i = 0; i < bpf_program__insn_cnt(a); ++i) {
+      EXPECT_EQ(ia[i].code, ib[i].code) << name << " insn " << i;
+      EXPECT_EQ(ia[i].dst_reg, ib[i].dst_reg) << name << " insn " << i;
+      EXPECT_EQ(ia[i].src_reg, ib[i].src_reg) << name << " insn " << i;
+      EXPECT_EQ(ia[i].off, ib[i].off) << name << " insn " << i;
+      if (ia[i].code == (BPF_LD | BPF_IMM | BPF_DW)) {
+        ++i;
+        continue;
+      }
+      EXPECT_EQ(ia[i].imm, ib[i].imm) << name << " insn " << i;
+    }
+  }
+}
+
+TEST(bpfbytecode, create_programs_opt_level)
+{
+  for (auto level : { ConfigOptLevel::fast, ConfigOptLevel::max }) {
+    auto bytecode = codegen(
+        "kprobe:f { $x = 0; unroll(4) { $x++ } @a[pid] = $x }", 1, level);
+
+    Probe f;
+    f.type = ProbeType::kprobe;
+    f.name = "kprobe:f";
+    f.index = 1;
+
+    EXPECT_EQ(std::string_view{ bpf_program__name(
+                  bytecode.getProgramForProbe(f).bpf_prog()) },
+              "kprobe_f_1");
+  }
+}
+
+TEST(bpfbytecode, opt_level_insns)
+{
+  const std::string prog = R"(kprobe:f {
+    $x = 0; unroll(4) { $x++ }
+    @a[pid, comm] = $x;
+    if ($x > 2) { printf("%d %s\n", $x, comm) }
+  })";
+
+  Probe f;
+  f.type = ProbeType::kprobe;
+  f.name = "kprobe:f";
+  f.index = 1;
+
+  std::map<ConfigOptLevel, size_t> insns;
+  for (auto level :
+       { ConfigOptLevel::fast, ConfigOptLevel::standard, ConfigOptLevel::max }) {
+    auto bytecode = codegen(prog, 1, level);
+    insns[level] = bytecode.getProgramForProbe(f).estimate_cost().insns;
+    EXPECT_GT(insns[level], 0);
+  }
+  // The reduced pipeline trades code size for compile time.
+  EXPECT_LE(insns[ConfigOptLevel::standard], insns[ConfigOptLevel::fast]);
+}
+
+static size_t count_helper_calls(const BpfProgram &program, bpf_func_id id)
+{
+  const struct bpf_insn *insns = bpf_program__insns(program.bpf_prog());
+  size_t count = 0;
+  for (size_t i = 0; i < bpf_program__insn_cnt(program.bpf_prog()); ++i) {
+    if (insns[i].code == (BPF_JMP | BPF_CALL) && insns[i].src_reg == 0 &&
+        insns[i].imm == id)
+      count++;
+  }
+  return count;
+}
+
+TEST(bpfbytecode, builtins_computed_once)
+{
+  auto bytecode = codegen(
+      R"(kprobe:f { @[comm] = count(); if (cpu > 1) { printf("%s %d\n", comm, cpu) } })");
+
+  Probe f;
+  f.type = ProbeType::kprobe;
+  f.name = "kprobe:f";
+  f.index = 1;
+
+  auto &program = bytecode.getProgramForProbe(f);
+  EXPECT_EQ(count_helper_calls(program, BPF_FUNC_get_current_comm), 1);
+}
+
+TEST(bpfbytecode, builtins_computed_after_filters)
+{
+  auto bytecode = codegen(
+      R"(kprobe:f /cpu == 1/ { @[comm] = count(); printf("%s\n", comm) })");
+
+  Probe f;
+  f.type = ProbeType::kprobe;
+  f.name = "kprobe:f";
+  f.index = 1;
+
+  // The predicate must be checked before comm is read for the body.
+  auto &program = bytecode.getProgramForProbe(f);
+  const struct bpf_insn *insns = bpf_program__insns(program.bpf_prog());
+  for (size_t i = 0; i < bpf_program__insn_cnt(program.bpf_prog()); ++i) {
+    if (insns[i].code == (BPF_JMP | BPF_CALL) && insns[i].src_reg == 0) {
+      EXPECT_EQ(insns[i].imm, BPF_FUNC_get_smp_processor_id);
+      break;
+    }
+  }
+  EXPECT_EQ(count_helper_calls(program, BPF_FUNC_get_current_comm), 1);
+}
+
+TEST(bpfbytecode, estimate_cost)
+{
+  auto bytecode = codegen(
+      R"(kprobe:f { if (pid > 1) { @a[tid] = count() } else { @b = 1 } })");
+
+  Probe f;
+  f.type = ProbeType::kprobe;
+  f.name = "kprobe:f";
+  f.index = 1;
+
+  auto &program = bytecode.getProgramForProbe(f);
+  auto cost = program.estimate_cost();
+  EXPECT_EQ(cost.insns, bpf_program__insn_cnt(program.bpf_prog()));
+  // Only one of the branches can be taken.
+  EXPECT_GT(cost.longest_path, 0);
+  EXPECT_LT(cost.longest_path, cost.insns);
+  EXPECT_GE(cost.helper_calls, 3);
+  EXPECT_GE(cost.map_ops, 2);
+  EXPECT_GT(cost.stack_bytes, 0);
+}
+
+TEST(bpfbytecode, string_literals_are_constant)
+{
+  auto out = ir(R"(kprobe:f { @a = "abc" })");
+  EXPECT_NE(out.find("@abc = constant [4 x i8]"), std::string::npos) << out;
+}
+
+TEST(bpfbytecode, strncmp_literal_literal)
+{
+  auto out = ir(R"(kprobe:f { @a = strncmp("abc", "abd", 3) })");
+  EXPECT_NE(out.find("strcmp.acc"), std::string::npos) << out;
+  EXPECT_EQ(out.find("strcmp.loop"), std::string::npos) << out;
+}
+
+TEST(bpfbytecode, strncmp_literal_dynamic)
+{
+  auto out = ir(
+      R"(kprobe:f { $s = comm; @a = strncmp($s, "nginx-worker", 64) })");
+  // Only the literal and its NULL terminator are compared: 13 bytes as an
+  // 8, 4 and 1 byte word, in place of the generic word-at-a-time loop.
+  EXPECT_NE(out.find("strcmp.acc"), std::string::npos) << out;
+  EXPECT_EQ(out.find("strcmp.loop"), std::string::npos) << out;
+  EXPECT_NE(out.find("xor i64"), std::string::npos) << out;
+  EXPECT_NE(out.find("xor i32"), std::string::npos) << out;
+  EXPECT_NE(out.find("xor i8"), std::string::npos) << out;
+  EXPECT_EQ(out.find("xor i16"), std::string::npos) << out;
+}
+
+TEST(bpfbytecode, strncmp_literal_length_not_multiple_of_word)
+{
+  auto out = ir(R"(kprobe:f { $s = comm; @a = strncmp($s, "nginx", 5) })");
+  // n cuts the literal before its terminator: 5 bytes as a 4 and 1 byte word.
+  EXPECT_NE(out.find("xor i32"), std::string::npos) << out;
+  EXPECT_NE(out.find("xor i8"), std::string::npos) << out;
+  EXPECT_EQ(out.find("xor i64"), std::string::npos) << out;
+  EXPECT_EQ(out.find("xor i16"), std::string::npos) << out;
+}
+
+TEST(bpfbytecode, strncmp_dynamic)
+{
+  auto out = ir(
+      R"(kprobe:f { $s = comm; $t = comm; @a = strncmp($s, $t, 16) })");
+  EXPECT_NE(out.find("strcmp.loop"), std::string::npos) << out;
+  EXPECT_EQ(out.find("strcmp.acc"), std::string::npos) << out;
+}
+
+TEST(bpfbytecode, estimate_cost_subprog_calls)
+{
+  // Without inlining, the subprogram is called with bpf-to-bpf calls. It is
+  // only appended when loading, so its body is not part of the estimate.
+  auto bytecode = codegen(
+      R"(fn add($a: int64): int64 { return $a + 1 }
+         kprobe:f { @a = add(arg0); @b = add(arg1) })",
+      1,
+      ConfigOptLevel::fast);
+
+  Probe f;
+  f.type = ProbeType::kprobe;
+  f.name = "kprobe:f";
+  f.index = 1;
+
+  auto cost = bytecode.getProgramForProbe(f).estimate_cost();
+  EXPECT_EQ(cost.subprog_calls, 2);
+  EXPECT_EQ(cost.subprograms, 0);
+  EXPECT_LE(cost.longest_path, cost.insns);
+}
+
 } // namespace bpftrace::test::bpfbytecode
@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <vector>
+
+#include "bpfmap.h"
+#include "mocks.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::bpfmap {
+
+using ::testing::_;
+using ::testing::Invoke;
+using ::testing::Return;
+
+// Keys and values are 8 bytes each, the defaults of MockBpfMap.
+static const std::vector<uint64_t> keys = { 1, 2, 3, 4 };
+static const std::vector<uint64_t> values = { 10, 20, 30, 40 };
+
+TEST(bpfmap, update_batch)
+{
+  MockBpfMap map;
+  std::vector<uint64_t> written;
+  EXPECT_CALL(map, update_batch_once(_, _, _))
+      .WillRepeatedly(Invoke(
+          [&](const void *k, const void *, uint32_t *count) -> int {
+            // Write at most 3 elements per call.
+            *count = std::min(*count, 3U);
+            const auto *first = static_cast<const uint64_t *>(k);
+            written.insert(written.end(), first, first + *count);
+            return 0;
+          }));
+  EXPECT_CALL(map, update_elem(_, _)).Times(0);
+
+  auto ok = map.update_batch(keys.data(), values.data(), keys.size());
+  EXPECT_TRUE(bool(ok));
+  EXPECT_EQ(written, keys);
+}
+
+TEST(bpfmap, update_batch_fallback)
+{
+  for (int err : { -EINVAL, -EOPNOTSUPP, -524 /* ENOTSUPP */ }) {
+    MockBpfMap map;
+    std::vector<uint64_t> written;
+    // The kernel fails before writing back the count.
+    EXPECT_CALL(map, update_batch_once(_, _, _)).WillOnce(Return(err));
+    EXPECT_CALL(map, update_elem(_, _))
+        .Times(keys.size())
+        .WillRepeatedly(Invoke([&](const void *k, const void *v) -> Result<> {
+          auto key = *static_cast<const uint64_t *>(k);
+          EXPECT_EQ(*static_cast<const uint64_t *>(v), key * 10);
+          written.push_back(key);
+          return OK();
+        }));
+
+    auto ok = map.update_batch(keys.data(), values.data(), keys.size());
+    EXPECT_TRUE(bool(ok));
+    EXPECT_EQ(written, keys);
+  }
+}
+
+TEST(bpfmap, update_batch_error)
+{
+  MockBpfMap map;
+  EXPECT_CALL(map, update_batch_once(_, _, _))
+      .WillOnce(Invoke([](const void *, const void *, uint32_t *count) {
+        *count = 1;
+        return -E2BIG;
+      }));
+  EXPECT_CALL(map, update_elem(_, _)).Times(0);
+
+  auto ok = map.update_batch(keys.data(), values.data(), keys.size());
+  EXPECT_FALSE(bool(ok));
+  consumeError(std::move(ok));
+}
+
+} // namespace bpftrace::test::bpfmap
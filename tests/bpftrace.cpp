@@ -1,6 +1,7 @@
 #include <chrono>
 #include <cstdint>
 #include <cstring>
+#include <unistd.h>
 
 #include "ast/passes/ap_probe_expansion.h"
 #include "ast/passes/args_resolver.h"
@@ -323,6 +324,29 @@ TEST(bpftrace, add_probes_uprobe_string_offset)
                10);
 }
 
+TEST(bpftrace, add_probes_uprobe_predicate_pid)
+{
+  auto bpftrace = get_strict_mock_bpftrace();
+  parse_probe("uprobe:/bin/sh:f /pid == 1234/ {} "
+              "uprobe:/bin/sh:main /1234 == pid/ {} "
+              "uprobe:/bin/sh:readline /pid == 1234 && arg0/ {} "
+              "uprobe:/bin/sh:first_open /tid == 1234/ {} "
+              "kprobe:sys_read /pid == 1234/ {} "
+              "usdt:/bin/sh:prov1:tp1 /pid == 1234/ {}",
+              *bpftrace);
+
+  ASSERT_EQ(6U, bpftrace->get_probes().size());
+  EXPECT_EQ(1234, bpftrace->get_probes().at(0).filter_pid);
+  EXPECT_EQ(1234, bpftrace->get_probes().at(1).filter_pid);
+  // Only a plain comparison with pid is pushed down.
+  EXPECT_EQ(0, bpftrace->get_probes().at(2).filter_pid);
+  EXPECT_EQ(0, bpftrace->get_probes().at(3).filter_pid);
+  // kprobes can't filter by pid when attaching.
+  EXPECT_EQ(0, bpftrace->get_probes().at(4).filter_pid);
+  // USDT probes with a pid are resolved through the process' mappings.
+  EXPECT_EQ(0, bpftrace->get_probes().at(5).filter_pid);
+}
+
 TEST(bpftrace, add_probes_usdt)
 {
   auto bpftrace = get_strict_mock_bpftrace();
@@ -1464,4 +1488,19 @@ hh:mm:ss.ms  |___________________________________________________|
   }
 }
 
+TEST(bpftrace, prefetch_symbols)
+{
+  // Prefetched symbols are resolved the same way as inline ones.
+  auto bpftrace = get_mock_bpftrace();
+  auto addr = reinterpret_cast<uint64_t>(&::getpid);
+  auto usym = bpftrace->resolve_usym(addr, ::getpid(), -1);
+  auto ksym = bpftrace->resolve_ksym(addr);
+
+  bpftrace->prefetch_usym(addr, ::getpid(), -1);
+  bpftrace->prefetch_ksym(addr);
+  EXPECT_EQ(bpftrace->resolve_usym(addr, ::getpid(), -1), usym);
+  EXPECT_EQ(bpftrace->resolve_ksym(addr), ksym);
+  bpftrace->clear_prefetched_symbols();
+}
+
 } // namespace bpftrace::test::bpftrace
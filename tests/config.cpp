@@ -20,6 +20,9 @@ TEST(Config, set)
   EXPECT_FALSE(config.print_maps_on_exit);
   EXPECT_TRUE(bool(config.set("print_maps_on_exit", "true")));
   EXPECT_TRUE(config.print_maps_on_exit);
+  EXPECT_FALSE(config.intern_stacks);
+  EXPECT_TRUE(bool(config.set("intern_stacks", "true")));
+  EXPECT_TRUE(config.intern_stacks);
 
   // Check that int parsing works.
   EXPECT_TRUE(bool(config.set("log_size", "100")));
@@ -28,8 +31,26 @@ TEST(Config, set)
   EXPECT_EQ(config.log_size, 101);
   EXPECT_FALSE(bool(config.set("log_size", "invalid")));
   EXPECT_EQ(config.log_size, 101);
+  EXPECT_EQ(config.dw_ustack_max_pids, 0);
+  EXPECT_TRUE(bool(config.set("dw_ustack_max_pids", "32")));
+  EXPECT_EQ(config.dw_ustack_max_pids, 32);
+  EXPECT_EQ(config.probe_insn_budget, 0);
+  EXPECT_TRUE(bool(config.set("probe_insn_budget", "200")));
+  EXPECT_EQ(config.probe_insn_budget, 200);
+  EXPECT_EQ(config.probe_stats_interval, 0);
+  EXPECT_TRUE(bool(config.set("probe_stats_interval", "5")));
+  EXPECT_EQ(config.probe_stats_interval, 5);
+  EXPECT_EQ(config.max_user_symbol_caches, 1024);
+  EXPECT_TRUE(bool(config.set("max_user_symbol_caches", "16")));
+  EXPECT_EQ(config.max_user_symbol_caches, 16);
+  EXPECT_EQ(config.max_user_symbol_cache_bytes, 256 * 1024 * 1024);
+  EXPECT_TRUE(bool(config.set("max_user_symbol_cache_bytes", "4096")));
+  EXPECT_EQ(config.max_user_symbol_cache_bytes, 4096);
 
   // Check that string parsing works.
+  EXPECT_EQ(config.dw_ustack_cache_dir, "");
+  EXPECT_TRUE(bool(config.set("dw_ustack_cache_dir", "/tmp/dwunwind")));
+  EXPECT_EQ(config.dw_ustack_cache_dir, "/tmp/dwunwind");
   EXPECT_TRUE(bool(config.set("str_trunc_trailer", "oh, no! we lost bytes!")));
   EXPECT_EQ(config.str_trunc_trailer, "oh, no! we lost bytes!");
   EXPECT_TRUE(bool(config.set("str_trunc_trailer", 0)));
@@ -51,6 +72,14 @@ TEST(Config, set)
   EXPECT_FALSE(bool(config.set("missing_probes", "invalid")));
   EXPECT_TRUE(bool(config.set("missing_probes", "warn")));
   EXPECT_EQ(config.missing_probes, ConfigMissingProbes::warn);
+
+  EXPECT_EQ(config.opt_level, ConfigOptLevel::standard);
+  EXPECT_FALSE(bool(config.set("opt_level", "invalid")));
+  EXPECT_FALSE(bool(config.set("opt_level", 3)));
+  EXPECT_TRUE(bool(config.set("opt_level", "fast")));
+  EXPECT_EQ(config.opt_level, ConfigOptLevel::fast);
+  EXPECT_TRUE(bool(config.set("opt_level", "MAX")));
+  EXPECT_EQ(config.opt_level, ConfigOptLevel::max);
 }
 
 TEST(Config, key_finding)
@@ -186,6 +186,11 @@ void tcp_shutdown(struct sock *sk, int how)
 {
 }
 
+// Passes a record by value, which embeds another record.
+void value_arg(struct Foo2 foo2)
+{
+}
+
 // kernel percpu variables
 __attribute__((section(".data..percpu"))) unsigned long process_counts;
 
@@ -198,6 +203,7 @@ int main(void)
   struct bpf_iter__task_vma iter_task_vma;
   struct bpf_map bpf_map;
   struct sock sk;
+  struct Foo2 foo2 = {};
   enum FooEnum e;
 
   func_1(0, 0, 0, 0, 0);
@@ -208,5 +214,6 @@ int main(void)
   bpf_map_sum_elem_count(&bpf_map);
   __probestub_event_rt((void *)&bpf_map, 1);
   tcp_shutdown(&sk, 0);
+  value_arg(foo2);
   return 0;
 }
@@ -0,0 +1,37 @@
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+#include "dwarf/dwunwind.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::dwunwind {
+
+using Feed = std::tuple<TableType, uint32_t, std::vector<uint8_t>>;
+
+static std::vector<Feed> build_tables(size_t jobs)
+{
+  std::vector<Feed> fed;
+  DWARFUnwind unwind([&](TableType type,
+                         uint32_t key,
+                         const std::vector<uint8_t> &value) {
+    fed.emplace_back(type, key, value);
+    return 0;
+  });
+  unwind.set_jobs(jobs);
+  EXPECT_EQ(unwind.add_pid(getpid(), /* skip_failed_files */ true),
+            DWARFError::Success);
+  return fed;
+}
+
+TEST(dwunwind, parallel_matches_serial)
+{
+  // The test binary maps several objects, so they are compiled on different
+  // threads. Ids are handed out in mapping order regardless.
+  auto serial = build_tables(1);
+  auto parallel = build_tables(4);
+  EXPECT_FALSE(serial.empty());
+  EXPECT_TRUE(serial == parallel);
+}
+
+} // namespace bpftrace::test::dwunwind
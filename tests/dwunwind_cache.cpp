@@ -0,0 +1,110 @@
+#include <filesystem>
+
+#include "dwarf/dwunwind_cache.h"
+#include "util/temp.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::dwunwind_cache {
+
+static std::vector<uint8_t> make_tables(size_t num_entries)
+{
+  std::vector<std::vector<uint8_t>> expressions = {
+    std::vector<uint8_t>(EXPRESSION_SIZE, 1),
+    std::vector<uint8_t>(EXPRESSION_SIZE, 2),
+  };
+  std::vector<std::vector<uint8_t>> entries;
+  for (size_t i = 0; i < num_entries; i++)
+    entries.emplace_back(CFT_ENTRY_SIZE, static_cast<uint8_t>(i));
+  std::map<uint64_t, uint32_t> rows = {
+    { 0x1000, 1 },
+    { 0x1010, 2 },
+    { 0x1020, 0 },
+  };
+  return ObjectUnwindTables::serialize(expressions, entries, rows);
+}
+
+TEST(dwunwind_cache, roundtrip)
+{
+  // An odd number of cft entries needs padding before the rows.
+  for (size_t num_entries : { 2, 3 }) {
+    auto data = make_tables(num_entries);
+    auto tables = ObjectUnwindTables::parse(data);
+    ASSERT_TRUE(tables.has_value());
+
+    EXPECT_EQ(tables->num_expressions(), 2);
+    EXPECT_EQ(tables->expression(1)[0], 2);
+    EXPECT_EQ(tables->num_entries(), num_entries);
+    EXPECT_EQ(tables->entry(1)[CFT_ENTRY_SIZE - 1], 1);
+    ASSERT_EQ(tables->rows().size(), 3);
+    EXPECT_EQ(tables->rows()[1].file_offset, 0x1010);
+    EXPECT_EQ(tables->rows()[1].entry, 2);
+    EXPECT_EQ(tables->rows()[2].entry, 0);
+  }
+}
+
+TEST(dwunwind_cache, invalid)
+{
+  auto data = make_tables(2);
+  EXPECT_FALSE(ObjectUnwindTables::parse({}).has_value());
+
+  auto truncated = data;
+  truncated.pop_back();
+  EXPECT_FALSE(ObjectUnwindTables::parse(truncated).has_value());
+
+  auto bad_magic = data;
+  bad_magic[0] = 'X';
+  EXPECT_FALSE(ObjectUnwindTables::parse(bad_magic).has_value());
+}
+
+TEST(dwunwind_cache, store_and_load)
+{
+  auto dir = util::TempDir::create();
+  ASSERT_TRUE(bool(dir));
+  UnwindTableCache cache(dir->path() / "cache");
+
+  EXPECT_EQ(cache.load("abcdef"), nullptr);
+
+  auto data = make_tables(3);
+  cache.store("abcdef", data);
+  auto buf = cache.load("abcdef");
+  ASSERT_NE(buf, nullptr);
+  std::vector<uint8_t> loaded(buf->getBufferStart(), buf->getBufferEnd());
+  EXPECT_EQ(loaded, data);
+  EXPECT_EQ(cache.load("012345"), nullptr);
+}
+
+TEST(dwunwind_cache, untrusted)
+{
+  namespace fs = std::filesystem;
+  auto dir = util::TempDir::create();
+  ASSERT_TRUE(bool(dir));
+  auto cache_dir = dir->path() / "cache";
+  UnwindTableCache cache(cache_dir);
+
+  auto data = make_tables(2);
+  cache.store("abcdef", data);
+  EXPECT_EQ(fs::status(cache_dir).permissions() & fs::perms::all,
+            fs::perms(0755));
+  EXPECT_EQ(fs::status(cache_dir / "abcdef.dwu").permissions() &
+                fs::perms::all,
+            fs::perms(0644));
+  ASSERT_NE(cache.load("abcdef"), nullptr);
+
+  // Files that others could have written are ignored.
+  fs::permissions(cache_dir / "abcdef.dwu",
+                  fs::perms::others_write,
+                  fs::perm_options::add);
+  EXPECT_EQ(cache.load("abcdef"), nullptr);
+  fs::permissions(cache_dir / "abcdef.dwu",
+                  fs::perms::others_write,
+                  fs::perm_options::remove);
+  ASSERT_NE(cache.load("abcdef"), nullptr);
+
+  // And so is everything in a directory that others can write to.
+  fs::permissions(cache_dir, fs::perms::group_write, fs::perm_options::add);
+  EXPECT_EQ(cache.load("abcdef"), nullptr);
+  cache.store("012345", data);
+  EXPECT_FALSE(fs::exists(cache_dir / "012345.dwu"));
+}
+
+} // namespace bpftrace::test::dwunwind_cache
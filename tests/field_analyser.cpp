@@ -310,6 +310,95 @@ TEST_F(field_analyser_btf, btf_types_arr_access)
   ASSERT_EQ(foo3->fields.size(), 2U); // fields are resolved
 }
 
+TEST_F(field_analyser_btf, btf_types_nested_lazy)
+{
+  auto bpftrace = get_mock_bpftrace();
+  test(*bpftrace,
+       "kprobe:sys_read {\n"
+       "  @ = ((struct Foo2 *) ctx)->a;\n"
+       "}",
+       true);
+
+  // Only the fields of the accessed record are resolved, not the fields of
+  // the records embedded in it.
+  auto foo2 = bpftrace->structs.Lookup("struct Foo2").lock();
+  auto foo1 = bpftrace->structs.Lookup("struct Foo1").lock();
+  ASSERT_TRUE(foo2);
+  ASSERT_TRUE(foo1);
+  ASSERT_TRUE(foo2->HasField("f"));
+  EXPECT_EQ(foo1->fields.size(), 0U);
+}
+
+TEST_F(field_analyser_btf, btf_types_nested_value)
+{
+  auto bpftrace = get_mock_bpftrace();
+  test(*bpftrace,
+       "kprobe:sys_read {\n"
+       "  @ = *((struct Foo2 *) ctx);\n"
+       "}",
+       true);
+
+  // The record is used as a whole, so embedded records must be resolved.
+  auto foo1 = bpftrace->structs.Lookup("struct Foo1").lock();
+  ASSERT_TRUE(foo1);
+  EXPECT_EQ(foo1->fields.size(), 3U);
+}
+
+TEST_F(field_analyser_btf, btf_types_nested_value_repeated)
+{
+  auto bpftrace = get_mock_bpftrace();
+  test(*bpftrace,
+       "kprobe:sys_read {\n"
+       "  @a = ((struct Foo2 *) ctx)->a;\n"
+       "  @b = *((struct Foo2 *) ctx);\n"
+       "  @c = *((struct Foo2 *) ctx);\n"
+       "}",
+       true);
+
+  // The tree is only walked once, but stays complete for every use.
+  auto foo2 = bpftrace->structs.Lookup("struct Foo2").lock();
+  auto foo1 = bpftrace->structs.Lookup("struct Foo1").lock();
+  ASSERT_TRUE(foo2);
+  ASSERT_TRUE(foo1);
+  EXPECT_TRUE(foo2->HasField("f"));
+  EXPECT_EQ(foo1->fields.size(), 3U);
+}
+
+TEST_F(field_analyser_btf, btf_types_nested_args)
+{
+  // An argument's fields are resolved, but not the records embedded in it.
+  auto bpftrace = get_mock_bpftrace();
+  test(*bpftrace, "fentry:value_arg { @ = args.foo2.a; }", true);
+  auto foo1 = bpftrace->structs.Lookup("struct Foo1").lock();
+  ASSERT_TRUE(foo1);
+  EXPECT_EQ(foo1->fields.size(), 0U);
+
+  // The arguments are used as a whole, so embedded records must be resolved.
+  for (const auto *prog : { "fentry:value_arg { print(args); }",
+                            "fentry:value_arg { $a = args; }" }) {
+    bpftrace = get_mock_bpftrace();
+    test(*bpftrace, prog, true);
+    foo1 = bpftrace->structs.Lookup("struct Foo1").lock();
+    ASSERT_TRUE(foo1) << prog;
+    EXPECT_EQ(foo1->fields.size(), 3U) << prog;
+  }
+}
+
+TEST_F(field_analyser_btf, btf_types_nested_access)
+{
+  auto bpftrace = get_mock_bpftrace();
+  test(*bpftrace,
+       "kprobe:sys_read {\n"
+       "  @ = ((struct Foo2 *) ctx)->f.c;\n"
+       "}",
+       true);
+
+  auto foo1 = bpftrace->structs.Lookup("struct Foo1").lock();
+  ASSERT_TRUE(foo1);
+  ASSERT_TRUE(foo1->HasField("c"));
+  EXPECT_EQ(foo1->GetField("c").offset, 8);
+}
+
 TEST_F(field_analyser_btf, btf_types_anon_structs)
 {
   auto bpftrace = get_strict_mock_bpftrace();
@@ -328,7 +417,8 @@ TEST_F(field_analyser_btf, btf_types_anon_structs)
   EXPECT_EQ(typedefarray.GetSize(), 32);
   EXPECT_TRUE(typedefarray.GetElementTy().IsCTypeTy());
   EXPECT_TRUE(typedefarray.GetElementTy().IsAnonTy());
-  EXPECT_TRUE(typedefarray.GetElementTy().HasField("a"));
+  // Not accessed by the script, so its fields are not resolved
+  EXPECT_EQ(typedefarray.GetElementTy().GetFieldCount(), 0);
 
   ASSERT_TRUE(anonstruct->HasField("AnonArray"));
   auto structarray = anonstruct->GetField("AnonArray").type;
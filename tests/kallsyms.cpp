@@ -0,0 +1,95 @@
+#include <sstream>
+
+#include "symbols/kallsyms.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::kallsyms {
+
+using symbols::Kallsyms;
+
+static Kallsyms parse(const std::string &kallsyms, const std::string &modules)
+{
+  std::istringstream kallsyms_in(kallsyms);
+  std::istringstream modules_in(modules);
+  return Kallsyms::parse(kallsyms_in, modules_in);
+}
+
+TEST(kallsyms, lookup)
+{
+  auto table = parse("ffffffff81000000 T _stext\n"
+                     "ffffffff81000100 T schedule\n"
+                     "ffffffff81000100 t schedule_alias\n"
+                     "ffffffffc0002000 t mod_exit\t[mod]\n"
+                     "ffffffffc0001000 t mod_init\t[mod]\n"
+                     "ffffffffa0000000 t bpf_prog_1234_f\t[bpf]\n"
+                     "0000000000000000 A restricted\n",
+                     "mod 12288 0 - Live 0xffffffffc0001000\n");
+  EXPECT_EQ(table.size(), 5);
+
+  EXPECT_FALSE(table.lookup(0x1000));
+
+  auto sym = table.lookup(0xffffffff81000010);
+  ASSERT_TRUE(sym);
+  EXPECT_EQ(sym->name, "_stext");
+  EXPECT_EQ(sym->module, "vmlinux");
+  EXPECT_EQ(sym->offset, 0x10);
+
+  // The first symbol listed at an address wins.
+  sym = table.lookup(0xffffffff81000100);
+  ASSERT_TRUE(sym);
+  EXPECT_EQ(sym->name, "schedule");
+  EXPECT_EQ(sym->offset, 0);
+
+  // Out of order symbols are sorted.
+  sym = table.lookup(0xffffffffc0001008);
+  ASSERT_TRUE(sym);
+  EXPECT_EQ(sym->name, "mod_init");
+  EXPECT_EQ(sym->module, "mod");
+  sym = table.lookup(0xffffffffc0002008);
+  ASSERT_TRUE(sym);
+  EXPECT_EQ(sym->name, "mod_exit");
+
+  // Past the end of the module.
+  EXPECT_FALSE(table.lookup(0xffffffffc0004000));
+
+  // No range is known for BPF programs.
+  sym = table.lookup(0xffffffffa0000040);
+  ASSERT_TRUE(sym);
+  EXPECT_EQ(sym->name, "bpf_prog_1234_f");
+  EXPECT_EQ(sym->module, "bpf");
+}
+
+TEST(kallsyms, address)
+{
+  auto table = parse("ffffffff81000000 T _stext\n"
+                     "ffffffff81000100 D some_var\n",
+                     "");
+  EXPECT_EQ(table.address("some_var"), 0xffffffff81000100);
+  EXPECT_EQ(table.address("_stext"), 0xffffffff81000000);
+  EXPECT_EQ(table.address("missing"), 0);
+}
+
+TEST(kallsyms, address_of_alias)
+{
+  auto table = parse("ffffffff81000100 T schedule\n"
+                     "ffffffff81000000 T _stext\n"
+                     "ffffffff81000100 t schedule_alias\n"
+                     "ffffffffc0001000 t dup\t[mod]\n"
+                     "ffffffff81000200 t dup\n",
+                     "");
+  // Aliases are not used for address lookups, but can still be resolved.
+  EXPECT_EQ(table.lookup(0xffffffff81000100)->name, "schedule");
+  EXPECT_EQ(table.address("schedule_alias"), 0xffffffff81000100);
+  EXPECT_EQ(table.address("schedule"), 0xffffffff81000100);
+  // The first one listed wins.
+  EXPECT_EQ(table.address("dup"), 0xffffffffc0001000);
+}
+
+TEST(kallsyms, empty)
+{
+  auto table = parse("", "");
+  EXPECT_EQ(table.size(), 0);
+  EXPECT_FALSE(table.lookup(0xffffffff81000000));
+}
+
+} // namespace bpftrace::test::kallsyms
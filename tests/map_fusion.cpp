@@ -0,0 +1,112 @@
+#include "ast/passes/map_fusion.h"
+#include "ast/passes/parse_passes.h"
+#include "ast/passes/resource_analyser.h"
+#include "ast/passes/types/type_resolver.h"
+#include "mocks.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::map_fusion {
+
+static RequiredResources test(const std::string &input)
+{
+  auto bpftrace = get_mock_bpftrace();
+  ast::ASTContext ast("stdin", input);
+  ast::TypeMetadata no_types; // No external types defined.
+
+  auto ok = ast::PassManager()
+                .put(ast)
+                .put<BPFtrace>(*bpftrace)
+                .put(get_mock_function_info())
+                .put(no_types)
+                .add(ast::AllParsePasses())
+                .add(ast::CreateTypeResolverPass())
+                .add(ast::CreateResourcePass())
+                .add(ast::CreateMapFusionPass())
+                .run();
+  EXPECT_TRUE(ok && ast.diagnostics().ok()) << input;
+  return std::move(bpftrace->resources);
+}
+
+static std::string fused_map(const RequiredResources &resources,
+                             const std::string &map)
+{
+  return resources.maps_info.at(map).fused_map;
+}
+
+TEST(map_fusion, co_keyed_aggregations)
+{
+  auto resources = test(
+      R"(kprobe:f { @a[pid] = count(); @b[pid] = sum(arg0); @c[pid] = max(arg1); })");
+  ASSERT_EQ(resources.fused_maps_info.size(), 1);
+  EXPECT_EQ(fused_map(resources, "@a"), "fused_0");
+  EXPECT_EQ(fused_map(resources, "@b"), "fused_0");
+  EXPECT_EQ(fused_map(resources, "@c"), "fused_0");
+
+  // count and sum take one word each, max takes two.
+  EXPECT_EQ(resources.maps_info.at("@a").fused_offset, 0);
+  EXPECT_EQ(resources.maps_info.at("@b").fused_offset, 8);
+  EXPECT_EQ(resources.maps_info.at("@c").fused_offset, 16);
+  const auto &fused = resources.fused_maps_info.at("fused_0");
+  EXPECT_EQ(fused.value_type.GetSize(), 32);
+  EXPECT_EQ(fused.key_type, resources.maps_info.at("@a").key_type);
+}
+
+TEST(map_fusion, different_keys)
+{
+  auto resources = test(R"(kprobe:f { @a[pid] = count(); @b[tid] = count(); })");
+  EXPECT_TRUE(resources.fused_maps_info.empty());
+  EXPECT_EQ(fused_map(resources, "@a"), "");
+}
+
+TEST(map_fusion, not_consecutive)
+{
+  auto resources = test(
+      R"(kprobe:f { @a[pid] = count(); $x = 1; @b[pid] = count(); })");
+  EXPECT_TRUE(resources.fused_maps_info.empty());
+}
+
+TEST(map_fusion, different_key_sets)
+{
+  // @b is updated without @a elsewhere, so the maps could hold different keys.
+  auto resources = test(R"(kprobe:f { @a[pid] = count(); @b[pid] = count(); }
+                           kprobe:g { @b[pid] = count(); })");
+  EXPECT_TRUE(resources.fused_maps_info.empty());
+}
+
+TEST(map_fusion, same_set_in_several_probes)
+{
+  auto resources = test(R"(kprobe:f { @a[pid] = count(); @b[pid] = sum(arg0); }
+                           kprobe:g { @b[tid] = sum(arg1); @a[tid] = count(); })");
+  EXPECT_EQ(resources.fused_maps_info.size(), 1);
+}
+
+TEST(map_fusion, other_uses)
+{
+  auto resources = test(
+      R"(kprobe:f { @a[pid] = count(); @b[pid] = count(); } end { print(@a); })");
+  EXPECT_TRUE(resources.fused_maps_info.empty());
+
+  resources = test(
+      R"(kprobe:f { @a[pid] = count(); @b[pid] = count(); @c = @b[1]; })");
+  EXPECT_TRUE(resources.fused_maps_info.empty());
+}
+
+TEST(map_fusion, unstable_values)
+{
+  auto resources = test(
+      R"(kprobe:f { @a[pid] = sum(nsecs); @b[pid] = count(); })");
+  EXPECT_TRUE(resources.fused_maps_info.empty());
+
+  resources = test(
+      R"(kprobe:f { $x = 0; @a[pid] = sum($x++); @b[pid] = count(); })");
+  EXPECT_TRUE(resources.fused_maps_info.empty());
+}
+
+TEST(map_fusion, unsupported_aggregations)
+{
+  auto resources = test(
+      R"(kprobe:f { @a[pid] = count(); @b[pid] = hist(arg0); })");
+  EXPECT_TRUE(resources.fused_maps_info.empty());
+}
+
+} // namespace bpftrace::test::map_fusion
@@ -36,6 +36,7 @@ static symbols::ModulesFuncsMap make_mock_functions()
                                              "sys_read",
                                              "sys_write",
                                              "tcp_shutdown",
+                                             "value_arg",
                                              "queued_spin_lock_slowpath",
                                              "bpf_map_sum_elem_count",
                                              "bpf_iter_task",
@@ -52,6 +52,12 @@ public:
                                           int nvalues));
   MOCK_CONST_METHOD2(collect_tseries_data,
                      Result<TSeriesMap>(const MapInfo &map_info, int nvalues));
+  MOCK_CONST_METHOD2(update_elem,
+                     Result<>(const void *key, const void *value));
+  MOCK_CONST_METHOD3(update_batch_once,
+                     int(const void *keys,
+                         const void *values,
+                         uint32_t *count));
 };
 
 class MockBPFtrace : public BPFtrace {
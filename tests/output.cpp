@@ -2,8 +2,11 @@
 
 #include "bpfmap.h"
 #include "mocks.h"
+#include "output/folded.h"
+#include "output/json.h"
 #include "output/text.h"
 #include "types_format.h"
+#include "gmock/gmock-matchers.h"
 #include "gtest/gtest.h"
 
 namespace bpftrace::test::output {
@@ -156,4 +159,150 @@ TEST(TextOutput, lhist_underflow_only)
             out.str());
 }
 
+static std::vector<::bpftrace::output::ProbeStats> probe_stats()
+{
+  using namespace std::chrono_literals;
+  return {
+    { .probe = "kprobe:f", .events = 2000, .run_time = 500000ns, .period = 2s },
+    { .probe = "tracepoint:a:b", .events = 0, .run_time = 0ns, .period = 2s },
+  };
+}
+
+TEST(TextOutput, probe_stats)
+{
+  std::stringstream out;
+  ::bpftrace::output::TextOutput output(out, out);
+  output.probe_stats(probe_stats());
+
+  auto header = std::string("Probe") + std::string(36, ' ') +
+                "Events         Events/s       ns/event\n";
+  EXPECT_EQ(out.str(),
+            header + std::string(79, '-') + "\n" + "kprobe:f" +
+                std::string(33, ' ') + "2000           1000.0         250.0\n" +
+                "tracepoint:a:b" + std::string(27, ' ') +
+                "0              0.0            0.0\n\n");
+}
+
+TEST(JsonOutput, probe_stats)
+{
+  std::stringstream out;
+  ::bpftrace::output::JsonOutput output(out);
+  output.probe_stats(probe_stats());
+
+  EXPECT_THAT(out.str(), testing::StartsWith(R"({"type": "probe_stats")"));
+  EXPECT_THAT(out.str(), testing::HasSubstr(R"("probe": "kprobe:f")"));
+  EXPECT_THAT(out.str(), testing::HasSubstr(R"("events": 2000)"));
+  EXPECT_THAT(out.str(), testing::HasSubstr(R"("run_time_ns": 500000)"));
+  EXPECT_THAT(out.str(), testing::HasSubstr(R"("events_per_sec": 1000)"));
+  EXPECT_THAT(out.str(), testing::HasSubstr(R"("ns_per_event": 250)"));
+  EXPECT_THAT(out.str(), testing::HasSubstr(R"("probe": "tracepoint:a:b")"));
+}
+
+TEST(TextOutput, symbol_cache_stats)
+{
+  std::stringstream out;
+  ::bpftrace::output::TextOutput output(out, out);
+  output.symbol_cache_stats(
+      { .hits = 10, .misses = 2, .evictions = 1, .entries = 1 });
+
+  EXPECT_EQ(out.str(),
+            "User symbol cache: 10 hits, 2 misses, 1 evictions, 1 entries\n\n");
+}
+
+TEST(JsonOutput, symbol_cache_stats)
+{
+  std::stringstream out;
+  ::bpftrace::output::JsonOutput output(out);
+  output.symbol_cache_stats(
+      { .hits = 10, .misses = 2, .evictions = 1, .entries = 1 });
+
+  EXPECT_THAT(out.str(),
+              testing::StartsWith(R"({"type": "symbol_cache_stats")"));
+  EXPECT_THAT(out.str(), testing::HasSubstr(R"("hits": 10)"));
+  EXPECT_THAT(out.str(), testing::HasSubstr(R"("misses": 2)"));
+  EXPECT_THAT(out.str(), testing::HasSubstr(R"("evictions": 1)"));
+}
+
+TEST(FoldedOutput, stacks)
+{
+  std::stringstream out;
+  std::map<std::string, MapInfo> maps_info;
+  maps_info["@"] = MapInfo{
+    .key_type = CreateTuple(Struct::CreateTuple(
+        { CreateStack(true), CreateStack(false), CreateString(16) })),
+    .value_type = CreateCount(),
+  };
+  maps_info["@single"] = MapInfo{
+    .key_type = CreateStack(true),
+    .value_type = CreateCount(),
+  };
+  ::bpftrace::output::FoldedOutput output(maps_info, out, out);
+
+  using ::bpftrace::output::Primitive;
+  using ::bpftrace::output::Value;
+  Value::OrderedMap m;
+  m.values.emplace_back(
+      Primitive::Tuple{ { std::string("\n        schedule+8\n        "
+                                      "do_nanosleep+16\n"),
+                          std::string("\n        nanosleep+4\n        "
+                                      "spin+37@/src/main.c:14\n"),
+                          std::string("sleep") } },
+      Primitive(uint64_t(3)));
+  output.map("@", m);
+
+  Value::OrderedMap single;
+  single.values.emplace_back(std::string("\n        f\n        g\n"),
+                             Primitive(int64_t(5)));
+  output.map("@single", single);
+
+  EXPECT_EQ(out.str(),
+            "sleep;spin@/src/main.c:14;nanosleep;do_nanosleep;schedule 3\n"
+            "g;f 5\n");
+}
+
+TEST(FoldedOutput, multiline_strings_are_not_stacks)
+{
+  std::stringstream out;
+  std::map<std::string, MapInfo> maps_info;
+  maps_info["@"] = MapInfo{
+    .key_type = CreateString(16),
+    .value_type = CreateCount(),
+  };
+  ::bpftrace::output::FoldedOutput output(maps_info, out, out);
+
+  using ::bpftrace::output::Primitive;
+  using ::bpftrace::output::Value;
+  Value::OrderedMap m;
+  m.values.emplace_back(std::string("a+1\nb"), Primitive(uint64_t(2)));
+  output.map("@", m);
+
+  EXPECT_EQ(out.str(), "a+1\nb 2\n");
+}
+
+TEST(FoldedOutput, fallback_to_err)
+{
+  std::stringstream folded_out;
+  std::stringstream folded_err;
+  std::stringstream text_out;
+  std::map<std::string, MapInfo> maps_info;
+  maps_info["@"] = MapInfo{
+    .key_type = CreateString(16),
+    .value_type = CreateString(16),
+  };
+  ::bpftrace::output::FoldedOutput folded(maps_info, folded_out, folded_err);
+  ::bpftrace::output::TextOutput text(text_out, text_out);
+
+  using ::bpftrace::output::Primitive;
+  using ::bpftrace::output::Value;
+  Value::OrderedMap m;
+  m.values.emplace_back(std::string("a"), Primitive(std::string("b")));
+  folded.map("@", m);
+  text.map("@", m);
+  folded.map("@x", Primitive(uint64_t(1)));
+  text.map("@x", Primitive(uint64_t(1)));
+
+  EXPECT_EQ(folded_out.str(), "");
+  EXPECT_EQ(folded_err.str(), text_out.str());
+}
+
 } // namespace bpftrace::test::output
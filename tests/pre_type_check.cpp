@@ -403,6 +403,11 @@ TEST(CallPreCheck, nargs)
   test("kprobe:f { @x = count(); clear(@x, 1); }",
        "clear() requires one argument (2 provided)");
 
+  // rotate
+  test("kprobe:f { @x = count(); rotate(@x); }");
+  test("kprobe:f { @x = count(); rotate(@x, 1); }",
+       "rotate() requires one argument (2 provided)");
+
   // zero
   test("kprobe:f { @x = count(); zero(@x); }");
   test("kprobe:f { @x = count(); zero(@x, 1); }",
@@ -593,12 +598,15 @@ TEST(CallPreCheck, raw_map_arg_funcs)
 {
   test("kprobe:f { @x[1,2] = count(); clear(@x); }");
   test("kprobe:f { @x[1,2] = count(); zero(@x); }");
+  test("kprobe:f { @x[1,2] = count(); rotate(@x); }");
 
   // Errors
   test("kprobe:f { @x[1,2] = count(); clear(@x[3,4]); }",
        "expects a map argument");
   test("kprobe:f { @x[1,2] = count(); zero(@x[3,4]); }",
        "expects a map argument");
+  test("kprobe:f { @x[1,2] = count(); rotate(@x[3,4]); }",
+       "expects a map argument");
 }
 
 TEST(MapPreCheck, no_meta_map_assignments)
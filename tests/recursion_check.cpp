@@ -1,3 +1,5 @@
+#include <sstream>
+
 #include "ast/passes/recursion_check.h"
 #include "ast/passes/attachpoint_passes.h"
 #include "mocks.h"
@@ -6,13 +8,17 @@
 
 namespace bpftrace::test::recursion_check {
 
-void test(const std::string& input, bool has_recursion_check)
+void test(const std::string& input,
+          bool has_recursion_check,
+          const std::string& expected_warning = "")
 {
   auto mock_bpftrace = get_mock_bpftrace();
   BPFtrace& bpftrace = *mock_bpftrace;
 
   ast::ASTContext ast("stdin", input);
 
+  std::stringstream out;
+  auto* cerr_buf = std::cerr.rdbuf(out.rdbuf());
   auto ok = ast::PassManager()
                 .put(ast)
                 .put(bpftrace)
@@ -21,8 +27,12 @@ void test(const std::string& input, bool has_recursion_check)
                 .add(ast::CreateParseAttachpointsPass())
                 .add(ast::CreateRecursionCheckPass())
                 .run();
+  std::cerr.rdbuf(cerr_buf);
   ASSERT_TRUE(ok && ast.diagnostics().ok());
   EXPECT_EQ(bpftrace.need_recursion_check_, has_recursion_check);
+  EXPECT_EQ(out.str().empty(), !has_recursion_check);
+  if (!expected_warning.empty())
+    EXPECT_EQ(out.str(), expected_warning);
 }
 
 TEST(recursion_check, has_check)
@@ -35,4 +45,20 @@ TEST(recursion_check, has_check)
   test("fentry:otherfunc { 1 }", false);
 }
 
+TEST(recursion_check, warning)
+{
+  const std::string warning =
+      "WARNING: Attaching to dangerous function: "
+      "vmlinux:queued_spin_lock_slowpath. bpftrace has added mitigations to "
+      "prevent a kernel deadlock but they may result in some lost events.\n";
+  test("fentry:vmlinux:queued_spin_lock_slowpath { 1 }", true, warning);
+  // The warning is only emitted once per program.
+  test("fentry:vmlinux:queued_spin_lock_slowpath { 1 } "
+       "fexit:vmlinux:queued_spin_lock_slowpath { 1 }",
+       true,
+       warning);
+  // kprobes are protected by the kernel itself.
+  test("kprobe:queued_spin_lock_slowpath { 1 }", false);
+}
+
 } // namespace bpftrace::test::recursion_check
@@ -66,57 +66,81 @@ TEST(resource_analyser, printf_in_subprog)
   test(R"(fn greet(): void { printf("Hello, world\n"); })", true);
 }
 
-TEST(resource_analyser, fmt_string_args_size_ints)
+TEST(resource_analyser, fmt_string_args_offsets_ints)
 {
   RequiredResources resources;
   test(R"(begin { printf("%d %d", 3, 4) })", true, &resources);
-  EXPECT_EQ(resources.max_fmtstring_args_size, 16);
+  ASSERT_EQ(resources.printf_args.size(), 1);
+  const auto &fields = std::get<1>(resources.printf_args.at(0));
+  ASSERT_EQ(fields.size(), 2);
+  // Integer literals are typed by value, so both arguments are u8.
+  EXPECT_EQ(fields.at(0).offset, 0);
+  EXPECT_EQ(fields.at(1).offset, 1);
 }
 
-TEST(resource_analyser, fmt_string_args_below_on_stack_limit)
+TEST(resource_analyser, fmt_string_args_packed_strings)
 {
   RequiredResources resources;
-  test(R"(begin { printf("%d %d", 3, 4) })", true, &resources, 32);
-  EXPECT_EQ(resources.max_fmtstring_args_size, 0);
+  test(R"(begin { printf("%s %d", "abc", 1) })", true, &resources);
+  ASSERT_EQ(resources.printf_args.size(), 1);
+  const auto &fields = std::get<1>(resources.printf_args.at(0));
+  ASSERT_EQ(fields.size(), 2);
+  EXPECT_EQ(fields.at(0).type, CreateString(4));
+  EXPECT_EQ(fields.at(0).offset, 0);
+  EXPECT_EQ(fields.at(1).offset, 8);
+
+  // Id, fixed-size arguments and then the string, rounded up.
+  EXPECT_EQ(resources.max_fmtstring_args_size, 32);
 }
 
-TEST(resource_analyser, fmt_string_args_size_arrays)
+TEST(resource_analyser, fmt_string_args_strings_above_on_stack_limit)
 {
+  // Records with strings are written at variable offsets, which is only
+  // allowed for the scratch buffer, however small they are.
   RequiredResources resources;
-  test(
-      R"(struct Foo { int a; char b[10]; } begin { $foo = (struct Foo *)0; $foo2 = (struct Foo *)1; printf("%d %s %d %s\n", $foo->a, $foo->b, $foo2->a, $foo2->b) })",
-      true,
-      &resources);
-  EXPECT_EQ(resources.max_fmtstring_args_size, 40);
+  test(R"(begin { printf("%s", "abc") })", true, &resources, 1024);
+  EXPECT_EQ(resources.max_fmtstring_args_size, 24);
+  EXPECT_TRUE(resources.global_vars.global_var_map().contains(
+      std::string(globalvars::FMT_STRINGS_BUFFER)));
 }
 
-TEST(resource_analyser, fmt_string_args_size_strings)
+TEST(resource_analyser, fmt_string_args_no_strings)
 {
   RequiredResources resources;
-  test(
-      R"(begin { printf("%dst: %sa; %dnd: %sb;; %drd: %sc;;; %dth: %sd;;;;\n", 1, "a", 2, "ab", 3, "abc", 4, "abcd") })",
-      true,
-      &resources);
-  EXPECT_EQ(resources.max_fmtstring_args_size, 32);
+  test(R"(begin { printf("%d %d", 3, 4) })", true, &resources);
+  EXPECT_EQ(resources.max_fmtstring_args_size, 0);
 }
 
-TEST(resource_analyser, fmt_string_args_non_map_print_int)
+TEST(resource_analyser, recursion_prevention_global)
 {
+  auto bpftrace = get_mock_bpftrace();
   RequiredResources resources;
-  test(R"(begin { print(5) })", true, &resources);
-  EXPECT_EQ(resources.max_fmtstring_args_size, 17);
+  test(*bpftrace, "kprobe:f { 1 }", true, &resources);
+  EXPECT_FALSE(resources.global_vars.global_var_map().contains(
+      std::string(globalvars::RECURSION_PREVENTION)));
+
+  bpftrace->need_recursion_check_ = true;
+  test(*bpftrace, "kprobe:f { 1 }", true, &resources);
+  EXPECT_TRUE(resources.global_vars.global_var_map().contains(
+      std::string(globalvars::RECURSION_PREVENTION)));
 }
 
-TEST(resource_analyser, fmt_string_args_non_map_print_arr)
+TEST(resource_analyser, rotated_maps)
 {
   RequiredResources resources;
-  test(
-      R"(struct Foo { char a[24]; } begin { print(5); $foo = (struct Foo *)0; print($foo->a) })",
-      true,
-      &resources);
-
-  // See clang_parser.cpp; the increase signal well-formedness.
-  EXPECT_EQ(resources.max_fmtstring_args_size, 40U + 1U);
+  test("kprobe:f { @a = count(); @b = count(); clear(@a); }", true, &resources);
+  EXPECT_EQ(resources.rotated_maps, 0);
+  EXPECT_FALSE(resources.global_vars.global_var_map().contains(
+      std::string(globalvars::MAP_ROTATION)));
+
+  test("kprobe:f { @a = count(); @b = count(); rotate(@b); rotate(@b); }",
+       true,
+       &resources);
+  EXPECT_EQ(resources.rotated_maps, 1);
+  EXPECT_EQ(resources.maps_info.at("@a").rotation_index, -1);
+  EXPECT_EQ(resources.maps_info.at("@b").rotation_index, 0);
+  EXPECT_TRUE(resources.global_vars.global_var_map().contains(
+      std::string(globalvars::MAP_ROTATION)));
 }
 
 TEST(resource_analyser, print_non_map_print_correct_args_order)
@@ -0,0 +1,47 @@
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "symbolization_worker.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::symbolization_worker {
+
+TEST(SymbolizationWorker, results)
+{
+  SymbolizationWorker worker(4);
+  std::vector<std::future<std::string>> results;
+  for (int i = 0; i < 100; i++) {
+    results.push_back(worker.submit([i] { return std::to_string(i); }));
+  }
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(results[i].get(), std::to_string(i));
+  }
+}
+
+TEST(SymbolizationWorker, destroy_with_pending_jobs)
+{
+  std::atomic<int> ran = 0;
+  std::vector<std::future<std::string>> results;
+  {
+    SymbolizationWorker worker(1);
+    for (int i = 0; i < 100; i++) {
+      results.push_back(worker.submit([&ran] {
+        ran++;
+        return std::string();
+      }));
+    }
+  }
+  // Jobs that did not run are dropped.
+  int dropped = 0;
+  for (auto &result : results) {
+    try {
+      result.get();
+    } catch (const std::future_error &) {
+      dropped++;
+    }
+  }
+  EXPECT_EQ(ran + dropped, 100);
+}
+
+} // namespace bpftrace::test::symbolization_worker
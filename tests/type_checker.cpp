@@ -1010,6 +1010,15 @@ TEST_F(TypeCheckerTest, call_clear)
   test("kprobe:f { @x = count(); clear(@x) ? 0 : 1; }", Error{});
 }
 
+TEST_F(TypeCheckerTest, call_rotate)
+{
+  test("kprobe:f { @x = count(); rotate(@x); }");
+  test("kprobe:f { @x[1,2] = count(); rotate(@x); }");
+
+  test("kprobe:f { @x = count(); $y = rotate(@x); }", Error{});
+  test("kprobe:f { @x = count(); @[rotate(@x)] = 1; }", Error{});
+}
+
 TEST_F(TypeCheckerTest, call_zero)
 {
   test("kprobe:f { @x = count(); zero(@x); }");
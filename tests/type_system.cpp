@@ -119,6 +119,8 @@ TEST(TypeSystemTest, basic)
     "int main()",
     "void (*)(struct sock* sk, int how)",
     "void tcp_shutdown(struct sock* sk, int how)",
+    "void (*)(struct Foo2 foo2)",
+    "void value_arg(struct Foo2 foo2)",
     ".data..percpu",
   };
   for (const auto &v : types.global) {
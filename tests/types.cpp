@@ -73,6 +73,13 @@ TEST(types, to_str)
   stack_type2.mode = StackMode::build_id;
   EXPECT_EQ(to_str(CreateStack(false, stack_type2)), "ustack_build_id_20");
 
+  StackType stack_type3 = StackType();
+  stack_type3.interned = true;
+  auto interned = CreateStack(false, stack_type3);
+  EXPECT_EQ(to_str(interned), "ustack_bpftrace_127_interned");
+  EXPECT_EQ(interned.GetSize(), 24);
+  EXPECT_EQ(CreateStackFrames(interned), CreateStack(false));
+
   EXPECT_EQ(to_str(CreateTimestamp()), "timestamp");
   EXPECT_EQ(to_str(CreateKSym()), "ksym_t");
   EXPECT_EQ(to_str(CreateUSym()), "usym_t");
@@ -86,4 +93,29 @@ TEST(types, to_str)
   EXPECT_EQ(to_str(CreateVoid()), "void");
 }
 
+TEST(types, interned_names)
+{
+  auto a = CreateCStruct("struct task_struct");
+  auto b = CreateCStruct(std::string("struct ") + "task_struct");
+  auto c = CreateCStruct("struct mm_struct");
+
+  // Types with the same name share the same interned name.
+  EXPECT_EQ(&a.GetName(), &b.GetName());
+  EXPECT_NE(&a.GetName(), &c.GetName());
+  EXPECT_EQ(a, b);
+  EXPECT_NE(a, c);
+  EXPECT_TRUE(a.IsCompatible(b));
+  EXPECT_FALSE(a.IsCompatible(c));
+  EXPECT_TRUE(a.IsCStructTy());
+
+  auto copy = a;
+  EXPECT_EQ(&copy.GetName(), &a.GetName());
+
+  EXPECT_TRUE(CreateInt32().GetName().empty());
+  EXPECT_FALSE(CreateInt32().IsEnumTy());
+  EXPECT_TRUE(CreateEnum(32, "foo").IsEnumTy());
+  EXPECT_EQ(CreateEnum(32, "foo"), CreateEnum(32, "foo"));
+  EXPECT_NE(CreateEnum(32, "foo"), CreateEnum(32, "bar"));
+}
+
 } // namespace bpftrace::test::types
@@ -0,0 +1,80 @@
+#include "ast/passes/unroll_lowering.h"
+#include "ast/passes/collect_nodes.h"
+#include "mocks.h"
+#include "parser.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::unroll_lowering {
+
+static void test(const std::string &input,
+                 bool lowered,
+                 bool has_loop_feature = true)
+{
+  auto mock_bpftrace = get_mock_bpftrace();
+  BPFtrace &bpftrace = *mock_bpftrace;
+  bpftrace.feature_ = std::make_unique<MockBPFfeature>(has_loop_feature);
+
+  ast::ASTContext ast("stdin", input);
+  auto ok = ast::PassManager()
+                .put(ast)
+                .put(bpftrace)
+                .add(CreateParsePass())
+                .add(ast::CreateUnrollLoweringPass())
+                .run();
+  ASSERT_TRUE(ok && ast.diagnostics().ok());
+
+  ast::CollectNodes<ast::Unroll> unrolls;
+  unrolls.visit(ast.root);
+  ast::CollectNodes<ast::For> loops;
+  loops.visit(ast.root);
+
+  EXPECT_EQ(unrolls.nodes().size(), lowered ? 0 : 1) << input;
+  EXPECT_EQ(loops.nodes().size(), lowered ? 1 : 0) << input;
+  if (lowered) {
+    const ast::For &f = loops.nodes().front();
+    ASSERT_TRUE(f.iterable.is<ast::Range>());
+    EXPECT_EQ(f.iterable.as<ast::Range>()->end.as<ast::Integer>()->value, 100);
+  }
+}
+
+TEST(unroll_lowering, large_body)
+{
+  test(R"(kprobe:f { $a = 0; unroll(100) { $a = $a + 1; @x[$a] = $a * 2; } })",
+       true);
+}
+
+TEST(unroll_lowering, small_body)
+{
+  test(R"(kprobe:f { $a = 0; unroll(2) { $a = $a + 1; } })", false);
+}
+
+TEST(unroll_lowering, no_loop_feature)
+{
+  test(R"(kprobe:f { $a = 0; unroll(100) { $a = $a + 1; @x[$a] = $a * 2; } })",
+       false,
+       false);
+}
+
+TEST(unroll_lowering, jumps)
+{
+  test(R"(kprobe:f { $a = 0; unroll(100) { $a = $a + 1; if ($a > 5) { return; } @x[$a] = $a * 2; } })",
+       false);
+  test(R"(kprobe:f { $a = 0; while ($a < 200) { unroll(100) { $a = $a + 1; if ($a > 5) { break; } @x[$a] = $a * 2; } } })",
+       false);
+}
+
+TEST(unroll_lowering, ctx_access)
+{
+  test(R"(kprobe:f { $a = 0; unroll(100) { $a = $a + 1; @x[$a] = arg0; } })",
+       false);
+  test(R"(kprobe:f { $a = 0; unroll(100) { $a = $a + 1; @x[kstack()] = $a; } })",
+       false);
+}
+
+TEST(unroll_lowering, invalid_count)
+{
+  test(R"(kprobe:f { $a = 0; unroll(101) { $a = $a + 1; @x[$a] = $a * 2; } })",
+       false);
+}
+
+} // namespace bpftrace::test::unroll_lowering
@@ -0,0 +1,77 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "usyms.h"
+#include "gtest/gtest.h"
+
+extern "C" __attribute__((noinline)) int usyms_test_function()
+{
+  asm volatile("");
+  return 42;
+}
+
+namespace bpftrace::test::usyms {
+
+static std::string resolve(Usyms &usyms, uint64_t addr, int pid)
+{
+  return usyms.resolve(addr, pid, "/proc/self/exe", false, false, false)
+      .front();
+}
+
+TEST(usyms, per_pid)
+{
+  Config config;
+  config.user_symbol_cache_type = UserSymbolCacheType::per_pid;
+  Usyms usyms(config);
+
+  // The test binary is usually position independent, so this only resolves
+  // if the mapping of the process is taken into account.
+  auto addr = reinterpret_cast<uint64_t>(&usyms_test_function);
+  EXPECT_EQ(resolve(usyms, addr, ::getpid()), "usyms_test_function");
+  EXPECT_EQ(resolve(usyms, addr + 1, ::getpid()), "usyms_test_function");
+}
+
+TEST(usyms, per_pid_shared_objects)
+{
+  Config config;
+  config.user_symbol_cache_type = UserSymbolCacheType::per_pid;
+  Usyms usyms(config);
+
+  auto addr = reinterpret_cast<uint64_t>(&usyms_test_function);
+  EXPECT_EQ(resolve(usyms, addr, ::getpid()), "usyms_test_function");
+  auto stats = usyms.stats();
+
+  // A forked child maps the same objects, so their symbols are reused.
+  pid_t child = fork();
+  ASSERT_GE(child, 0);
+  if (child == 0) {
+    pause();
+    _exit(0);
+  }
+  EXPECT_EQ(resolve(usyms, addr, child), "usyms_test_function");
+  EXPECT_EQ(usyms.stats().entries, stats.entries);
+  EXPECT_EQ(usyms.stats().hits, stats.hits + 1);
+
+  kill(child, SIGKILL);
+  waitpid(child, nullptr, 0);
+}
+
+TEST(usyms, per_pid_cache_bytes)
+{
+  Config config;
+  config.user_symbol_cache_type = UserSymbolCacheType::per_pid;
+  config.max_user_symbol_cache_bytes = 1;
+  Usyms usyms(config);
+
+  // A table over the limit is still used to resolve, but not kept along with
+  // the next one.
+  auto addr = reinterpret_cast<uint64_t>(&usyms_test_function);
+  EXPECT_EQ(resolve(usyms, addr, ::getpid()), "usyms_test_function");
+  EXPECT_EQ(usyms.stats().entries, 1);
+  resolve(usyms, reinterpret_cast<uint64_t>(&::getpid), ::getpid());
+  EXPECT_EQ(usyms.stats().entries, 1);
+  EXPECT_EQ(usyms.stats().evictions, 1);
+}
+
+} // namespace bpftrace::test::usyms
@@ -12,6 +12,7 @@
 #include "util/bpf_names.h"
 #include "util/cgroup.h"
 #include "util/gfp_flags.h"
+#include "util/lru_cache.h"
 #include "util/math.h"
 #include "util/paths.h"
 #include "util/similar.h"
@@ -525,6 +526,43 @@ TEST(utils, round_up_to_next_power_of_two)
   ASSERT_EQ(round_up_to_next_power_of_two(max_power_of_two), max_power_of_two);
 }
 
+TEST(utils, lru_cache)
+{
+  LRUCache<int, std::string> cache(2);
+  EXPECT_EQ(cache.find(1), nullptr);
+
+  cache.insert(1, "one");
+  cache.insert(2, "two");
+  ASSERT_NE(cache.find(1), nullptr);
+  EXPECT_EQ(*cache.find(1), "one");
+
+  // 2 is now the least recently used entry.
+  cache.insert(3, "three");
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.evictions(), 1);
+  EXPECT_EQ(cache.find(2), nullptr);
+  EXPECT_NE(cache.find(1), nullptr);
+  EXPECT_NE(cache.find(3), nullptr);
+
+  cache.insert(3, "drei");
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.evictions(), 1);
+  EXPECT_EQ(*cache.find(3), "drei");
+
+  // 1 is now the least recently used entry.
+  ASSERT_NE(cache.least_recent(), nullptr);
+  EXPECT_EQ(*cache.least_recent(), "one");
+  cache.evict_least_recent();
+  EXPECT_EQ(cache.size(), 1);
+  EXPECT_EQ(cache.evictions(), 2);
+  EXPECT_EQ(cache.find(1), nullptr);
+
+  cache.clear();
+  EXPECT_EQ(cache.least_recent(), nullptr);
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(cache.find(1), nullptr);
+}
+
 TEST(utils, similar)
 {
   // This is not well-defined, and therefore we cannot include whitebox tests